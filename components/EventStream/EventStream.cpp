@@ -0,0 +1,177 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <lwip/sockets.h>
+#include <esp_timer.h>
+#include "EventStream.h"
+#include "Logger.h"
+
+// the response has no length and isn't chunked, it lasts until the connection is closed
+static const char responseHeader[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n";
+
+EventStream::EventStream()
+{
+    mutex = xSemaphoreCreateMutex();
+    for (client_t &client : clients)
+    {
+        client.stream = this;
+        client.state = ClientState::Free;
+    }
+    droppedClients = 0;
+}
+
+esp_err_t EventStream::handleRequest(httpd_req_t *req)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    client_t *client = nullptr;
+    for (client_t &c : clients)
+    {
+        if (c.state == ClientState::Free)
+        {
+            client = &c;
+            break;
+        }
+    }
+    if (!client)
+    {
+        xSemaphoreGive(mutex);
+        LOG_W("Too many event stream clients");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, "Too many clients", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    client->state = ClientState::Connected;
+    client->server = req->handle;
+    client->fd = httpd_req_to_sockfd(req);
+    client->length = 0;
+    // the header goes through the buffer too, so it is sent before any event
+    enqueue(*client, responseHeader, sizeof(responseHeader) - 1);
+    flush(*client);
+    xSemaphoreGive(mutex);
+
+    // the server tells us when the connection is closed by freeing the context of the session
+    req->sess_ctx = client;
+    req->free_ctx = sessionClosed;
+    LOG_D("Event stream client connected");
+    return ESP_OK;
+}
+
+void EventStream::publish(const char *event, const char *data)
+{
+    char message[256];
+    int length = snprintf(message, sizeof(message), "event: %s\ndata: %s\n\n", event, data);
+    if (length >= (int) sizeof(message))
+    {
+        LOG_E("Event too long: %s", event);
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (client_t &client : clients)
+    {
+        if (client.state != ClientState::Connected)
+            continue;
+        if (enqueue(client, message, length))
+            flush(client);
+    }
+    xSemaphoreGive(mutex);
+}
+
+size_t EventStream::getClientCount()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    size_t count = 0;
+    for (const client_t &client : clients)
+        if (client.state == ClientState::Connected)
+            count++;
+    xSemaphoreGive(mutex);
+    return count;
+}
+
+uint32_t EventStream::getDroppedClients()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint32_t dropped = droppedClients;
+    xSemaphoreGive(mutex);
+    return dropped;
+}
+
+void EventStream::sessionClosed(void *context)
+{
+    client_t *client = static_cast<client_t *>(context);
+    EventStream *stream = client->stream;
+    xSemaphoreTake(stream->mutex, portMAX_DELAY);
+    client->state = ClientState::Free;
+    xSemaphoreGive(stream->mutex);
+    LOG_D("Event stream client disconnected");
+}
+
+bool EventStream::enqueue(client_t &client, const char *data, size_t length)
+{
+    if (client.length + length > sizeof(client.buffer))
+    {
+        LOG_W("Event stream client is too slow, disconnecting it");
+        droppedClients++;
+        drop(client);
+        return false;
+    }
+    memcpy(client.buffer + client.length, data, length);
+    client.length += length;
+    return true;
+}
+
+void EventStream::flush(client_t &client)
+{
+    while (client.length > 0)
+    {
+        int sent = send(client.fd, client.buffer, client.length, MSG_DONTWAIT);
+        if (sent > 0)
+        {
+            memmove(client.buffer, client.buffer + sent, client.length - sent);
+            client.length -= sent;
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // the socket's send buffer is full, the rest stays in our buffer until the next event
+            return;
+        }
+        else
+        {
+            LOG_D("Error sending to event stream client: %d", errno);
+            drop(client);
+            return;
+        }
+    }
+}
+
+void EventStream::drop(client_t &client)
+{
+    client.state = ClientState::Closing;
+    client.length = 0;
+    httpd_sess_trigger_close(client.server, client.fd);
+}
@@ -0,0 +1,85 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVENTSTREAM_H
+#define EVENTSTREAM_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_http_server.h>
+
+/* Server-Sent Events stream served by esp_http_server
+ * the connections of the clients are kept open after the request, and the events are written to their sockets without blocking
+ * each client has a buffer for the events that couldn't be sent yet; when it fills up, the client is too slow and it is disconnected,
+ * so publishing an event never waits for a client
+ */
+class EventStream
+{
+public:
+
+    static const size_t maxClients = 4;
+    static const size_t clientBufferSize = 1024;
+
+    EventStream();
+
+    // handles a request to the stream: adds the client, or responds with 503 if there are already maxClients
+    esp_err_t handleRequest(httpd_req_t *req);
+
+    // sends an event to every client, data must not contain new lines
+    void publish(const char *event, const char *data);
+
+    size_t getClientCount();
+
+    // the number of clients disconnected because they were too slow
+    uint32_t getDroppedClients();
+
+private:
+
+    enum class ClientState
+    {
+        Free,
+        Connected,
+        Closing  // the session is being closed by the server, the slot can't be reused until it is
+    };
+
+    struct client_t
+    {
+        EventStream *stream;
+        ClientState state;
+        httpd_handle_t server;
+        int fd;
+        size_t length;
+        char buffer[clientBufferSize];
+    };
+
+    // called by the server when the session of a client is closed
+    static void sessionClosed(void *context);
+
+    // the following are called with the mutex taken
+    bool enqueue(client_t &client, const char *data, size_t length);
+    void flush(client_t &client);
+    void drop(client_t &client);
+
+    client_t clients[maxClients];
+    uint32_t droppedClients;
+
+    SemaphoreHandle_t mutex;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Executor.h"
+
+Executor::Executor() : jobCount(0), task(nullptr)
+{
+}
+
+int Executor::addJob(const char *name, JobFunction function, TickType_t firstDelay)
+{
+    if (jobCount >= maxJobs)
+        return -1;
+    job_t &job = jobs[jobCount];
+    job.name = name;
+    job.function = function;
+    job.start = xTaskGetTickCount();
+    job.delay = firstDelay;
+    job.notified = false;
+    return jobCount++;
+}
+
+void Executor::notify(int job)
+{
+    if (job < 0 || (size_t) job >= jobCount)
+        return;
+    jobs[job].notified = true;
+    TaskHandle_t handle = task;
+    if (handle)
+        xTaskNotifyGive(handle);
+}
+
+void Executor::run()
+{
+    task = xTaskGetCurrentTaskHandle();
+    while (true)
+    {
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+        bool ran = false;
+        for (size_t i = 0; i < jobCount; i++)
+        {
+            job_t &job = jobs[i];
+            bool notified = job.notified.exchange(false);
+            bool timerExpired = job.delay != portMAX_DELAY && (TickType_t) (now - job.start) >= job.delay;
+            if (!notified && !timerExpired)
+            {
+                if (job.delay != portMAX_DELAY && job.delay - (now - job.start) < wait)
+                    wait = job.delay - (now - job.start);
+                continue;
+            }
+
+            TickType_t nextDelay = job.function(notified);
+            if (timerExpired)
+            {
+                // periodic jobs don't drift, unless they fell behind by a whole period
+                job.start += job.delay;
+                if ((TickType_t) (xTaskGetTickCount() - job.start) >= nextDelay)
+                    job.start = xTaskGetTickCount();
+            }
+            else
+            {
+                job.start = xTaskGetTickCount();
+            }
+            job.delay = nextDelay;
+            ran = true;
+            break;
+        }
+        if (ran)
+            continue;
+        // the notifications of all jobs wake up the task, the flags tell which one
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
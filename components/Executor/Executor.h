@@ -0,0 +1,70 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+
+/* runs several jobs cooperatively on one task, instead of giving each of them its own task and stack
+ * a job is a function that does one step of work and returns the number of ticks after which it should run again
+ * (portMAX_DELAY if it should only run when notified)
+ * a job runs when its timer expires or when it is notified from another task
+ * jobs added first have priority: after every step the executor starts again with the first job that is due
+ */
+class Executor
+{
+public:
+
+    // notified is true if the job was notified since its last step
+    typedef TickType_t (*JobFunction)(bool notified);
+
+    static const size_t maxJobs = 4;
+
+    Executor();
+
+    // firstDelay - ticks until the first step, portMAX_DELAY if it should wait for a notification
+    // returns the id of the job, used for notify(), or -1 if there is no room for it
+    int addJob(const char *name, JobFunction function, TickType_t firstDelay);
+
+    // makes the job run as soon as the jobs before it are done, can be called from any task
+    void notify(int job);
+
+    // runs the jobs forever on the calling task
+    void run();
+
+private:
+
+    struct job_t
+    {
+        const char *name;
+        JobFunction function;
+        TickType_t start;  // the delay is counted from here
+        TickType_t delay;
+        std::atomic<bool> notified;
+    };
+
+    job_t jobs[maxJobs];
+    size_t jobCount;
+    std::atomic<TaskHandle_t> task;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include "Arena.h"
+
+static const size_t alignment = 8;
+
+Arena::Arena()
+{
+    buffer = nullptr;
+    capacity = 0;
+    used = 0;
+    peak = 0;
+}
+
+bool Arena::begin(size_t capacity)
+{
+    if (buffer && this->capacity == capacity)
+    {
+        reset();
+        return true;
+    }
+    free(buffer);
+    buffer = (char *) malloc(capacity);
+    this->capacity = buffer ? capacity : 0;
+    used = 0;
+    return buffer != nullptr;
+}
+
+void *Arena::allocate(size_t size)
+{
+    size_t start = (used + alignment - 1) & ~(alignment - 1);
+    if (start > capacity || size > capacity - start)
+        return nullptr;
+    used = start + size;
+    if (used > peak)
+        peak = used;
+    return buffer + start;
+}
+
+char *Arena::printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t available = getAvailable();
+    char *result = (char *) allocate(0);
+    int length = result ? vsnprintf(result, available, format, args) : -1;
+    va_end(args);
+    if (length < 0 || (size_t) length >= available)
+        return nullptr;
+    allocate(length + 1);
+    return result;
+}
+
+size_t Arena::getAvailable()
+{
+    size_t start = (used + alignment - 1) & ~(alignment - 1);
+    return start < capacity ? capacity - start : 0;
+}
+
+size_t Arena::getPeak()
+{
+    return peak;
+}
+
+void Arena::reset()
+{
+    used = 0;
+}
+
+Arena::~Arena()
+{
+    free(buffer);
+}
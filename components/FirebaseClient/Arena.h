@@ -0,0 +1,64 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+
+/* a buffer allocated once, handed out from its start and freed all at once by reset()
+ * the allocations of a request or of a stream connection come from an arena instead of the heap,
+ * so they can't fragment it, however long the device runs
+ */
+class Arena
+{
+public:
+
+    Arena();
+
+    // allocates the buffer, returns false if it can't
+    bool begin(size_t capacity);
+
+    // returns nullptr if there isn't enough room left, the result is aligned for any type
+    void *allocate(size_t size);
+
+    // like asprintf, returns nullptr if the result doesn't fit
+    char *printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    // (bytes) the room left
+    size_t getAvailable();
+
+    // (bytes) the most that was ever used, to know if the capacity is right
+    size_t getPeak();
+
+    // frees everything that was allocated, the pointers handed out are no longer valid
+    void reset();
+
+    ~Arena();
+
+private:
+
+    char *buffer;
+    size_t capacity;
+    size_t used;
+    size_t peak;
+};
+
+#endif
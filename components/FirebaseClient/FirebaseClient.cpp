@@ -17,61 +17,113 @@
     along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include <Stream.h>
-#include <StreamString.h>
-#include <esp_http_client.h>
+#include <cstring>
+#include <algorithm>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include "FirebaseClient.h"
 #include "Logger.h"
+#include "Trace.h"
+#include "TlsMemory.h"
 
-static esp_err_t http_event_handler(esp_http_client_event_handle_t event)
+// the heap used by a connection is estimated as the difference of free heap from before connecting until the handshake is done
+static void updateTlsPeakUsage(size_t freeHeapBefore, size_t &tlsPeakUsage)
 {
-    if (event->event_id == HTTP_EVENT_ON_DATA)
+    size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (freeHeapBefore > freeHeap && freeHeapBefore - freeHeap > tlsPeakUsage)
+        tlsPeakUsage = freeHeapBefore - freeHeap;
+}
+
+esp_err_t FirebaseClient::httpEventHandler(esp_http_client_event_t *event)
+{
+    auto *client = static_cast<FirebaseClient *>(event->user_data);
+    if (event->event_id == HTTP_EVENT_ON_CONNECTED)
     {
-        if (event->user_data)
-        {
-            auto sstring = static_cast<StreamString *>(event->user_data);
-            sstring->write(static_cast<const uint8_t *>(event->data), event->data_len);
-        }
+        TRACE_END(TraceSpan::TlsHandshake);
+        client->connected = true;
+        updateTlsPeakUsage(client->freeHeapBefore, client->tlsPeakUsage);
+    }
+    else if (event->event_id == HTTP_EVENT_ON_DATA)
+    {
+        // the terminating null always fits
+        size_t length = std::min<size_t>(event->data_len, client->responseCapacity - client->responseLength - 1);
+        memcpy(client->response + client->responseLength, event->data, length);
+        client->responseLength += length;
+        client->response[client->responseLength] = 0;
+        if (length < (size_t) event->data_len)
+            client->responseTruncated = true;
     }
     return ESP_OK;
 }
 
-FirebaseClient::FirebaseClient()
+FirebaseClient::FirebaseClient(size_t requestArenaSize) : requestArenaSize(requestArenaSize)
 {
     errorMutex = xSemaphoreCreateMutex();
+    tlsPeakUsage = 0;
+    streamConnects = 0;
+    streamingHost[0] = 0;
+    streamingPathWithQuery[0] = 0;
+    client = nullptr;
+    response = nullptr;
+    responseLength = 0;
+    responseCapacity = 0;
+    responseTruncated = false;
+    freeHeapBefore = 0;
+    connected = false;
 }
 
 void FirebaseClient::begin(const char *rootCert, const char *url, const char *secret, const char *streamingPath)
 {
-    free(streamingPathWithQuery);
-    free(streamingHost);
     setError(false);
     if (streaming_tls)
         closeStream();
     rootCA = rootCert;
     firebaseURL = url;
     snprintf(query, sizeof(query), "auth=%s", secret);
-    int ret = asprintf(&streamingPathWithQuery, "%s?%s", streamingPath, query);
-    if (ret == -1)
+    int ret = snprintf(streamingPathWithQuery, sizeof(streamingPathWithQuery), "%s?%s", streamingPath, query);
+    if (ret < 0 || (size_t) ret >= sizeof(streamingPathWithQuery))
     {
-        LOG_E("Could not allocate streamingPathWithQuery");
+        LOG_E("streamingPathWithQuery is too long");
+        abort();
+    }
+    // allocated here, before the heap has a chance to fragment
+    if (!requestArena.begin(requestArenaSize) || !streamArena.begin(streamArenaSize))
+    {
+        LOG_E("Could not allocate the arenas");
+        abort();
+    }
+    if (client)
+        esp_http_client_cleanup(client);
+    esp_http_client_config_t config = {};
+    config.cert_pem = rootCA;
+    config.host = firebaseURL;
+    config.path = "/";
+    config.transport_type = HTTP_TRANSPORT_OVER_SSL;
+    config.event_handler = httpEventHandler;
+    config.user_data = this;
+    client = esp_http_client_init(&config);
+    if (!client)
+    {
+        LOG_E("Could not allocate the HTTP client");
         abort();
     }
 }
 
 FirebaseClient::~FirebaseClient()
 {
-    free(streamingPathWithQuery);
-    free(streamingHost);
+    if (client)
+        esp_http_client_cleanup(client);
     vQueueDelete(errorMutex);
 }
 
 bool FirebaseClient::internal_initializeStream(const char *pathWithQuery, const char *location, bool locationIsURL)
 {
+    TLS_MEMORY_SCOPE(TlsConnection::Stream);
     esp_tls_cfg_t cfg = {};
     cfg.cacert_pem_buf = (const unsigned char *) rootCA;
     cfg.cacert_pem_bytes = strlen(rootCA) + 1;
     cfg.non_block = true;
+    size_t freeHeapBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
     streaming_tls = esp_tls_init();
     if (!streaming_tls)
     {
@@ -82,7 +134,7 @@ bool FirebaseClient::internal_initializeStream(const char *pathWithQuery, const
     if (!location)
     {
         // we use the last used host
-        if (!streamingHost)
+        if (!streamingHost[0])
         {
             LOG_D("First initialization must have host");
             return false;
@@ -90,25 +142,22 @@ bool FirebaseClient::internal_initializeStream(const char *pathWithQuery, const
         location = streamingHost;
         locationIsURL = false;
     }
-    else
-    {
-        free(streamingHost);
-        streamingHost = strdup(location);
-    }
     int ret;
+    TRACE_BEGIN(TraceSpan::TlsHandshake);
     while ((ret = locationIsURL ?
         esp_tls_conn_http_new_async(location, &cfg, streaming_tls) 
         : esp_tls_conn_new_async(location, strlen(location), 443, &cfg, streaming_tls)) == 0)
     {
         delay(50);
     }
+    TRACE_END(TraceSpan::TlsHandshake);
     if (ret != 1)
     {
         LOG_D("Connection failed");
         return false;
     }
     LOG_T("Connection established");
-    char *request;
+    updateTlsPeakUsage(freeHeapBefore, tlsPeakUsage);
     size_t hostLength;
     const char *host = location;
     if (locationIsURL)
@@ -127,11 +176,23 @@ bool FirebaseClient::internal_initializeStream(const char *pathWithQuery, const
     {
         hostLength = strlen(location);
     }
-    
-    ret = asprintf(&request, "GET %s HTTP/1.1\r\nHost: %.*s\r\nUser-Agent: ThermostatESP32\r\nAccept: text/event-stream\r\n\r\n", pathWithQuery, hostLength, host);
-    if (ret == -1)
+    if (host != streamingHost)
+    {
+        if (hostLength >= sizeof(streamingHost))
+        {
+            LOG_D("Host is too long");
+            return false;
+        }
+        memcpy(streamingHost, host, hostLength);
+        streamingHost[hostLength] = 0;
+    }
+
+    // the request line of the previous connection isn't needed anymore
+    streamArena.reset();
+    char *request = streamArena.printf("GET %s HTTP/1.1\r\nHost: %.*s\r\nUser-Agent: ThermostatESP32\r\nAccept: text/event-stream\r\n\r\n", pathWithQuery, (int) hostLength, host);
+    if (!request)
     {
-        LOG_D("Could not allocate request");
+        LOG_D("Request doesn't fit in the stream arena");
         return false;
     }
     LOG_T("Sending request");
@@ -146,11 +207,10 @@ bool FirebaseClient::internal_initializeStream(const char *pathWithQuery, const
         else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
         {
             LOG_D("esp_tls_conn_write error: -%X", -ret);
-            free(request);
             return false;
         }
     } while (written_bytes < strlen(request));
-    free(request);
+    streamConnects++;
     return true;
 }
 
@@ -177,6 +237,7 @@ void FirebaseClient::initializeStream()
 
 bool FirebaseClient::consumeStreamIfAvailable()
 {
+    TLS_MEMORY_SCOPE(TlsConnection::Stream);
     // declared here to avoid "jump to label 'error' crosses initialization" error
     int ret;
     const char *event;
@@ -190,7 +251,9 @@ bool FirebaseClient::consumeStreamIfAvailable()
         goto error;
     }
 
+    TRACE_BEGIN(TraceSpan::StreamRead);
     ret = esp_tls_conn_read(streaming_tls, streaming_buf, sizeof(streaming_buf) - 1);
+    TRACE_END(TraceSpan::StreamRead);
     if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
         return false;
     if (ret < 0)
@@ -373,58 +436,106 @@ void FirebaseClient::setError(bool value)
 
 void FirebaseClient::getJson(const char *path, String &result)
 {
-    StreamString sstring;
-    sendRequest(HTTP_METHOD_GET, path, nullptr, &sstring);
-    if (!getError())
+    const char *body = sendRequest(HTTP_METHOD_GET, path, nullptr);
+    if (body)
     {
-        result = sstring.readString();
+        result = body;
     }
 }
 
+size_t FirebaseClient::takeTlsPeakUsage()
+{
+    size_t peak = tlsPeakUsage;
+    tlsPeakUsage = 0;
+    return peak;
+}
+
+uint32_t FirebaseClient::getStreamConnects()
+{
+    return streamConnects;
+}
+
+LatencyHistogram &FirebaseClient::getRequestLatencies()
+{
+    return requestLatencies;
+}
+
+size_t FirebaseClient::getRequestArenaPeak()
+{
+    return requestArena.getPeak();
+}
+
+size_t FirebaseClient::getStreamArenaPeak()
+{
+    return streamArena.getPeak();
+}
+
 void FirebaseClient::setJson(const char *path, const char *data)
 {
-    sendRequest(HTTP_METHOD_PUT, path, data, nullptr);
+    sendRequest(HTTP_METHOD_PUT, path, data);
 }
 
 void FirebaseClient::pushJson(const char *path, const char *data)
 {
-    sendRequest(HTTP_METHOD_POST, path, data, nullptr);
+    sendRequest(HTTP_METHOD_POST, path, data);
 }
 
-void FirebaseClient::sendRequest(int method, const char *path, const char *data, void *responseReceiver)
+const char *FirebaseClient::sendRequest(int method, const char *path, const char *data)
 {
-    esp_http_client_config_t config = {};
-    config.cert_pem = rootCA;
-    config.host = firebaseURL;
-    config.path = path;
-    config.query = query;
-    config.transport_type = HTTP_TRANSPORT_OVER_SSL;
-    config.event_handler = http_event_handler;
-    config.user_data = responseReceiver;
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    TLS_MEMORY_SCOPE(TlsConnection::Rest);
+    // the URL and the response of the previous request aren't needed anymore
+    requestArena.reset();
+    const char *url = requestArena.printf("https://%s%s?%s", firebaseURL, path, query);
+    // the arena is sized for a response of its capacity minus maxUrlSize
+    if (!url || strlen(url) >= maxUrlSize)
+    {
+        LOG_E("URL is longer than maxUrlSize");
+        setError(true);
+        return nullptr;
+    }
+    // the response gets the rest of the arena
+    responseCapacity = requestArena.getAvailable();
+    response = (char *) requestArena.allocate(responseCapacity);
+    responseLength = 0;
+    response[0] = 0;
+    responseTruncated = false;
+    freeHeapBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    connected = false;
+    esp_http_client_set_url(client, url);
     esp_http_client_set_method(client, (esp_http_client_method_t) method);
-    if (data)
-        esp_http_client_set_post_field(client, data, strlen(data));
+    esp_http_client_set_post_field(client, data, data ? strlen(data) : 0);
     LOG_T("Starting connection");
+    // the handshake span ends in httpEventHandler, when the connection is established
+    TRACE_BEGIN(TraceSpan::TlsHandshake);
+    int64_t start = esp_timer_get_time();
     esp_err_t err = esp_http_client_perform(client);
+    requestLatencies.record((esp_timer_get_time() - start) / 1000);
+    if (!connected)
+        TRACE_END(TraceSpan::TlsHandshake);
+    bool success = false;
     if (err == ESP_OK)
     {
         int code = esp_http_client_get_status_code(client);
-        if (code == 200)
+        if (code != 200)
         {
-            LOG_T("Request was successful");
-            setError(false);
+            LOG_D("Server returned status code: %d", code);
+        }
+        else if (responseTruncated)
+        {
+            LOG_E("Response doesn't fit in the request arena");
         }
         else
         {
-            LOG_D("Server returned status code: %d", code);
-            setError(true);
+            LOG_T("Request was successful");
+            success = true;
         }
     }
     else
     {
         LOG_D("Connection failed with error: %d, %s", err, esp_err_to_name(err));
-        setError(true);
     }
-    esp_http_client_cleanup(client);
-}
\ No newline at end of file
+    setError(!success);
+    // the TLS buffers are only kept while a request is made, the client is kept for the next one
+    esp_http_client_close(client);
+    return success ? response : nullptr;
+}
@@ -22,12 +22,27 @@
 
 #include <Arduino.h>
 #include <esp_tls.h>
-
+#include <esp_http_client.h>
+#include <atomic>
+#include "LatencyHistogram.h"
+#include "Arena.h"
+
+/* the buffers of the client are allocated once, in begin():
+ * - the request line of the stream comes from an arena that is reset when the stream connects
+ * - the requests share one esp_http_client, whose connection is closed after each of them,
+ *   and the response is read into an arena that is reset when the next request starts
+ */
 class FirebaseClient
 {
 public:
 
-    FirebaseClient();
+    // (bytes) the stream arena holds its request line
+    static const size_t streamArenaSize = 512;
+    // (bytes) the most the URL of a request takes from the request arena, the rest is left for the response
+    static const size_t maxUrlSize = 256;
+
+    // (bytes) the request arena holds the URL and the response of a request, so it limits what getJson can receive
+    explicit FirebaseClient(size_t requestArenaSize);
 
     /* rootCert - TLS certificate of Firebase's authority (Google Trust Services)    
      * url - URL of database (example.firebaseio.com)
@@ -64,11 +79,29 @@ public:
 
     void pushJson(const char *path, const char *data);
 
+    /* returns the largest amount of heap used by a connection since the last call
+     * it is measured when the TLS handshake is done, so it includes the TLS buffers and the certificate chain
+     */
+    size_t takeTlsPeakUsage();
+
+    // the number of times the stream was connected, including redirects
+    uint32_t getStreamConnects();
+
+    // the durations of the requests made with getJson, setJson and pushJson
+    LatencyHistogram &getRequestLatencies();
+
+    // (bytes) the most used from the arenas, to know if their sizes are right
+    size_t getRequestArenaPeak();
+    size_t getStreamArenaPeak();
+
     ~FirebaseClient();
 
 private:
+    static esp_err_t httpEventHandler(esp_http_client_event_t *event);
+
     bool internal_initializeStream(const char *pathWithQuery, const char *location, bool locationIsURL);
-    void sendRequest(int method, const char *path, const char *data, void *responseReceiver);
+    // returns the response, or nullptr if the request failed
+    const char *sendRequest(int method, const char *path, const char *data);
 
     bool error;
     const char *rootCA;
@@ -76,13 +109,29 @@ private:
     char query[50];
 
     bool streamConnected;
-    char *streamingHost;
-    char *streamingPathWithQuery;
+    // the host of the last stream connection, used by relative redirects
+    char streamingHost[128];
+    char streamingPathWithQuery[128];
+    Arena streamArena;
     esp_tls_t *streaming_tls;
     char streaming_buf[512];
     TickType_t lastEvent;
     bool afterFirstEvent;
     bool insideEvent;
+    size_t tlsPeakUsage;
+
+    const size_t requestArenaSize;
+    Arena requestArena;
+    esp_http_client_handle_t client;
+    // the state of the current request, used by httpEventHandler
+    char *response;
+    size_t responseLength;
+    size_t responseCapacity;
+    bool responseTruncated;
+    size_t freeHeapBefore;
+    bool connected;
+    std::atomic<uint32_t> streamConnects;
+    LatencyHistogram requestLatencies;
 
     SemaphoreHandle_t errorMutex;
 };
@@ -0,0 +1,161 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include "HealthMonitor.h"
+
+// appends to buffer and keeps length pointing at the end of the string, even if it doesn't fit
+static void append(char *buffer, size_t size, int &length, const char *format, ...)
+{
+    size_t offset = (size_t) length < size ? length : size;
+    va_list args;
+    va_start(args, format);
+    length += vsnprintf(buffer + offset, size - offset, format, args);
+    va_end(args);
+}
+
+HealthMonitor::HealthMonitor()
+{
+    mutex = xSemaphoreCreateMutex();
+    heapWindows[0] = { MALLOC_CAP_8BIT, "heap" };
+    heapWindows[1] = { MALLOC_CAP_INTERNAL, "internal" };
+    heapWindows[2] = { MALLOC_CAP_DMA, "dma" };
+    taskCount = 0;
+    lastTotalRunTime = 0;
+    resetWindow();
+}
+
+void HealthMonitor::addTask(TaskHandle_t *task)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (taskCount < maxTasks)
+        tasks[taskCount++] = { task, 0 };
+    xSemaphoreGive(mutex);
+}
+
+TaskHandle_t HealthMonitor::getTask(size_t index)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    TaskHandle_t task = index < taskCount ? *tasks[index].handle : nullptr;
+    xSemaphoreGive(mutex);
+    return task;
+}
+
+void HealthMonitor::sample()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (heapWindow_t &window : heapWindows)
+    {
+        size_t freeSize = heap_caps_get_free_size(window.caps);
+        size_t largest = heap_caps_get_largest_free_block(window.caps);
+        if (freeSize < window.freeMin)
+            window.freeMin = freeSize;
+        if (freeSize > window.freeMax)
+            window.freeMax = freeSize;
+        if (largest < window.largestMin)
+            window.largestMin = largest;
+        if (largest > window.largestMax)
+            window.largestMax = largest;
+    }
+    xSemaphoreGive(mutex);
+}
+
+void HealthMonitor::recordTlsUsage(size_t bytes)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (bytes > tlsPeak)
+        tlsPeak = bytes;
+    xSemaphoreGive(mutex);
+}
+
+int HealthMonitor::toJson(char *buffer, size_t size)
+{
+    // the current values are part of the window too
+    sample();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int length = 0;
+
+    append(buffer, size, length, "{");
+    for (const heapWindow_t &window : heapWindows)
+    {
+        append(buffer, size, length, R"==("%s": {"free": [%u, %u], "largest": [%u, %u], "minFree": %u}, )==",
+            window.name, window.freeMin, window.freeMax, window.largestMin, window.largestMax,
+            heap_caps_get_minimum_free_size(window.caps));
+    }
+    append(buffer, size, length, R"==("tlsPeak": %u, "tasks": {)==", tlsPeak);
+
+#if configUSE_TRACE_FACILITY == 1 && configGENERATE_RUN_TIME_STATS == 1
+    // the CPU time is reported in permille of one core, over the window
+    UBaseType_t taskNumber = uxTaskGetNumberOfTasks();
+    TaskStatus_t *statuses = (TaskStatus_t *) malloc(taskNumber * sizeof(TaskStatus_t));
+    uint32_t totalRunTime = 0;
+    if (statuses)
+        taskNumber = uxTaskGetSystemState(statuses, taskNumber, &totalRunTime);
+    uint32_t windowRunTime = totalRunTime - lastTotalRunTime;
+    lastTotalRunTime = totalRunTime;
+#endif
+    bool first = true;
+    for (size_t i = 0; i < taskCount; i++)
+    {
+        TaskHandle_t handle = *tasks[i].handle;
+        if (!handle)
+            continue;
+        uint32_t cpu = 0;
+#if configUSE_TRACE_FACILITY == 1 && configGENERATE_RUN_TIME_STATS == 1
+        for (UBaseType_t j = 0; statuses && j < taskNumber; j++)
+        {
+            if (statuses[j].xHandle == handle)
+            {
+                uint32_t taskRunTime = statuses[j].ulRunTimeCounter - tasks[i].lastRunTime;
+                tasks[i].lastRunTime = statuses[j].ulRunTimeCounter;
+                if (windowRunTime > 0)
+                    cpu = (uint64_t) taskRunTime * 1000 / windowRunTime;
+                break;
+            }
+        }
+#endif
+        // in ESP-IDF, the stack high water mark is in bytes
+        append(buffer, size, length, R"==(%s"%s": {"stackFree": %u, "cpu": %u})==",
+            first ? "" : ", ", pcTaskGetTaskName(handle), uxTaskGetStackHighWaterMark(handle), cpu);
+        first = false;
+    }
+#if configUSE_TRACE_FACILITY == 1 && configGENERATE_RUN_TIME_STATS == 1
+    free(statuses);
+#endif
+    append(buffer, size, length, "}}");
+
+    resetWindow();
+    xSemaphoreGive(mutex);
+    return length;
+}
+
+void HealthMonitor::resetWindow()
+{
+    for (heapWindow_t &window : heapWindows)
+    {
+        window.freeMin = SIZE_MAX;
+        window.freeMax = 0;
+        window.largestMin = SIZE_MAX;
+        window.largestMax = 0;
+    }
+    tlsPeak = 0;
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEALTHMONITOR_H
+#define HEALTHMONITOR_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_heap_caps.h>
+
+/* collects the health of the firmware: stack high water marks and CPU time of tasks, heap usage per capability
+ * and the peak memory used by TLS connections
+ * the heap is sampled often (sample()), and the minimum and maximum of each window are kept
+ * a window ends every time the values are written with toJson()
+ */
+class HealthMonitor
+{
+public:
+
+    static const size_t maxTasks = 8;
+
+    HealthMonitor();
+
+    // the task will be reported by toJson(); it can be called before the task is created, with the variable that will hold its handle
+    void addTask(TaskHandle_t *task);
+
+    // returns the handle of a task added with addTask, or nullptr if it wasn't created yet or index is out of range
+    TaskHandle_t getTask(size_t index);
+
+    // samples the heap, it is cheap enough to be called a few times a second
+    void sample();
+
+    // records the memory used by a TLS connection, the maximum of the window is reported
+    void recordTlsUsage(size_t bytes);
+
+    /* writes the values collected in the current window as a JSON object to buffer and starts a new window
+     * returns the length of the string, like snprintf
+     */
+    int toJson(char *buffer, size_t size);
+
+private:
+
+    struct heapWindow_t
+    {
+        uint32_t caps;
+        const char *name;
+        size_t freeMin;
+        size_t freeMax;
+        size_t largestMin;
+        size_t largestMax;
+    };
+
+    struct taskInfo_t
+    {
+        TaskHandle_t *handle;
+        uint32_t lastRunTime;
+    };
+
+    void resetWindow();
+
+    heapWindow_t heapWindows[3];
+    taskInfo_t tasks[maxTasks];
+    size_t taskCount;
+    size_t tlsPeak;
+    uint32_t lastTotalRunTime;
+
+    SemaphoreHandle_t mutex;
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include "LatencyHistogram.h"
+
+// (ms) upper bounds of the buckets, the last bucket has no bound
+static const uint32_t bucketBounds[LatencyHistogram::bucketCount - 1] = { 10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 };
+
+LatencyHistogram::LatencyHistogram(uint32_t threshold) : threshold(threshold)
+{
+    mutex = xSemaphoreCreateMutex();
+    memset(buckets, 0, sizeof(buckets));
+    maximum = 0;
+    violations = 0;
+    memset(totalBuckets, 0, sizeof(totalBuckets));
+    totalSum = 0;
+    totalViolations = 0;
+}
+
+void LatencyHistogram::record(uint32_t latency)
+{
+    size_t bucket = 0;
+    while (bucket < bucketCount - 1 && latency > bucketBounds[bucket])
+        bucket++;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    buckets[bucket]++;
+    totalBuckets[bucket]++;
+    totalSum += latency;
+    if (latency > maximum)
+        maximum = latency;
+    if (latency > threshold)
+    {
+        violations++;
+        totalViolations++;
+    }
+    xSemaphoreGive(mutex);
+}
+
+int LatencyHistogram::toJson(char *buffer, size_t size)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int length = snprintf(buffer, size, R"==({"buckets": [%u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u], "max": %u, "slo": %u, "violations": %u})==",
+        buckets[0], buckets[1], buckets[2], buckets[3], buckets[4], buckets[5],
+        buckets[6], buckets[7], buckets[8], buckets[9], buckets[10], buckets[11],
+        maximum, threshold, violations);
+    memset(buckets, 0, sizeof(buckets));
+    maximum = 0;
+    violations = 0;
+    xSemaphoreGive(mutex);
+    return length;
+}
+
+uint32_t LatencyHistogram::getBucketBound(size_t bucket)
+{
+    return bucket < bucketCount - 1 ? bucketBounds[bucket] : UINT32_MAX;
+}
+
+void LatencyHistogram::getTotals(uint32_t (&totalBuckets)[bucketCount], uint64_t &totalSum, uint32_t &totalViolations)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    memcpy(totalBuckets, this->totalBuckets, sizeof(totalBuckets));
+    totalSum = this->totalSum;
+    totalViolations = this->totalViolations;
+    xSemaphoreGive(mutex);
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <cstdint>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/* counts latencies in buckets with fixed upper bounds, and the latencies that are over a threshold (the SLO)
+ * the buckets are: <= 10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 ms, and over 60000 ms
+ * the values are reported and cleared by toJson(), so each report covers the time since the previous one
+ * totals since boot are kept too, for scrapers that compute rates themselves
+ */
+class LatencyHistogram
+{
+public:
+
+    static const size_t bucketCount = 12;
+
+    // threshold - latencies over it are counted as violations (ms)
+    explicit LatencyHistogram(uint32_t threshold = UINT32_MAX);
+
+    void record(uint32_t latency);
+
+    /* writes the buckets, the maximum, the threshold and the number of violations as a JSON object to buffer, then clears them
+     * returns the length of the string, like snprintf
+     */
+    int toJson(char *buffer, size_t size);
+
+    // the upper bound of a bucket (ms), UINT32_MAX for the last one
+    static uint32_t getBucketBound(size_t bucket);
+
+    /* copies the totals since boot: the count of each bucket (not cumulative), the sum of the latencies (ms) and the number of violations
+     * they aren't cleared by toJson()
+     */
+    void getTotals(uint32_t (&totalBuckets)[bucketCount], uint64_t &totalSum, uint32_t &totalViolations);
+
+private:
+
+    uint32_t threshold;
+    uint32_t buckets[bucketCount];
+    uint32_t maximum;
+    uint32_t violations;
+
+    uint32_t totalBuckets[bucketCount];
+    uint64_t totalSum;
+    uint32_t totalViolations;
+
+    SemaphoreHandle_t mutex;
+};
+
+#endif
@@ -0,0 +1,259 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstring>
+#include <algorithm>
+#include "DeltaPatcher.h"
+#include "Logger.h"
+
+enum Command : uint8_t
+{
+    commandCopy = 1,
+    commandAdd = 2,
+    commandInsert = 3
+};
+
+const size_t DeltaPatcher::sourceBufferSize;
+
+DeltaPatcher::DeltaPatcher(output_t output, void *context) : output(output), context(context)
+{
+    source = nullptr;
+    memset(sourceSha256, 0, sizeof(sourceSha256));
+    state = State::Header;
+    pendingLength = 0;
+    pendingNeeded = headerSize;
+    sourceSize = 0;
+    targetSize = 0;
+    produced = 0;
+    commandOffset = 0;
+    commandRemaining = 0;
+}
+
+void DeltaPatcher::begin(const esp_partition_t *source, const uint8_t *sourceSha256)
+{
+    this->source = source;
+    memcpy(this->sourceSha256, sourceSha256, sizeof(this->sourceSha256));
+    state = State::Header;
+    pendingLength = 0;
+    pendingNeeded = headerSize;
+    sourceSize = 0;
+    targetSize = 0;
+    produced = 0;
+}
+
+esp_err_t DeltaPatcher::write(const uint8_t *data, size_t length)
+{
+    esp_err_t err;
+    while (length)
+    {
+        switch (state)
+        {
+        case State::Header:
+        case State::Command:
+        {
+            size_t count = std::min(pendingNeeded - pendingLength, length);
+            memcpy(pending + pendingLength, data, count);
+            pendingLength += count;
+            data += count;
+            length -= count;
+            if (pendingLength == pendingNeeded)
+            {
+                err = state == State::Header ? internal_parseHeader() : internal_parseCommand();
+                if (err != ESP_OK)
+                    return err;
+            }
+            break;
+        }
+        case State::Add:
+        {
+            size_t count = std::min<size_t>(std::min<size_t>(length, commandRemaining), sourceBufferSize);
+            err = esp_partition_read(source, commandOffset, sourceBuffer, count);
+            if (err != ESP_OK)
+            {
+                LOG_E("esp_partition_read error: %d", err);
+                return err;
+            }
+            for (size_t i = 0; i < count; i++)
+                sourceBuffer[i] += data[i];
+            err = output(context, sourceBuffer, count);
+            if (err != ESP_OK)
+                return err;
+            data += count;
+            length -= count;
+            commandOffset += count;
+            commandRemaining -= count;
+            produced += count;
+            if (!commandRemaining)
+                internal_nextCommand();
+            break;
+        }
+        case State::Insert:
+        {
+            size_t count = std::min<size_t>(length, commandRemaining);
+            err = output(context, data, count);
+            if (err != ESP_OK)
+                return err;
+            data += count;
+            length -= count;
+            commandRemaining -= count;
+            produced += count;
+            if (!commandRemaining)
+                internal_nextCommand();
+            break;
+        }
+        case State::Done:
+            LOG_E("Data after the end of the patch");
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    return ESP_OK;
+}
+
+bool DeltaPatcher::isDone()
+{
+    return state == State::Done;
+}
+
+uint32_t DeltaPatcher::getTargetSize()
+{
+    return targetSize;
+}
+
+uint32_t DeltaPatcher::internal_readUint32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+esp_err_t DeltaPatcher::internal_parseHeader()
+{
+    if (memcmp(pending, "TDP1", 4) != 0)
+    {
+        LOG_E("Not a patch");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    sourceSize = internal_readUint32(pending + 4);
+    targetSize = internal_readUint32(pending + 8);
+    if (memcmp(pending + 12, sourceSha256, sizeof(sourceSha256)) != 0 || sourceSize > source->size)
+    {
+        LOG_E("The patch was made against another image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (!targetSize)
+    {
+        LOG_E("The patch has an empty image");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    LOG_D("Patching a %u bytes image into a %u bytes image", sourceSize, targetSize);
+    internal_nextCommand();
+    return ESP_OK;
+}
+
+esp_err_t DeltaPatcher::internal_parseCommand()
+{
+    // the first byte is the type, which tells how many more bytes the command has
+    if (pendingLength == 1)
+    {
+        switch (pending[0])
+        {
+        case commandCopy:
+        case commandAdd:
+            pendingNeeded = 9;
+            return ESP_OK;
+        case commandInsert:
+            pendingNeeded = 5;
+            return ESP_OK;
+        default:
+            LOG_E("Unknown patch command: %u", pending[0]);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    esp_err_t err;
+    switch (pending[0])
+    {
+    case commandCopy:
+        commandOffset = internal_readUint32(pending + 1);
+        commandRemaining = internal_readUint32(pending + 5);
+        err = internal_checkRange(true);
+        if (err != ESP_OK)
+            return err;
+        err = internal_copy();
+        if (err != ESP_OK)
+            return err;
+        break;
+    case commandAdd:
+        commandOffset = internal_readUint32(pending + 1);
+        commandRemaining = internal_readUint32(pending + 5);
+        err = internal_checkRange(true);
+        if (err != ESP_OK)
+            return err;
+        state = State::Add;
+        break;
+    default:
+        commandOffset = 0;
+        commandRemaining = internal_readUint32(pending + 1);
+        err = internal_checkRange(false);
+        if (err != ESP_OK)
+            return err;
+        state = State::Insert;
+        break;
+    }
+    if (!commandRemaining)
+        internal_nextCommand();
+    return ESP_OK;
+}
+
+esp_err_t DeltaPatcher::internal_copy()
+{
+    while (commandRemaining)
+    {
+        size_t count = std::min<size_t>(commandRemaining, sourceBufferSize);
+        esp_err_t err = esp_partition_read(source, commandOffset, sourceBuffer, count);
+        if (err != ESP_OK)
+        {
+            LOG_E("esp_partition_read error: %d", err);
+            return err;
+        }
+        err = output(context, sourceBuffer, count);
+        if (err != ESP_OK)
+            return err;
+        commandOffset += count;
+        commandRemaining -= count;
+        produced += count;
+    }
+    return ESP_OK;
+}
+
+esp_err_t DeltaPatcher::internal_checkRange(bool fromSource)
+{
+    if ((fromSource && (uint64_t) commandOffset + commandRemaining > sourceSize) || (uint64_t) produced + commandRemaining > targetSize)
+    {
+        LOG_E("Patch command out of range");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+void DeltaPatcher::internal_nextCommand()
+{
+    pendingLength = 0;
+    pendingNeeded = 1;
+    state = produced == targetSize ? State::Done : State::Command;
+}
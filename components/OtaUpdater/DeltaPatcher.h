@@ -0,0 +1,104 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DELTAPATCHER_H
+#define DELTAPATCHER_H
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+/* rebuilds an image from a patch against the image in another partition, as the patch arrives
+ * the patch is made by tools/ota_artifacts.py, all the numbers are little endian:
+ * - header: "TDP1", the size of the source image, the size of the target image, the SHA-256 of the source image
+ * - commands, until the whole target image is rebuilt:
+ *   1 - copy: offset in the source, length
+ *   2 - add: offset in the source, length, then length bytes added to the bytes from the source
+ *   3 - insert: length, then length bytes
+ * only the command being applied is kept in RAM, the source is read from flash when it is needed
+ */
+class DeltaPatcher
+{
+public:
+
+    // receives the target image, in order
+    typedef esp_err_t (*output_t)(void *context, const uint8_t *data, size_t length);
+
+    static const size_t sourceBufferSize = 256;
+
+    DeltaPatcher(output_t output, void *context);
+
+    // source - the partition with the image the patch was made against, sourceSha256 - the SHA-256 of that image
+    void begin(const esp_partition_t *source, const uint8_t *sourceSha256);
+
+    /* applies the next part of the patch
+     * returns ESP_ERR_INVALID_VERSION if the patch was made against another image, ESP_ERR_INVALID_RESPONSE if it is corrupted,
+     * or the error returned by the output
+     */
+    esp_err_t write(const uint8_t *data, size_t length);
+
+    // true once the whole target image was rebuilt
+    bool isDone();
+
+    // (bytes) 0 until the header was received
+    uint32_t getTargetSize();
+
+private:
+
+    enum class State : uint8_t
+    {
+        Header,
+        Command,
+        Add,
+        Insert,
+        Done
+    };
+
+    static const size_t headerSize = 44;
+    static const size_t maxCommandSize = 9;
+
+    static uint32_t internal_readUint32(const uint8_t *data);
+
+    esp_err_t internal_parseHeader();
+    esp_err_t internal_parseCommand();
+    esp_err_t internal_copy();
+    esp_err_t internal_checkRange(bool fromSource);
+    void internal_nextCommand();
+
+    output_t output;
+    void *context;
+    const esp_partition_t *source;
+    uint8_t sourceSha256[32];
+
+    State state;
+    // the header or the command being received
+    uint8_t pending[headerSize];
+    size_t pendingLength;
+    size_t pendingNeeded;
+
+    uint32_t sourceSize;
+    uint32_t targetSize;
+    uint32_t produced;
+    // the source range of the current command, and what is left of it
+    uint32_t commandOffset;
+    uint32_t commandRemaining;
+    uint8_t sourceBuffer[sourceBufferSize];
+};
+
+#endif
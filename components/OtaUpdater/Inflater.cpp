@@ -0,0 +1,119 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdlib>
+#include "Inflater.h"
+#include "Logger.h"
+
+Inflater::Inflater(output_t output, void *context) : output(output), context(context)
+{
+    decompressor = nullptr;
+    window = nullptr;
+    windowOffset = 0;
+    headerChecked = false;
+    done = false;
+}
+
+Inflater::~Inflater()
+{
+    end();
+}
+
+esp_err_t Inflater::begin()
+{
+    end();
+    decompressor = (tinfl_decompressor *) malloc(sizeof(tinfl_decompressor));
+    window = (uint8_t *) malloc(windowSize);
+    if (!decompressor || !window)
+    {
+        end();
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(decompressor);
+    windowOffset = 0;
+    headerChecked = false;
+    done = false;
+    return ESP_OK;
+}
+
+esp_err_t Inflater::write(const uint8_t *data, size_t length)
+{
+    if (!decompressor)
+        return ESP_ERR_INVALID_STATE;
+    if (!headerChecked && length)
+    {
+        // the upper 4 bits of the first byte of the zlib header are the base 2 logarithm of the window size minus 8
+        // a back reference further than the window would be decompressed with the wrong data
+        size_t streamWindowSize = (size_t) 1 << ((data[0] >> 4) + 8);
+        if (streamWindowSize > windowSize)
+        {
+            LOG_E("The window of the compressed stream is too large: %u", streamWindowSize);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        headerChecked = true;
+    }
+    while (true)
+    {
+        if (done)
+        {
+            if (length)
+            {
+                LOG_E("Data after the end of the compressed stream");
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            return ESP_OK;
+        }
+        // the window is used as a circular buffer, the output is written after the part that was already sent
+        size_t inputLength = length;
+        size_t outputLength = windowSize - windowOffset;
+        tinfl_status status = tinfl_decompress(decompressor, data, &inputLength, window, window + windowOffset, &outputLength,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += inputLength;
+        length -= inputLength;
+        if (outputLength)
+        {
+            esp_err_t err = output(context, window + windowOffset, outputLength);
+            if (err != ESP_OK)
+                return err;
+            windowOffset = (windowOffset + outputLength) & (windowSize - 1);
+        }
+        if (status < TINFL_STATUS_DONE)
+        {
+            LOG_E("Corrupted compressed stream: %d", status);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        done = status == TINFL_STATUS_DONE;
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && !length)
+            return ESP_OK;
+    }
+}
+
+bool Inflater::isDone()
+{
+    return done;
+}
+
+void Inflater::end()
+{
+    free(decompressor);
+    decompressor = nullptr;
+    free(window);
+    window = nullptr;
+}
@@ -0,0 +1,71 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <esp_err.h>
+#include <esp32/rom/miniz.h>
+
+/* decompresses a zlib stream as it arrives, with the decompressor in the ROM
+ * it uses a fixed amount of RAM, the 4 KB window of the stream plus the 11 KB state of the decompressor,
+ * which is only allocated between begin() and end()
+ * the streams must be compressed with a window of at most windowSize, as tools/ota_artifacts.py does
+ */
+class Inflater
+{
+public:
+
+    // the largest window of the streams that can be decompressed, must be a power of 2
+    static const size_t windowSize = 4096;
+
+    // receives the decompressed data, in pieces of at most windowSize
+    typedef esp_err_t (*output_t)(void *context, const uint8_t *data, size_t length);
+
+    Inflater(output_t output, void *context);
+
+    ~Inflater();
+
+    // returns ESP_ERR_NO_MEM if the buffers can't be allocated
+    esp_err_t begin();
+
+    /* decompresses the next part of the stream
+     * returns ESP_ERR_INVALID_RESPONSE if the stream is corrupted, its window is larger than windowSize
+     * or there is data after its end, or the error returned by the output
+     */
+    esp_err_t write(const uint8_t *data, size_t length);
+
+    // true once the end of the stream was decompressed
+    bool isDone();
+
+    void end();
+
+private:
+
+    output_t output;
+    void *context;
+    tinfl_decompressor *decompressor;
+    uint8_t *window;
+    size_t windowOffset;
+    bool headerChecked;
+    bool done;
+};
+
+#endif
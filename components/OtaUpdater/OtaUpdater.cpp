@@ -0,0 +1,486 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include <esp_image_format.h>
+#include "OtaUpdater.h"
+#include "Logger.h"
+#include "Trace.h"
+#include "TlsMemory.h"
+
+// (ms) the delay before a retry, it doubles after every attempt that didn't download anything
+static const uint32_t minRetryDelay = 1000;
+static const uint32_t maxRetryDelay = 30000;
+static const int maxRedirects = 5;
+// (ms) a connection that doesn't receive anything for this long is considered dropped
+static const int receiveTimeout = 10000;
+
+OtaUpdater::OtaUpdater(const char *certificate, uint32_t maxRate, uint32_t maxDuration) :
+    certificate(certificate), maxRate(maxRate), maxDuration(maxDuration),
+    inflater(writeDecompressed, this), patcher(writeImage, this),
+    state(State::Idle), format(Format::Image), written(0), received(0), total(0), throughput(0), resumes(0)
+{
+    url = nullptr;
+    hasExpectedSha256 = false;
+    partition = nullptr;
+    handle = 0;
+    begun = false;
+    descriptionChecked = false;
+    client = nullptr;
+    skip = 0;
+    rangeStart = -1;
+    rangeTotal = -1;
+    startTime = 0;
+    connectTime = 0;
+    connectReceived = 0;
+    retryDelay = minRetryDelay;
+    lastRetryReceived = 0;
+}
+
+bool OtaUpdater::start(const char *url, const char *expectedSha256, Format format)
+{
+    if (state == State::Downloading)
+        return false;
+    partition = esp_ota_get_next_update_partition(nullptr);
+    if (!partition)
+    {
+        LOG_E("No OTA partition to update");
+        return false;
+    }
+    hasExpectedSha256 = false;
+    if (expectedSha256)
+    {
+        if (!parseSha256(expectedSha256, this->expectedSha256))
+        {
+            LOG_E("Invalid SHA-256: %s", expectedSha256);
+            return false;
+        }
+        hasExpectedSha256 = true;
+    }
+    if (format == Format::Delta)
+    {
+        const esp_partition_t *running = esp_ota_get_running_partition();
+        uint8_t runningSha256[32];
+        if (esp_partition_get_sha256(running, runningSha256) != ESP_OK)
+        {
+            LOG_E("Can't compute the SHA-256 of the running image");
+            return false;
+        }
+        patcher.begin(running, runningSha256);
+    }
+    if (format != Format::Image && inflater.begin() != ESP_OK)
+    {
+        LOG_E("Not enough memory to decompress the update");
+        return false;
+    }
+    free(this->url);
+    this->url = strdup(url);
+    if (!this->url)
+    {
+        inflater.end();
+        return false;
+    }
+
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts_ret(&sha256, 0);
+    begun = false;
+    descriptionChecked = false;
+    skip = 0;
+    written = 0;
+    received = 0;
+    total = 0;
+    throughput = 0;
+    resumes = 0;
+    startTime = esp_timer_get_time();
+    retryDelay = minRetryDelay;
+    lastRetryReceived = 0;
+    this->format = format;
+    state = State::Downloading;
+    LOG_D("Starting update from %s", url);
+    return true;
+}
+
+bool OtaUpdater::getRunningSha256(char *hex)
+{
+    uint8_t sha256[32];
+    if (esp_partition_get_sha256(esp_ota_get_running_partition(), sha256) != ESP_OK)
+        return false;
+    for (size_t i = 0; i < sizeof(sha256); i++)
+        sprintf(hex + 2 * i, "%02x", sha256[i]);
+    return true;
+}
+
+TickType_t OtaUpdater::step()
+{
+    TLS_MEMORY_SCOPE(TlsConnection::OtaDownload);
+    if (state != State::Downloading)
+        return portMAX_DELAY;
+    if (esp_timer_get_time() - startTime > maxDuration * 1000LL)
+    {
+        LOG_E("The update took too long, received %u/%u bytes", received.load(), total.load());
+        internal_fail();
+        return portMAX_DELAY;
+    }
+
+    if (!client)
+    {
+        esp_err_t err = internal_connect();
+        if (err == ESP_ERR_INVALID_SIZE)
+        {
+            LOG_E("The image changed on the server");
+            internal_fail();
+            return portMAX_DELAY;
+        }
+        if (err != ESP_OK)
+            return internal_retry("Error connecting");
+        return 0;
+    }
+
+    TRACE_BEGIN(TraceSpan::OtaChunk);
+    int length = esp_http_client_read(client, buffer, chunkSize);
+    TRACE_END(TraceSpan::OtaChunk);
+    if (length < 0)
+        return internal_retry("Error reading");
+    if (length == 0)
+    {
+        if (!total && esp_http_client_is_complete_data_received(client))
+        {
+            internal_finish();
+            return portMAX_DELAY;
+        }
+        return internal_retry("Connection closed");
+    }
+
+    // when the server ignored the Range header, the part we already have is read again and dropped
+    size_t skipped = std::min<size_t>(skip, length);
+    skip -= skipped;
+    if (length > (int) skipped)
+    {
+        esp_err_t err = internal_write((const uint8_t *) buffer + skipped, length - skipped);
+        if (err != ESP_OK)
+        {
+            internal_fail();
+            return portMAX_DELAY;
+        }
+    }
+    if (total && received >= total)
+    {
+        internal_finish();
+        return portMAX_DELAY;
+    }
+
+    // the next chunk is read when the average rate since connecting drops back to maxRate
+    int64_t now = esp_timer_get_time();
+    uint32_t connectionBytes = received - connectReceived;
+    if (now > connectTime)
+        throughput = connectionBytes * 1000000LL / (now - connectTime);
+    int64_t due = connectTime + connectionBytes * 1000000LL / maxRate;
+    return due > now ? pdMS_TO_TICKS((due - now) / 1000) : 0;
+}
+
+OtaUpdater::State OtaUpdater::getState()
+{
+    return state;
+}
+
+bool OtaUpdater::isActive()
+{
+    return state == State::Downloading;
+}
+
+OtaUpdater::Format OtaUpdater::getFormat()
+{
+    return format;
+}
+
+uint32_t OtaUpdater::getWritten()
+{
+    return written;
+}
+
+uint32_t OtaUpdater::getReceived()
+{
+    return received;
+}
+
+uint32_t OtaUpdater::getTotal()
+{
+    return total;
+}
+
+uint32_t OtaUpdater::getThroughput()
+{
+    return throughput;
+}
+
+uint32_t OtaUpdater::getResumes()
+{
+    return resumes;
+}
+
+esp_err_t OtaUpdater::httpEventHandler(esp_http_client_event_t *event)
+{
+    if (event->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(event->header_key, "Content-Range") == 0)
+    {
+        auto *updater = static_cast<OtaUpdater *>(event->user_data);
+        long long start, end, size;
+        if (sscanf(event->header_value, "bytes %lld-%lld/%lld", &start, &end, &size) == 3)
+        {
+            updater->rangeStart = start;
+            updater->rangeTotal = size;
+        }
+    }
+    return ESP_OK;
+}
+
+bool OtaUpdater::parseSha256(const char *hex, uint8_t *sha256)
+{
+    bool valid = strlen(hex) == 64;
+    for (size_t i = 0; valid && i < 32; i++)
+    {
+        char byte[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+        char *end;
+        sha256[i] = strtoul(byte, &end, 16);
+        valid = *end == 0;
+    }
+    return valid;
+}
+
+esp_err_t OtaUpdater::writeImage(void *context, const uint8_t *data, size_t length)
+{
+    return static_cast<OtaUpdater *>(context)->internal_writeImage(data, length);
+}
+
+esp_err_t OtaUpdater::writeDecompressed(void *context, const uint8_t *data, size_t length)
+{
+    auto *updater = static_cast<OtaUpdater *>(context);
+    if (updater->format == Format::Delta)
+        return updater->patcher.write(data, length);
+    return updater->internal_writeImage(data, length);
+}
+
+esp_err_t OtaUpdater::internal_connect()
+{
+    esp_http_client_config_t config = {};
+    config.url = url;
+    config.cert_pem = certificate;
+    // we make the buffers bigger to fit all the headers from Github and AWS
+    config.buffer_size = 2048;
+    config.buffer_size_tx = 2048;
+    config.timeout_ms = receiveTimeout;
+    config.event_handler = httpEventHandler;
+    config.user_data = this;
+    client = esp_http_client_init(&config);
+    if (!client)
+        return ESP_ERR_NO_MEM;
+    char range[24];
+    if (received)
+    {
+        snprintf(range, sizeof(range), "bytes=%u-", received.load());
+        esp_http_client_set_header(client, "Range", range);
+    }
+
+    int contentLength;
+    int status;
+    for (int redirects = 0; ; redirects++)
+    {
+        rangeStart = -1;
+        rangeTotal = -1;
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK)
+        {
+            internal_disconnect();
+            return err;
+        }
+        contentLength = esp_http_client_fetch_headers(client);
+        status = esp_http_client_get_status_code(client);
+        if (status != 301 && status != 302 && status != 303 && status != 307 && status != 308)
+            break;
+        if (redirects == maxRedirects)
+        {
+            LOG_E("Too many redirects");
+            internal_disconnect();
+            return ESP_FAIL;
+        }
+        // the body of the redirect is read, so the connection can be reused if the new location is on the same host
+        while (esp_http_client_read(client, buffer, chunkSize) > 0)
+        {
+        }
+        esp_http_client_set_redirection(client);
+    }
+
+    uint32_t size;
+    if (status == 206 && rangeStart == received)
+    {
+        size = rangeTotal > 0 ? rangeTotal : received + std::max(contentLength, 0);
+        skip = 0;
+    }
+    else if (status == 200)
+    {
+        size = std::max(contentLength, 0);
+        skip = received;
+        if (received)
+        {
+            LOG_W("The server doesn't support resuming, skipping %u bytes", received.load());
+        }
+    }
+    else
+    {
+        LOG_E("Server returned status code: %d", status);
+        internal_disconnect();
+        return ESP_FAIL;
+    }
+    if (total && size && size != total)
+    {
+        internal_disconnect();
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (size)
+        total = size;
+
+    connectTime = esp_timer_get_time();
+    connectReceived = received;
+    return ESP_OK;
+}
+
+void OtaUpdater::internal_disconnect()
+{
+    if (client)
+    {
+        esp_http_client_cleanup(client);
+        client = nullptr;
+    }
+}
+
+TickType_t OtaUpdater::internal_retry(const char *reason)
+{
+    internal_disconnect();
+    // an attempt that downloaded something starts the backoff again
+    retryDelay = received > lastRetryReceived ? minRetryDelay : std::min(retryDelay * 2, maxRetryDelay);
+    lastRetryReceived = received;
+    resumes++;
+    LOG_W("%s, resuming from %u bytes in %u ms", reason, received.load(), retryDelay);
+    return pdMS_TO_TICKS(retryDelay);
+}
+
+esp_err_t OtaUpdater::internal_write(const uint8_t *data, size_t length)
+{
+    // the decoders keep their state between connections, so a resumed download continues where they stopped
+    received += length;
+    if (format == Format::Image)
+        return internal_writeImage(data, length);
+    return inflater.write(data, length);
+}
+
+esp_err_t OtaUpdater::internal_writeImage(const uint8_t *data, size_t length)
+{
+    esp_err_t err;
+    if (!begun)
+    {
+        // the partition is erased here, only as much as the image needs if its size is known
+        size_t size = OTA_SIZE_UNKNOWN;
+        if (format == Format::Image && total)
+            size = total;
+        else if (format == Format::Delta)
+            size = patcher.getTargetSize();
+        err = esp_ota_begin(partition, size, &handle);
+        if (err != ESP_OK)
+        {
+            LOG_E("esp_ota_begin error: %d", err);
+            return err;
+        }
+        begun = true;
+    }
+    err = esp_ota_write(handle, data, length);
+    if (err != ESP_OK)
+    {
+        LOG_E("esp_ota_write error: %d", err);
+        return err;
+    }
+    mbedtls_sha256_update_ret(&sha256, (const unsigned char *) data, length);
+    written += length;
+
+    // as soon as the description of the image is written, we check that it is a firmware for this device
+    if (!descriptionChecked && written >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t))
+    {
+        esp_app_desc_t description;
+        err = esp_ota_get_partition_description(partition, &description);
+        if (err != ESP_OK || strncmp(description.project_name, esp_ota_get_app_description()->project_name, sizeof(description.project_name)) != 0)
+        {
+            LOG_E("The image isn't a firmware for this device");
+            return ESP_ERR_OTA_VALIDATE_FAILED;
+        }
+        LOG_D("Downloading version %s", description.version);
+        descriptionChecked = true;
+    }
+    return ESP_OK;
+}
+
+void OtaUpdater::internal_finish()
+{
+    internal_disconnect();
+    if ((format != Format::Image && !inflater.isDone()) || (format == Format::Delta && !patcher.isDone()))
+    {
+        LOG_E("The download ended before the end of the image");
+        internal_fail();
+        return;
+    }
+    inflater.end();
+    uint8_t sha256Result[32];
+    mbedtls_sha256_finish_ret(&sha256, sha256Result);
+    if (hasExpectedSha256 && memcmp(sha256Result, expectedSha256, sizeof(sha256Result)) != 0)
+    {
+        LOG_E("The SHA-256 of the image doesn't match");
+        internal_fail();
+        return;
+    }
+    // esp_ota_end also verifies the image, with its own checksum and hash
+    begun = false;
+    esp_err_t err = esp_ota_end(handle);
+    if (err == ESP_OK)
+        err = esp_ota_set_boot_partition(partition);
+    mbedtls_sha256_free(&sha256);
+    if (err != ESP_OK)
+    {
+        LOG_E("Error installing the image: %d", err);
+        state = State::Failed;
+        return;
+    }
+    LOG_D("Installed the image, %u bytes", written.load());
+    state = State::Succeeded;
+}
+
+void OtaUpdater::internal_fail()
+{
+    internal_disconnect();
+    if (begun)
+    {
+        // frees the handle, the partition isn't marked as bootable
+        esp_ota_end(handle);
+        begun = false;
+    }
+    mbedtls_sha256_free(&sha256);
+    inflater.end();
+    state = State::Failed;
+}
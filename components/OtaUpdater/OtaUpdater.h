@@ -0,0 +1,155 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef OTAUPDATER_H
+#define OTAUPDATER_H
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <esp_http_client.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include "Inflater.h"
+#include "DeltaPatcher.h"
+
+/* downloads a firmware image to the next OTA partition a chunk at a time, so it never blocks its task for long
+ * - an interrupted download is resumed from where it stopped, with an HTTP Range request
+ * - the bandwidth is limited to maxRate, by the delay step() asks for after each chunk
+ * - the whole update, retries included, is abandoned after maxDuration
+ * - the image is checked as it arrives: its description must belong to the same project as the running firmware,
+ *   and its SHA-256 is compared to the expected one before it is marked as bootable
+ * - the download can be the image compressed with zlib, or a compressed patch against the running image,
+ *   both made by tools/ota_artifacts.py; they are decompressed and patched as they arrive, so the image is never kept in RAM
+ */
+class OtaUpdater
+{
+public:
+
+    enum class State : uint8_t
+    {
+        Idle,
+        Downloading,
+        Succeeded,  // the image is installed and will be used after a restart
+        Failed
+    };
+
+    enum class Format : uint8_t
+    {
+        Image,
+        Compressed,  // the image compressed with zlib
+        Delta        // a DeltaPatcher patch against the running image, compressed with zlib
+    };
+
+    static const size_t chunkSize = 1024;
+
+    /* certificate - the PEM certificates the server is verified with
+     * maxRate - (bytes/s)
+     * maxDuration - (ms)
+     */
+    OtaUpdater(const char *certificate, uint32_t maxRate, uint32_t maxDuration);
+
+    /* starts an update from url, expectedSha256 is the SHA-256 of the image in hex, or nullptr if it isn't known
+     * format is what url points to, the SHA-256 is always the one of the resulting image
+     * returns false if an update is already in progress
+     */
+    bool start(const char *url, const char *expectedSha256, Format format = Format::Image);
+
+    /* the SHA-256 of the running image in hex, which a patch must have been made against
+     * hex must have room for 65 characters, returns false if it can't be computed
+     */
+    static bool getRunningSha256(char *hex);
+
+    /* connects if needed, and downloads and writes one chunk
+     * returns the number of ticks after which it should be called again, while the state is Downloading
+     */
+    TickType_t step();
+
+    State getState();
+
+    bool isActive();
+
+    Format getFormat();
+
+    // (bytes) the part of the image written to flash
+    uint32_t getWritten();
+
+    // (bytes) the part of the download received, and its size, 0 if it isn't known yet
+    uint32_t getReceived();
+    uint32_t getTotal();
+
+    // (bytes/s) since the last connection was opened
+    uint32_t getThroughput();
+
+    // how many times the download was resumed after an interruption
+    uint32_t getResumes();
+
+private:
+
+    static esp_err_t httpEventHandler(esp_http_client_event_t *event);
+    static bool parseSha256(const char *hex, uint8_t *sha256);
+    static esp_err_t writeImage(void *context, const uint8_t *data, size_t length);
+    static esp_err_t writeDecompressed(void *context, const uint8_t *data, size_t length);
+
+    esp_err_t internal_connect();
+    void internal_disconnect();
+    TickType_t internal_retry(const char *reason);
+    esp_err_t internal_write(const uint8_t *data, size_t length);
+    esp_err_t internal_writeImage(const uint8_t *data, size_t length);
+    void internal_finish();
+    void internal_fail();
+
+    const char *certificate;
+    const uint32_t maxRate;
+    const uint32_t maxDuration;
+
+    char *url;
+    bool hasExpectedSha256;
+    uint8_t expectedSha256[32];
+    mbedtls_sha256_context sha256;
+    Inflater inflater;
+    DeltaPatcher patcher;
+
+    const esp_partition_t *partition;
+    esp_ota_handle_t handle;
+    bool begun;
+    bool descriptionChecked;
+    esp_http_client_handle_t client;
+    // bytes at the start of the response that were already received, when the server ignored the Range header
+    uint32_t skip;
+    // from the Content-Range header of the last response, -1 if it wasn't there
+    int64_t rangeStart;
+    int64_t rangeTotal;
+
+    int64_t startTime;        // (us)
+    int64_t connectTime;      // (us)
+    uint32_t connectReceived;  // (bytes) received when the connection was opened
+    uint32_t retryDelay;       // (ms)
+    uint32_t lastRetryReceived;
+
+    std::atomic<State> state;
+    std::atomic<Format> format;
+    std::atomic<uint32_t> written;
+    std::atomic<uint32_t> received;
+    std::atomic<uint32_t> total;
+    std::atomic<uint32_t> throughput;
+    std::atomic<uint32_t> resumes;
+    char buffer[chunkSize];
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include "Framebuffer.h"
+
+Framebuffer::Framebuffer() : Adafruit_GFX(FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT)
+{
+    memset(buffer, 0, sizeof(buffer));
+    generation = 0;
+    markAllDirty();
+}
+
+void Framebuffer::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+    if (x < 0 || x >= FRAMEBUFFER_WIDTH || y < 0 || y >= FRAMEBUFFER_HEIGHT)
+        return;
+    uint8_t bank = y / 8;
+    uint8_t mask = 1 << (y % 8);
+    uint8_t &byte = buffer[bank * FRAMEBUFFER_WIDTH + x];
+    uint8_t newByte = color ? (byte | mask) : (byte & ~mask);
+    if (newByte == byte)
+        return;
+    byte = newByte;
+    markDirty(bank, x);
+}
+
+void Framebuffer::fillScreen(uint16_t color)
+{
+    uint8_t value = color ? 0xFF : 0x00;
+    for (uint8_t bank = 0; bank < FRAMEBUFFER_BANKS; bank++)
+    {
+        uint8_t *row = buffer + bank * FRAMEBUFFER_WIDTH;
+        for (uint8_t column = 0; column < FRAMEBUFFER_WIDTH; column++)
+        {
+            if (row[column] != value)
+            {
+                row[column] = value;
+                markDirty(bank, column);
+            }
+        }
+    }
+}
+
+bool Framebuffer::getPixel(int16_t x, int16_t y) const
+{
+    if (x < 0 || x >= FRAMEBUFFER_WIDTH || y < 0 || y >= FRAMEBUFFER_HEIGHT)
+        return false;
+    return (buffer[(y / 8) * FRAMEBUFFER_WIDTH + x] >> (y % 8)) & 1;
+}
+
+void Framebuffer::drawSprite(int16_t x, int16_t y, const uint16_t *columns, uint8_t width, uint8_t height)
+{
+    if (y <= -16 || y >= FRAMEBUFFER_HEIGHT)
+        return;
+    uint16_t heightMask = height >= 16 ? 0xFFFF : (1 << height) - 1;
+    for (uint8_t i = 0; i < width; i++)
+    {
+        int16_t column = x + i;
+        if (column < 0 || column >= FRAMEBUFFER_WIDTH)
+            continue;
+        uint32_t bits = columns[i] & heightMask;
+        int16_t top = y;
+        if (top < 0)
+        {
+            bits >>= -top;
+            top = 0;
+        }
+        // the column spans at most 3 banks
+        bits <<= top % 8;
+        for (uint8_t bank = top / 8; bits && bank < FRAMEBUFFER_BANKS; bank++, bits >>= 8)
+        {
+            uint8_t &byte = buffer[bank * FRAMEBUFFER_WIDTH + column];
+            uint8_t newByte = byte | (bits & 0xFF);
+            if (newByte != byte)
+            {
+                byte = newByte;
+                markDirty(bank, column);
+            }
+        }
+    }
+}
+
+void Framebuffer::clearDisplay()
+{
+    fillScreen(WHITE);
+    setCursor(0, 0);
+    generation++;
+}
+
+uint32_t Framebuffer::getGeneration() const
+{
+    return generation;
+}
+
+bool Framebuffer::isDirty() const
+{
+    for (uint8_t bank = 0; bank < FRAMEBUFFER_BANKS; bank++)
+        if (dirtyMin[bank] <= dirtyMax[bank])
+            return true;
+    return false;
+}
+
+void Framebuffer::display()
+{
+    for (uint8_t bank = 0; bank < FRAMEBUFFER_BANKS; bank++)
+    {
+        if (dirtyMin[bank] > dirtyMax[bank])
+            continue;
+        flushBank(bank, dirtyMin[bank], buffer + bank * FRAMEBUFFER_WIDTH + dirtyMin[bank], dirtyMax[bank] - dirtyMin[bank] + 1);
+        dirtyMin[bank] = FRAMEBUFFER_WIDTH;
+        dirtyMax[bank] = 0;
+    }
+}
+
+void Framebuffer::markDirty(uint8_t bank, uint8_t column)
+{
+    if (column < dirtyMin[bank])
+        dirtyMin[bank] = column;
+    if (column > dirtyMax[bank])
+        dirtyMax[bank] = column;
+}
+
+void Framebuffer::markAllDirty()
+{
+    for (uint8_t bank = 0; bank < FRAMEBUFFER_BANKS; bank++)
+    {
+        dirtyMin[bank] = 0;
+        dirtyMax[bank] = FRAMEBUFFER_WIDTH - 1;
+    }
+}
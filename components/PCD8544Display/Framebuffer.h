@@ -0,0 +1,88 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <Adafruit_GFX.h>
+
+#ifndef BLACK
+#define BLACK 1
+#endif
+#ifndef WHITE
+#define WHITE 0
+#endif
+
+#define FRAMEBUFFER_WIDTH  84
+#define FRAMEBUFFER_HEIGHT 48
+#define FRAMEBUFFER_BANKS  (FRAMEBUFFER_HEIGHT / 8)
+
+/* 84x48 monochrome framebuffer in the PCD8544's native layout
+ * each byte is a vertical strip of 8 pixels (LSB on top), a bank is a row of 84 such bytes
+ * every byte that actually changes is recorded as a dirty column range of its bank,
+ * so display() only hands the modified part of each bank to the backend
+ */
+class Framebuffer : public Adafruit_GFX
+{
+public:
+
+    Framebuffer();
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+
+    void fillScreen(uint16_t color) override;
+
+    bool getPixel(int16_t x, int16_t y) const;
+
+    /* draws the black pixels of a sprite stored as columns (bit 0 is the top row, height is at most 16)
+     * x and y are the location of the top left corner
+     * the columns are ORed into the buffer a byte at a time, instead of drawing every pixel
+     */
+    void drawSprite(int16_t x, int16_t y, const uint16_t *columns, uint8_t width, uint8_t height);
+
+    // clears the buffer and moves the cursor to the top left corner
+    void clearDisplay();
+
+    /* incremented by every clearDisplay()
+     * lets a screen that only redraws what changed find out that someone else drew over it
+     */
+    uint32_t getGeneration() const;
+
+    bool isDirty() const;
+
+    // sends the dirty column range of each bank to the backend, then marks the buffer as clean
+    virtual void display();
+
+protected:
+
+    // sends length bytes starting at column firstColumn of bank to the display
+    virtual void flushBank(uint8_t bank, uint8_t firstColumn, const uint8_t *data, size_t length) = 0;
+
+    void markDirty(uint8_t bank, uint8_t column);
+
+    // used when the contents of the display are unknown, for example after a reset
+    void markAllDirty();
+
+    uint8_t buffer[FRAMEBUFFER_WIDTH * FRAMEBUFFER_BANKS];
+    uint8_t dirtyMin[FRAMEBUFFER_BANKS];
+    uint8_t dirtyMax[FRAMEBUFFER_BANKS];
+    uint32_t generation;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include "MemoryDisplay.h"
+
+MemoryDisplay::MemoryDisplay()
+{
+    memset(panel, 0, sizeof(panel));
+    resetStatistics();
+}
+
+bool MemoryDisplay::getPanelPixel(int16_t x, int16_t y) const
+{
+    if (x < 0 || x >= FRAMEBUFFER_WIDTH || y < 0 || y >= FRAMEBUFFER_HEIGHT)
+        return false;
+    return (panel[(y / 8) * FRAMEBUFFER_WIDTH + x] >> (y % 8)) & 1;
+}
+
+bool MemoryDisplay::writePBM(FILE *file) const
+{
+    if (fprintf(file, "P1\n%d %d\n", FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT) < 0)
+        return false;
+    for (int16_t y = 0; y < FRAMEBUFFER_HEIGHT; y++)
+    {
+        for (int16_t x = 0; x < FRAMEBUFFER_WIDTH; x++)
+        {
+            if (fputc(getPanelPixel(x, y) ? '1' : '0', file) == EOF)
+                return false;
+        }
+        if (fputc('\n', file) == EOF)
+            return false;
+    }
+    return true;
+}
+
+bool MemoryDisplay::writePBM(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+    bool success = writePBM(file);
+    return fclose(file) == 0 && success;
+}
+
+size_t MemoryDisplay::getBytesSent() const
+{
+    return bytesSent;
+}
+
+size_t MemoryDisplay::getCommandBytesSent() const
+{
+    return commandBytesSent;
+}
+
+void MemoryDisplay::resetStatistics()
+{
+    bytesSent = 0;
+    commandBytesSent = 0;
+}
+
+void MemoryDisplay::flushBank(uint8_t bank, uint8_t firstColumn, const uint8_t *data, size_t length)
+{
+    memcpy(panel + bank * FRAMEBUFFER_WIDTH + firstColumn, data, length);
+    bytesSent += length;
+    // setting the Y and X address takes 2 command bytes
+    commandBytesSent += 2;
+}
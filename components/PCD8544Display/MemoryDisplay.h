@@ -0,0 +1,61 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORYDISPLAY_H
+#define MEMORYDISPLAY_H
+
+#include <cstdio>
+#include "Framebuffer.h"
+
+/* display backend without hardware, for rendering screens on a PC
+ * flushing copies the dirty bytes into an 84x48 bitmap that mirrors the RAM of a real PCD8544,
+ * counts what would have been sent over SPI and can save the bitmap as a PBM image
+ */
+class MemoryDisplay : public Framebuffer
+{
+public:
+
+    MemoryDisplay();
+
+    // returns the pixel as it would be shown by the display, after the last display()
+    bool getPanelPixel(int16_t x, int16_t y) const;
+
+    // writes the panel as a plain PBM (P1) image, returns false if writing failed
+    bool writePBM(FILE *file) const;
+
+    bool writePBM(const char *path) const;
+
+    // number of data and command bytes that would have been sent since the last resetStatistics()
+    size_t getBytesSent() const;
+    size_t getCommandBytesSent() const;
+
+    void resetStatistics();
+
+protected:
+
+    void flushBank(uint8_t bank, uint8_t firstColumn, const uint8_t *data, size_t length) override;
+
+private:
+
+    uint8_t panel[FRAMEBUFFER_WIDTH * FRAMEBUFFER_BANKS];
+    size_t bytesSent;
+    size_t commandBytesSent;
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <driver/gpio.h>
+#include "PCD8544Display.h"
+#include "Trace.h"
+
+#define PCD8544_FUNCTIONSET          0x20
+#define PCD8544_EXTENDEDINSTRUCTION  0x01
+#define PCD8544_DISPLAYCONTROL       0x08
+#define PCD8544_DISPLAYNORMAL        0x04
+#define PCD8544_SETYADDR             0x40
+#define PCD8544_SETXADDR             0x80
+#define PCD8544_SETBIAS              0x10
+#define PCD8544_SETVOP               0x80
+
+#define PCD8544_SPI_HOST  VSPI_HOST
+#define PCD8544_DMA_CHAN  1
+#define PCD8544_PIN_CLK   18
+#define PCD8544_PIN_DIN   23
+
+// the user field of a transaction holds the D/C pin and the level it should have
+#define DC_USER(pin, level) ((void *) (((uint32_t) (pin) << 1) | (level)))
+
+TaskHandle_t PCD8544Display::transferTask = nullptr;
+uint32_t PCD8544Display::transferBits = 0;
+
+PCD8544Display::PCD8544Display(int8_t dc, int8_t cs, int8_t rst) : pinDC(dc), pinCS(cs), pinRST(rst)
+{
+    spi = nullptr;
+    mutex = xSemaphoreCreateMutex();
+    queuedTransactions = 0;
+}
+
+void PCD8544Display::begin(uint8_t contrast, uint8_t bias)
+{
+    pinMode(pinDC, OUTPUT);
+    pinMode(pinRST, OUTPUT);
+    digitalWrite(pinRST, LOW);
+    delay(1);
+    digitalWrite(pinRST, HIGH);
+
+    spi_bus_config_t busConfig = {};
+    busConfig.mosi_io_num = PCD8544_PIN_DIN;
+    busConfig.miso_io_num = -1;
+    busConfig.sclk_io_num = PCD8544_PIN_CLK;
+    busConfig.quadwp_io_num = -1;
+    busConfig.quadhd_io_num = -1;
+    busConfig.max_transfer_sz = sizeof(transferBuffer);
+    ESP_ERROR_CHECK(spi_bus_initialize(PCD8544_SPI_HOST, &busConfig, PCD8544_DMA_CHAN));
+
+    spi_device_interface_config_t deviceConfig = {};
+    deviceConfig.clock_speed_hz = 4000000;
+    deviceConfig.mode = 0;
+    deviceConfig.spics_io_num = pinCS;
+    deviceConfig.queue_size = FRAMEBUFFER_BANKS * 2;
+    deviceConfig.pre_cb = preTransferCallback;
+    deviceConfig.post_cb = postTransferCallback;
+    ESP_ERROR_CHECK(spi_bus_add_device(PCD8544_SPI_HOST, &deviceConfig, &spi));
+
+    command(PCD8544_FUNCTIONSET | PCD8544_EXTENDEDINSTRUCTION);
+    command(PCD8544_SETBIAS | (bias & 0x07));
+    command(PCD8544_SETVOP | (contrast & 0x7F));
+    command(PCD8544_FUNCTIONSET);
+    command(PCD8544_DISPLAYCONTROL | PCD8544_DISPLAYNORMAL);
+
+    // the RAM of the display is undefined after a reset
+    markAllDirty();
+    display();
+}
+
+void PCD8544Display::setContrast(uint8_t value)
+{
+    // the extended instruction set must not be interleaved with other commands
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    internal_command(PCD8544_FUNCTIONSET | PCD8544_EXTENDEDINSTRUCTION);
+    internal_command(PCD8544_SETVOP | (value & 0x7F));
+    internal_command(PCD8544_FUNCTIONSET);
+    xSemaphoreGive(mutex);
+}
+
+void PCD8544Display::display()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // the transfer buffer is still in use until the previous frame was sent
+    internal_waitForTransfer();
+    // queues the dirty banks with flushBank
+    Framebuffer::display();
+    xSemaphoreGive(mutex);
+}
+
+bool PCD8544Display::transferDone()
+{
+    // a task that holds the mutex is queueing or waiting for a transfer, so it isn't done
+    if (xSemaphoreTake(mutex, 0) != pdTRUE)
+        return false;
+    spi_transaction_t *done;
+    while (queuedTransactions > 0 && spi_device_get_trans_result(spi, &done, 0) == ESP_OK)
+        queuedTransactions--;
+    bool result = queuedTransactions == 0;
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void PCD8544Display::waitForTransfer()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    internal_waitForTransfer();
+    xSemaphoreGive(mutex);
+}
+
+void PCD8544Display::notifyOnTransfer(TaskHandle_t task, uint32_t bits)
+{
+    transferBits = bits;
+    transferTask = task;
+}
+
+void PCD8544Display::internal_waitForTransfer()
+{
+    spi_transaction_t *done;
+    while (queuedTransactions > 0)
+    {
+        ESP_ERROR_CHECK(spi_device_get_trans_result(spi, &done, portMAX_DELAY));
+        queuedTransactions--;
+    }
+}
+
+void PCD8544Display::flushBank(uint8_t bank, uint8_t firstColumn, const uint8_t *data, size_t length)
+{
+    uint8_t *source = transferBuffer + bank * FRAMEBUFFER_WIDTH;
+    memcpy(source, data, length);
+
+    // called by Framebuffer::display(), with the mutex taken
+    size_t index = queuedTransactions;
+    spi_transaction_t &address = transactions[index];
+    address = {};
+    address.flags = SPI_TRANS_USE_TXDATA;
+    address.length = 16;
+    address.tx_data[0] = PCD8544_SETYADDR | bank;
+    address.tx_data[1] = PCD8544_SETXADDR | firstColumn;
+    address.user = DC_USER(pinDC, 0);
+    ESP_ERROR_CHECK(spi_device_queue_trans(spi, &address, portMAX_DELAY));
+    queuedTransactions++;
+
+    spi_transaction_t &pixels = transactions[index + 1];
+    pixels = {};
+    pixels.length = length * 8;
+    pixels.tx_buffer = source;
+    pixels.user = DC_USER(pinDC, 1);
+    ESP_ERROR_CHECK(spi_device_queue_trans(spi, &pixels, portMAX_DELAY));
+    queuedTransactions++;
+}
+
+void PCD8544Display::command(uint8_t c)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    internal_command(c);
+    xSemaphoreGive(mutex);
+}
+
+void PCD8544Display::internal_command(uint8_t c)
+{
+    internal_waitForTransfer();
+    spi_transaction_t transaction = {};
+    transaction.flags = SPI_TRANS_USE_TXDATA;
+    transaction.length = 8;
+    transaction.tx_data[0] = c;
+    transaction.user = DC_USER(pinDC, 0);
+    ESP_ERROR_CHECK(spi_device_transmit(spi, &transaction));
+}
+
+void IRAM_ATTR PCD8544Display::preTransferCallback(spi_transaction_t *transaction)
+{
+    uint32_t user = (uint32_t) transaction->user;
+    gpio_set_level((gpio_num_t) (user >> 1), user & 1);
+    // D/C is high only for pixel data
+    if (user & 1)
+        TRACE_BEGIN(TraceSpan::SpiFlush);
+}
+
+void IRAM_ATTR PCD8544Display::postTransferCallback(spi_transaction_t *transaction)
+{
+    if (!((uint32_t) transaction->user & 1))
+        return;
+    TRACE_END(TraceSpan::SpiFlush);
+    TaskHandle_t task = transferTask;
+    if (task)
+    {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        xTaskNotifyFromISR(task, transferBits, eSetBits, &higherPriorityTaskWoken);
+        if (higherPriorityTaskWoken == pdTRUE)
+            portYIELD_FROM_ISR();
+    }
+}
@@ -0,0 +1,100 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCD8544DISPLAY_H
+#define PCD8544DISPLAY_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <driver/spi_master.h>
+#include "Framebuffer.h"
+
+/* Nokia 5110 (PCD8544) driver that only transfers the parts of the framebuffer that changed
+ * the transfer is done with SPI DMA in the background: display() copies the dirty parts into a second buffer,
+ * queues them and returns, so the next frame can be drawn while the previous one is being sent
+ * the SPI queue is guarded by a mutex, so display(), the commands and the transfer checks can be called from any task
+ */
+class PCD8544Display : public Framebuffer
+{
+public:
+
+    /* dc - data/command pin
+     * cs - chip select pin
+     * rst - reset pin
+     * the display is connected to the VSPI pins (CLK = 18, DIN = 23)
+     */
+    PCD8544Display(int8_t dc, int8_t cs, int8_t rst);
+
+    // resets and initializes the display, then sends the whole framebuffer
+    void begin(uint8_t contrast = 40, uint8_t bias = 4);
+
+    void setContrast(uint8_t value);
+
+    // waits for the previous transfer, then starts sending the dirty parts of the framebuffer
+    void display() override;
+
+    // returns true if the last transfer started by display() has finished, without blocking
+    bool transferDone();
+
+    // blocks until the last transfer started by display() has finished
+    void waitForTransfer();
+
+    /* the task is notified with bits, as with xTaskNotify(task, bits, eSetBits), when a bank of pixels was sent
+     * so it can call transferDone() and the next display() doesn't have to wait, nullptr stops the notifications
+     */
+    void notifyOnTransfer(TaskHandle_t task, uint32_t bits);
+
+protected:
+
+    void flushBank(uint8_t bank, uint8_t firstColumn, const uint8_t *data, size_t length) override;
+
+private:
+
+    void command(uint8_t c);
+
+    // the following are called with the mutex taken
+    void internal_waitForTransfer();
+    void internal_command(uint8_t c);
+
+    // sets the D/C pin before each transaction, from the ISR of the SPI driver
+    static void IRAM_ATTR preTransferCallback(spi_transaction_t *transaction);
+
+    // ends the trace span of the pixel data and notifies the task of notifyOnTransfer, from the ISR of the SPI driver
+    static void IRAM_ATTR postTransferCallback(spi_transaction_t *transaction);
+
+    // read by postTransferCallback, which only gets the transaction
+    static TaskHandle_t transferTask;
+    static uint32_t transferBits;
+
+    int8_t pinDC;
+    int8_t pinCS;
+    int8_t pinRST;
+
+    spi_device_handle_t spi;
+    SemaphoreHandle_t mutex;
+    // for each bank, one transaction with the address and one with the data
+    spi_transaction_t transactions[FRAMEBUFFER_BANKS * 2];
+    // the transactions whose results weren't taken yet, protected by the mutex
+    size_t queuedTransactions;
+    // the data being sent, each bank is copied to the start of its row, so the DMA source stays word aligned
+    alignas(4) uint8_t transferBuffer[FRAMEBUFFER_WIDTH * FRAMEBUFFER_BANKS];
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdarg>
+#include <cmath>
+#include "PrometheusWriter.h"
+
+PrometheusWriter::PrometheusWriter(httpd_req_t *req) : req(req)
+{
+    length = 0;
+    error = ESP_OK;
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+}
+
+void PrometheusWriter::describe(const char *name, const char *type, const char *help)
+{
+    append("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void PrometheusWriter::sample(const char *name, const char *labels, double value)
+{
+    char text[24];
+    // Prometheus spells these differently than printf
+    if (std::isnan(value))
+        snprintf(text, sizeof(text), "NaN");
+    else if (std::isinf(value))
+        snprintf(text, sizeof(text), value > 0 ? "+Inf" : "-Inf");
+    else
+        snprintf(text, sizeof(text), "%.9g", value);
+    if (labels)
+        append("%s{%s} %s\n", name, labels, text);
+    else
+        append("%s %s\n", name, text);
+}
+
+void PrometheusWriter::sample(const char *name, const char *labels, uint64_t value)
+{
+    if (labels)
+        append("%s{%s} %llu\n", name, labels, value);
+    else
+        append("%s %llu\n", name, value);
+}
+
+esp_err_t PrometheusWriter::finish()
+{
+    sendBuffer();
+    if (error == ESP_OK)
+        error = httpd_resp_send_chunk(req, nullptr, 0);
+    return error;
+}
+
+void PrometheusWriter::append(const char *format, ...)
+{
+    if (error != ESP_OK)
+        return;
+    // a line that doesn't fit in what is left of the buffer is written again after the buffer is sent
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(buffer + length, sizeof(buffer) - length, format, args);
+        va_end(args);
+        if (written >= 0 && length + written < sizeof(buffer))
+        {
+            length += written;
+            return;
+        }
+        sendBuffer();
+        if (error != ESP_OK)
+            return;
+    }
+    // longer than the whole buffer, it is dropped so the output stays valid
+}
+
+void PrometheusWriter::sendBuffer()
+{
+    if (length > 0 && error == ESP_OK)
+        error = httpd_resp_send_chunk(req, buffer, length);
+    length = 0;
+}
@@ -0,0 +1,59 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROMETHEUSWRITER_H
+#define PROMETHEUSWRITER_H
+
+#include <esp_http_server.h>
+
+/* writes metrics in the Prometheus text format as a chunked HTTP response
+ * the text goes through a small fixed buffer, which is sent as a chunk every time it fills up,
+ * so the memory used doesn't depend on the number of metrics and nothing is allocated
+ */
+class PrometheusWriter
+{
+public:
+
+    static const size_t bufferSize = 512;
+
+    explicit PrometheusWriter(httpd_req_t *req);
+
+    // writes the HELP and TYPE lines of a metric, type is counter, gauge or histogram
+    void describe(const char *name, const char *type, const char *help);
+
+    // writes a sample; labels are written between braces, like quantity="x",other="y", and can be nullptr
+    void sample(const char *name, const char *labels, double value);
+
+    void sample(const char *name, const char *labels, uint64_t value);
+
+    // sends what is left in the buffer and ends the response
+    esp_err_t finish();
+
+private:
+
+    void append(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void sendBuffer();
+
+    httpd_req_t *req;
+    char buffer[bufferSize];
+    size_t length;
+    esp_err_t error;
+};
+
+#endif
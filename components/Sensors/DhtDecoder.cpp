@@ -0,0 +1,69 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "DhtDecoder.h"
+
+const uint16_t DhtDecoder::oneThreshold;
+const uint16_t DhtDecoder::maxBitDuration;
+
+DhtDecoder::Result DhtDecoder::decode(const dhtPulse_t *pulses, size_t count, bool dht11, float &temperature, float &humidity)
+{
+    // the bits are read backwards from the end, the last high pulse is the least significant bit of the checksum
+    uint8_t data[5] = {};
+    int bit = 39;
+    for (size_t i = count; i > 0 && bit >= 0; i--)
+    {
+        const dhtPulse_t &pulse = pulses[i - 1];
+        if (!pulse.level || pulse.duration == 0)
+            continue;
+        if (pulse.duration > maxBitDuration)
+        {
+            // the line is released after the last bit, the capture can end with it high for as long as the idle threshold
+            if (bit == 39)
+                continue;
+            return Result::InvalidBit;
+        }
+        if (pulse.duration >= oneThreshold)
+            data[bit / 8] |= 0x80 >> (bit % 8);
+        bit--;
+    }
+    if (bit >= 0)
+        return Result::TooFewBits;
+    if ((uint8_t) (data[0] + data[1] + data[2] + data[3]) != data[4])
+        return Result::ChecksumError;
+
+    if (dht11)
+    {
+        // integral and decimal parts, the sign of the temperature is the top bit of its decimal part
+        humidity = data[0] + data[1] * 0.1f;
+        temperature = data[2] + (data[3] & 0x7F) * 0.1f;
+        if (data[3] & 0x80)
+            temperature = -temperature;
+    }
+    else
+    {
+        // tenths, the temperature is sign and magnitude
+        humidity = ((data[0] << 8) | data[1]) * 0.1f;
+        temperature = (((data[2] & 0x7F) << 8) | data[3]) * 0.1f;
+        if (data[2] & 0x80)
+            temperature = -temperature;
+    }
+    return Result::Ok;
+}
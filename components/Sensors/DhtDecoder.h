@@ -0,0 +1,61 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DHTDECODER_H
+#define DHTDECODER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// a time the data line of a DHT sensor stayed at a level
+struct dhtPulse_t
+{
+    uint8_t  level;
+    uint16_t duration;  // (us), 0 marks the end of a capture
+};
+
+/* decodes the answer of a DHT11 or DHT22 from the pulses of its data line
+ * after the start signal, the sensor pulls the line low for 80 us and releases it for 80 us, then sends 40 bits,
+ * each a 50 us low pulse followed by a high pulse of 26-28 us for a 0 or 70 us for a 1, most significant bit first
+ * the bits are the last 40 high pulses, so it doesn't matter where the capture started, the idle line after them is skipped
+ * it doesn't use the IDF, so it can be built on the host and fed recorded timings
+ */
+class DhtDecoder
+{
+public:
+
+    enum class Result : uint8_t
+    {
+        Ok,
+        TooFewBits,
+        InvalidBit,     // a high pulse too long to be a bit
+        ChecksumError
+    };
+
+    // (us) the high pulses at least this long are 1s
+    static const uint16_t oneThreshold = 48;
+    // (us) the high pulses longer than this aren't bits
+    static const uint16_t maxBitDuration = 120;
+
+    // temperature in °C and humidity in %, they are only set if the result is Ok
+    static Result decode(const dhtPulse_t *pulses, size_t count, bool dht11, float &temperature, float &humidity);
+};
+
+#endif
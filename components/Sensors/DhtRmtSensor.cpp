@@ -0,0 +1,172 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cmath>
+#include <esp_timer.h>
+#include "DhtRmtSensor.h"
+#include "Logger.h"
+
+const uint16_t DhtRmtSensor::idleThreshold;
+const uint32_t DhtRmtSensor::answerTime;
+const uint32_t DhtRmtSensor::answerTimeout;
+const size_t DhtRmtSensor::ringbufferSize;
+const size_t DhtRmtSensor::maxPulses;
+
+DhtRmtSensor::DhtRmtSensor(bool dht11, gpio_num_t pin, rmt_channel_t channel) : dht11(dht11), pin(pin), channel(channel)
+{
+    installed = false;
+    ringbuffer = nullptr;
+    phase = Phase::Idle;
+    phaseStart = 0;
+}
+
+DhtRmtSensor::~DhtRmtSensor()
+{
+    if (installed)
+        rmt_driver_uninstall(channel);
+}
+
+esp_err_t DhtRmtSensor::begin()
+{
+    rmt_config_t config = {};
+    config.rmt_mode = RMT_MODE_RX;
+    config.channel = channel;
+    config.gpio_num = pin;
+    config.clk_div = 80;  // 1 us ticks
+    config.mem_block_num = 1;
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = 100;  // (APB clock cycles) glitches shorter than 1.25 us are ignored
+    config.rx_config.idle_threshold = idleThreshold;
+    esp_err_t err = rmt_config(&config);
+    if (err == ESP_OK)
+        err = rmt_driver_install(channel, ringbufferSize, 0);
+    if (err != ESP_OK)
+    {
+        LOG_E("Error setting up RMT channel %d: %d", channel, err);
+        return err;
+    }
+    installed = true;
+    rmt_get_ringbuf_handle(channel, &ringbuffer);
+
+    // the GPIO drives the line only for the start signal, open drain, so the RMT input can still see the sensor pull it low
+    gpio_set_pull_mode(pin, GPIO_PULLUP_ONLY);
+    gpio_set_level(pin, 1);
+    gpio_set_direction(pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    return ESP_OK;
+}
+
+const char *DhtRmtSensor::getName()
+{
+    return dht11 ? "DHT11" : "DHT22";
+}
+
+uint32_t DhtRmtSensor::getMinInterval()
+{
+    return dht11 ? 1000 : 2000;
+}
+
+TickType_t DhtRmtSensor::startReading()
+{
+    if (phase == Phase::Receiving)
+        rmt_rx_stop(channel);
+    status = Status::Busy;
+    gpio_set_level(pin, 0);
+    phase = Phase::StartSignal;
+    phaseStart = esp_timer_get_time();
+    // the DHT11 needs at least 18 ms, the DHT22 at least 1 ms
+    return pdMS_TO_TICKS(dht11 ? 20 : 2) + 1;
+}
+
+TickType_t DhtRmtSensor::step()
+{
+    int64_t elapsed = esp_timer_get_time() - phaseStart;
+    switch (phase)
+    {
+    case Phase::Idle:
+        return 0;
+
+    case Phase::StartSignal:
+        if (elapsed < (dht11 ? 18000 : 1000))
+            return 1;
+        // the sensor answers 20-40 us after the line is released, so the capture is started first
+        internal_drain();
+        rmt_rx_start(channel, true);
+        gpio_set_level(pin, 1);
+        phase = Phase::Receiving;
+        phaseStart = esp_timer_get_time();
+        return pdMS_TO_TICKS(answerTime) + 1;
+
+    case Phase::Receiving:
+    {
+        size_t size = 0;
+        rmt_item32_t *items = (rmt_item32_t *) xRingbufferReceive(ringbuffer, &size, 0);
+        if (!items)
+        {
+            if (elapsed < answerTimeout * 1000)
+                return 1;
+            rmt_rx_stop(channel);
+            return internal_finish(Status::Timeout);
+        }
+        rmt_rx_stop(channel);
+        size_t count = 0;
+        for (size_t i = 0; i < size / sizeof(rmt_item32_t) && count + 2 <= maxPulses; i++)
+        {
+            pulses[count++] = { (uint8_t) items[i].level0, (uint16_t) items[i].duration0 };
+            pulses[count++] = { (uint8_t) items[i].level1, (uint16_t) items[i].duration1 };
+        }
+        vRingbufferReturnItem(ringbuffer, items);
+
+        float newTemperature, newHumidity;
+        DhtDecoder::Result result = DhtDecoder::decode(pulses, count, dht11, newTemperature, newHumidity);
+        if (result == DhtDecoder::Result::ChecksumError)
+            return internal_finish(Status::ChecksumError);
+        if (result != DhtDecoder::Result::Ok)
+        {
+            LOG_D("Invalid answer from DHT: %d, %u pulses", (int) result, (unsigned) count);
+            return internal_finish(Status::DecodeError);
+        }
+        temperature = newTemperature;
+        humidity = newHumidity;
+        return internal_finish(Status::Ok);
+    }
+    }
+    return 0;
+}
+
+// throws away what was captured outside a reading
+void DhtRmtSensor::internal_drain()
+{
+    size_t size;
+    void *item;
+    while ((item = xRingbufferReceive(ringbuffer, &size, 0)) != nullptr)
+        vRingbufferReturnItem(ringbuffer, item);
+}
+
+TickType_t DhtRmtSensor::internal_finish(Status result)
+{
+    status = result;
+    if (result != Status::Ok)
+    {
+        temperature = NAN;
+        humidity = NAN;
+    }
+    phase = Phase::Idle;
+    return 0;
+}
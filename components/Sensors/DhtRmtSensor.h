@@ -0,0 +1,86 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DHTRMTSENSOR_H
+#define DHTRMTSENSOR_H
+
+#include <driver/rmt.h>
+#include <driver/gpio.h>
+#include <freertos/ringbuf.h>
+#include "SensorDriver.h"
+#include "DhtDecoder.h"
+
+/* reads a DHT11 or DHT22 with an RMT channel, instead of timing the bits with interrupts disabled
+ * the start signal is held by the GPIO while the task waits, then the answer is captured by the RMT channel,
+ * whose driver copies the pulses to a ring buffer from its interrupt when the line goes idle,
+ * and step() decodes them in the task
+ */
+class DhtRmtSensor : public SensorDriver
+{
+public:
+
+    DhtRmtSensor(bool dht11, gpio_num_t pin, rmt_channel_t channel);
+
+    ~DhtRmtSensor() override;
+
+    // sets up the RMT channel and the pin, returns the error if it fails
+    esp_err_t begin();
+
+    const char *getName() override;
+
+    uint32_t getMinInterval() override;
+
+    TickType_t startReading() override;
+
+    TickType_t step() override;
+
+private:
+
+    enum class Phase : uint8_t
+    {
+        Idle,
+        StartSignal,  // the line is held low
+        Receiving     // the line is released and the answer is being captured
+    };
+
+    // (us) the line stays high this long after the answer, which ends the capture
+    static const uint16_t idleThreshold = 1000;
+    // (ms) from releasing the line until the answer is captured, and until it is given up
+    static const uint32_t answerTime = 6;
+    static const uint32_t answerTimeout = 20;
+    // (bytes) the ring buffer holds the pulses of one answer
+    static const size_t ringbufferSize = 512;
+    // an RMT memory block holds 64 items of two pulses each
+    static const size_t maxPulses = 128;
+
+    void internal_drain();
+    TickType_t internal_finish(Status result);
+
+    const bool dht11;
+    const gpio_num_t pin;
+    const rmt_channel_t channel;
+    bool installed;
+    RingbufHandle_t ringbuffer;
+    Phase phase;
+    int64_t phaseStart;  // (us)
+    dhtPulse_t pulses[maxPulses];
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cmath>
+#include "SensorDriver.h"
+#include "DhtRmtSensor.h"
+#include "Logger.h"
+
+SensorDriver *SensorDriver::create(SensorType type, uint8_t pin, uint8_t index)
+{
+    SensorDriver *driver = nullptr;
+    switch (type)
+    {
+    case SensorType::DHT11:
+    case SensorType::DHT22:
+    {
+        if (index >= RMT_CHANNEL_MAX)
+        {
+            LOG_E("No RMT channel for sensor %u", index);
+            return nullptr;
+        }
+        DhtRmtSensor *dht = new DhtRmtSensor(type == SensorType::DHT11, (gpio_num_t) pin, (rmt_channel_t) index);
+        if (dht->begin() != ESP_OK)
+        {
+            delete dht;
+            return nullptr;
+        }
+        driver = dht;
+        break;
+    }
+    }
+    return driver;
+}
+
+const char *SensorDriver::getStatusName(Status status)
+{
+    switch (status)
+    {
+    case Status::None:
+        return "none";
+    case Status::Busy:
+        return "busy";
+    case Status::Ok:
+        return "ok";
+    case Status::Timeout:
+        return "timeout";
+    case Status::ChecksumError:
+        return "checksumError";
+    case Status::DecodeError:
+        return "decodeError";
+    }
+    return "unknown";
+}
+
+SensorDriver::SensorDriver()
+{
+    status = Status::None;
+    temperature = NAN;
+    humidity = NAN;
+}
+
+SensorDriver::~SensorDriver()
+{
+}
+
+SensorDriver::Status SensorDriver::getStatus()
+{
+    return status;
+}
+
+float SensorDriver::getTemperature()
+{
+    return temperature;
+}
+
+float SensorDriver::getHumidity()
+{
+    return humidity;
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SENSORDRIVER_H
+#define SENSORDRIVER_H
+
+#include <cstdint>
+#include <freertos/FreeRTOS.h>
+
+// the sensors there is a driver for
+enum class SensorType : uint8_t
+{
+    DHT11,
+    DHT22
+};
+
+/* a temperature and humidity sensor that is read without blocking its task
+ * startReading() and step() only take the CPU for a moment, and return after how many ticks step() should be called again,
+ * so a task can read several sensors at once and other tasks run while the sensors measure
+ * step() returns 0 when the reading is finished, its result is kept until the next one finishes
+ * to add a sensor, implement this class, and add its type to SensorType and to create()
+ */
+class SensorDriver
+{
+public:
+
+    enum class Status : uint8_t
+    {
+        None,           // no reading was started yet
+        Busy,           // a reading is in progress
+        Ok,
+        Timeout,        // the sensor didn't answer
+        ChecksumError,
+        DecodeError     // the answer isn't what the sensor sends
+    };
+
+    /* creates the driver of a sensor of the given type on pin
+     * index tells apart the sensors of the same type, a driver can use it to pick a peripheral, it is at most 7
+     * returns nullptr if the driver can't be set up
+     */
+    static SensorDriver *create(SensorType type, uint8_t pin, uint8_t index);
+
+    static const char *getStatusName(Status status);
+
+    virtual ~SensorDriver();
+
+    virtual const char *getName() = 0;
+
+    // (ms) the minimum time between the starts of two readings
+    virtual uint32_t getMinInterval() = 0;
+
+    // starts a reading, returns the number of ticks after which step() should be called
+    virtual TickType_t startReading() = 0;
+
+    // advances the reading, returns the number of ticks after which it should be called again, or 0 when the reading is finished
+    virtual TickType_t step() = 0;
+
+    Status getStatus();
+
+    // (°C) of the last reading, NAN if it wasn't Ok
+    float getTemperature();
+
+    // (%) of the last reading, NAN if it wasn't Ok or the sensor doesn't measure it
+    float getHumidity();
+
+protected:
+
+    SensorDriver();
+
+    Status status;
+    float temperature;
+    float humidity;
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdlib>
+#include "SensorFilter.h"
+
+const uint8_t SensorFilter::medianSize;
+const uint8_t SensorFilter::fractionBits;
+
+SensorFilter::SensorFilter(uint8_t smoothingShift, uint8_t trendShift, int32_t publishThreshold)
+    : smoothingShift(smoothingShift), trendShift(trendShift), publishThreshold(publishThreshold)
+{
+    reset();
+}
+
+void SensorFilter::reset()
+{
+    readingCount = 0;
+    nextReading = 0;
+    estimate = 0;
+    trend = 0;
+    published = 0;
+    valid = false;
+}
+
+bool SensorFilter::add(int32_t value, uint32_t interval)
+{
+    readings[nextReading] = value;
+    nextReading = (nextReading + 1) % medianSize;
+    if (readingCount < medianSize)
+        readingCount++;
+
+    int32_t median = internal_median() << fractionBits;
+    if (!valid)
+    {
+        // the first reading is published right away, so the heater can be controlled without waiting for the window to fill
+        estimate = median;
+        trend = 0;
+        published = getEstimate();
+        valid = true;
+        return true;
+    }
+
+    int32_t previous = estimate;
+    estimate += (median - estimate) >> smoothingShift;
+    if (interval > 0)
+    {
+        int64_t slope = (int64_t) (estimate - previous) * 60000 / interval;
+        trend += (int32_t) ((slope - trend) >> trendShift);
+    }
+
+    int32_t newValue = getEstimate();
+    if (abs(newValue - published) < publishThreshold)
+        return false;
+    published = newValue;
+    return true;
+}
+
+bool SensorFilter::hasValue()
+{
+    return valid;
+}
+
+int32_t SensorFilter::getPublished()
+{
+    return published;
+}
+
+int32_t SensorFilter::getEstimate()
+{
+    return (estimate + (1 << (fractionBits - 1))) >> fractionBits;
+}
+
+int32_t SensorFilter::getTrend()
+{
+    return (trend + (1 << (fractionBits - 1))) >> fractionBits;
+}
+
+// the median of the readings in the window, the mean of the middle two if their number is even
+int32_t SensorFilter::internal_median()
+{
+    int32_t sorted[medianSize];
+    for (uint8_t i = 0; i < readingCount; i++)
+    {
+        // insertion sort, there are only a few of them
+        int32_t value = readings[i];
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = value;
+    }
+    if (readingCount % 2)
+        return sorted[readingCount / 2];
+    return (sorted[readingCount / 2 - 1] + sorted[readingCount / 2]) / 2;
+}
@@ -0,0 +1,82 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SENSORFILTER_H
+#define SENSORFILTER_H
+
+#include <cstdint>
+
+/* turns the readings of a sensor into an estimate that is only published when it really moved, in fixed point
+ * - the median of the last medianSize readings rejects outliers, like a single noisy sample of a DHT22
+ * - an exponential moving average of the medians smooths what is left, and the slope of the average is smoothed into a trend
+ * - the published value follows the estimate only when they differ by at least publishThreshold,
+ *   so the work done with it, like evaluating the schedules and redrawing the display, only happens when it changed
+ * values are in hundredths (of °C or %), the memory used is fixed and there are no floats
+ */
+class SensorFilter
+{
+public:
+
+    static const uint8_t medianSize = 5;
+
+    /* smoothingShift - the average moves by 1/2^smoothingShift of the way to each median
+     * trendShift - the trend moves by 1/2^trendShift of the way to each slope
+     * publishThreshold - (hundredths)
+     */
+    SensorFilter(uint8_t smoothingShift, uint8_t trendShift, int32_t publishThreshold);
+
+    // forgets the readings, for example when the sensor stopped answering
+    void reset();
+
+    /* adds a reading taken interval ms after the previous one, 0 if there was none
+     * returns true if the published value changed
+     */
+    bool add(int32_t value, uint32_t interval);
+
+    bool hasValue();
+
+    int32_t getPublished();
+
+    int32_t getEstimate();
+
+    // (hundredths per minute)
+    int32_t getTrend();
+
+private:
+
+    // bits below the hundredths kept by the average and the trend
+    static const uint8_t fractionBits = 8;
+
+    int32_t internal_median();
+
+    const uint8_t smoothingShift;
+    const uint8_t trendShift;
+    const int32_t publishThreshold;
+
+    int32_t readings[medianSize];
+    uint8_t readingCount;
+    uint8_t nextReading;
+    int32_t estimate;  // (hundredths << fractionBits)
+    int32_t trend;     // (hundredths per minute << fractionBits)
+    int32_t published;
+    bool valid;
+};
+
+#endif
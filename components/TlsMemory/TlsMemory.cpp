@@ -0,0 +1,98 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdint>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <mbedtls/platform.h>
+#include "TlsMemory.h"
+
+static const char *connectionNames[] = { "other", "stream", "rest", "update_check", "ota_download" };
+static_assert(sizeof(connectionNames) / sizeof(connectionNames[0]) == (size_t) TlsConnection::Count, "Every connection must have a name");
+
+// kept in front of every allocation, so its size and connection are known when it is freed
+struct alignas(8) allocationHeader_t
+{
+    uint32_t size;
+    TlsConnection connection;
+};
+
+static std::atomic<uint32_t> currentUsage[(size_t) TlsConnection::Count];
+static std::atomic<uint32_t> peakUsage[(size_t) TlsConnection::Count];
+static thread_local TlsConnection currentConnection = TlsConnection::Other;
+
+static void *tlsCalloc(size_t count, size_t size)
+{
+    if (size && count > (SIZE_MAX - sizeof(allocationHeader_t)) / size)
+        return nullptr;
+    size_t bytes = count * size;
+    // the same memory mbedTLS allocates from by default
+    auto *header = static_cast<allocationHeader_t *>(heap_caps_calloc(1, sizeof(allocationHeader_t) + bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    if (!header)
+        return nullptr;
+    header->size = bytes;
+    header->connection = currentConnection;
+    size_t index = (size_t) header->connection;
+    uint32_t usage = currentUsage[index] += bytes;
+    uint32_t peak = peakUsage[index];
+    while (usage > peak && !peakUsage[index].compare_exchange_weak(peak, usage))
+    {
+    }
+    return header + 1;
+}
+
+static void tlsFree(void *pointer)
+{
+    if (!pointer)
+        return;
+    auto *header = static_cast<allocationHeader_t *>(pointer) - 1;
+    currentUsage[(size_t) header->connection] -= header->size;
+    heap_caps_free(header);
+}
+
+void tlsMemoryInstall()
+{
+    mbedtls_platform_set_calloc_free(tlsCalloc, tlsFree);
+}
+
+uint32_t tlsMemoryGetCurrent(TlsConnection connection)
+{
+    return currentUsage[(size_t) connection];
+}
+
+uint32_t tlsMemoryGetPeak(TlsConnection connection)
+{
+    return peakUsage[(size_t) connection];
+}
+
+const char *tlsMemoryGetName(TlsConnection connection)
+{
+    return connectionNames[(size_t) connection];
+}
+
+TlsMemoryScope::TlsMemoryScope(TlsConnection connection) : previous(currentConnection)
+{
+    currentConnection = connection;
+}
+
+TlsMemoryScope::~TlsMemoryScope()
+{
+    currentConnection = previous;
+}
@@ -0,0 +1,61 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TLSMEMORY_H
+#define TLSMEMORY_H
+
+#include <stdint.h>
+
+// the connections whose TLS memory is accounted separately, their names are in TlsMemory.cpp
+enum class TlsConnection : uint8_t
+{
+    Other,        // allocations made outside of a TlsMemoryScope
+    Stream,
+    Rest,
+    UpdateCheck,
+    OtaDownload,
+    Count
+};
+
+/* makes mbedTLS allocate through the accounting, must be called before the first TLS connection
+ * every allocation is charged to the connection of the TlsMemoryScope of the task that made it,
+ * and released from the same connection when it is freed, whichever task frees it
+ */
+void tlsMemoryInstall();
+
+// (bytes) the memory used by mbedTLS for connection right now, and at most since boot
+uint32_t tlsMemoryGetCurrent(TlsConnection connection);
+uint32_t tlsMemoryGetPeak(TlsConnection connection);
+
+const char *tlsMemoryGetName(TlsConnection connection);
+
+// charges the allocations of the current task to a connection, until the end of the scope
+class TlsMemoryScope
+{
+public:
+    explicit TlsMemoryScope(TlsConnection connection);
+    ~TlsMemoryScope();
+private:
+    TlsConnection previous;
+};
+
+#define TLS_MEMORY_SCOPE(connection) TlsMemoryScope tlsMemoryScope(connection)
+
+#endif
@@ -0,0 +1,88 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Trace.h"
+
+#if TRACE_ENABLED
+
+#include <cstdio>
+#include <cstdlib>
+#include <freertos/task.h>
+#include <esp_attr.h>
+
+traceEvent_t traceBuffer[TRACE_BUFFER_SIZE];
+uint32_t traceHead = 0;
+volatile bool tracePaused = false;
+
+static const char *traceSpanNames[] = {
+    "sensor read",
+    "schedule evaluation",
+    "display render",
+    "SPI flush",
+    "TLS handshake",
+    "stream read",
+    "OTA chunk"
+};
+
+static_assert(sizeof(traceSpanNames) / sizeof(traceSpanNames[0]) == (size_t) TraceSpan::Count, "Every span needs a name");
+
+// called by the scheduler with interrupts disabled, see trace_hooks.h
+extern "C" void IRAM_ATTR traceTaskSwitchedIn(void *task)
+{
+    traceRecord(TraceEventType::TaskSwitch, (uint32_t) task);
+}
+
+void traceDump()
+{
+    tracePaused = true;
+    // lets events that were being recorded on the other core finish
+    vTaskDelay(1);
+
+    uint32_t head = traceHead;
+    uint32_t first = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+
+    // every line starts with TRACE, so the dump can be picked out of the rest of the serial output
+    // the first number is the frequency of the timestamps, they are in microseconds
+    printf("TRACE BEGIN %d %u\n", 1000000, head - first);
+    for (size_t i = 0; i < (size_t) TraceSpan::Count; i++)
+        printf("TRACE SPAN %u %s\n", i, traceSpanNames[i]);
+
+    // deleted tasks aren't listed, the tool shows them by their handle
+    UBaseType_t taskNumber = uxTaskGetNumberOfTasks();
+    TaskStatus_t *statuses = (TaskStatus_t *) malloc(taskNumber * sizeof(TaskStatus_t));
+    if (statuses)
+    {
+        taskNumber = uxTaskGetSystemState(statuses, taskNumber, nullptr);
+        for (UBaseType_t i = 0; i < taskNumber; i++)
+            printf("TRACE TASK %x %s\n", (uint32_t) statuses[i].xHandle, statuses[i].pcTaskName);
+        free(statuses);
+    }
+
+    for (uint32_t i = first; i < head; i++)
+    {
+        const traceEvent_t &event = traceBuffer[i & (TRACE_BUFFER_SIZE - 1)];
+        printf("TRACE EVENT %u %u %u %x\n", event.timestamp, (unsigned) event.type, event.core, event.data);
+    }
+    puts("TRACE END");
+
+    traceHead = 0;
+    tracePaused = false;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// the spans that can be recorded, their names are in Trace.cpp
+enum class TraceSpan : uint16_t
+{
+    SensorRead,
+    ScheduleEvaluation,
+    DisplayRender,
+    SpiFlush,
+    TlsHandshake,
+    StreamRead,
+    OtaChunk,
+    Count
+};
+
+#if TRACE_ENABLED
+
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#define TRACE_BUFFER_SIZE 512  // number of events kept, must be a power of 2
+
+enum class TraceEventType : uint8_t
+{
+    Begin,
+    End,
+    IsrBegin,
+    IsrEnd,
+    TaskSwitch
+};
+
+struct traceEvent_t
+{
+    uint32_t       timestamp;  // (us) low 32 bits of esp_timer_get_time, which both cores share
+    uint32_t       data;       // the span, or the handle of the task that was switched in
+    TraceEventType type;
+    uint8_t        core;
+};
+
+extern traceEvent_t traceBuffer[TRACE_BUFFER_SIZE];
+extern uint32_t traceHead;
+extern volatile bool tracePaused;
+
+/* adds an event to the ring buffer, overwriting the oldest one
+ * it is short and it can be called from ISRs, so it is always inlined
+ * the time is read from esp_timer and not from the cycle counter, which is different on each core and changes rate with the CPU frequency
+ */
+static inline __attribute__((always_inline)) void traceRecord(TraceEventType type, uint32_t data)
+{
+    if (tracePaused)
+        return;
+    uint32_t index = __atomic_fetch_add(&traceHead, 1, __ATOMIC_RELAXED) & (TRACE_BUFFER_SIZE - 1);
+    traceEvent_t &event = traceBuffer[index];
+    event.timestamp = (uint32_t) esp_timer_get_time();
+    event.data = data;
+    event.type = type;
+    event.core = xPortGetCoreID();
+}
+
+#define TRACE_BEGIN(span) traceRecord(xPortInIsrContext() ? TraceEventType::IsrBegin : TraceEventType::Begin, (uint32_t) (span))
+#define TRACE_END(span)   traceRecord(xPortInIsrContext() ? TraceEventType::IsrEnd : TraceEventType::End, (uint32_t) (span))
+
+// records a span from its construction until the end of the scope
+class TraceScope
+{
+public:
+    explicit TraceScope(TraceSpan span) : span(span) { TRACE_BEGIN(span); }
+    ~TraceScope() { TRACE_END(span); }
+private:
+    TraceSpan span;
+};
+
+#define TRACE_SCOPE(span) TraceScope traceScope(span)
+
+/* prints the recorded events to the serial port and clears the buffer
+ * the output can be converted to a Chrome trace with tools/trace_to_chrome.py
+ */
+void traceDump();
+
+#else
+
+#define TRACE_BEGIN(span) ((void) 0)
+#define TRACE_END(span)   ((void) 0)
+#define TRACE_SCOPE(span) ((void) 0)
+
+inline void traceDump() {}
+
+#endif
+
+#endif
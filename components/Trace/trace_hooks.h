@@ -0,0 +1,39 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* included in every C file of the build when TRACE_ENABLED is 1 (see the CMakeLists.txt of the project)
+ * it defines the FreeRTOS trace macros before FreeRTOSConfig.h does, so the scheduler records task switches
+ */
+
+#ifndef TRACE_HOOKS_H
+#define TRACE_HOOKS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void traceTaskSwitchedIn(void *task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define traceTASK_SWITCHED_IN() traceTaskSwitchedIn(pxCurrentTCB[xPortGetCoreID()])
+
+#endif
@@ -0,0 +1,283 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <sys/time.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp32/clk.h>
+#include <esp32/rom/crc.h>
+#include <nvs.h>
+#include <lwip/apps/sntp.h>
+#include "WallClock.h"
+#include "Logger.h"
+
+// (us) the clock is considered set when it is past this time (2020-01-01)
+static const int64_t minimumValidTime = 1577836800LL * 1000000;
+// (us) a time further than this from the one that follows from the last update was set by someone
+static const int64_t jumpThreshold = 1000000;
+// (ms) the last successful SNTP poll may be up to an hour old, the drift in that time is included
+static const uint32_t ntpUncertainty = 1000;
+// (ms) Manual Time is entered to the minute
+static const uint32_t manualUncertainty = 60000;
+// the RTC slow clock, which keeps counting through a soft reset, is an RC oscillator, much less precise than the crystal
+static const uint32_t rtcDriftPpm = 10000;
+static const uint32_t recordMagic = 0x57434c4b;
+
+static const char *sourceNames[] = { "none", "ntp", "manual", "rtcMemory", "checkpoint" };
+
+struct rtcRecord_t
+{
+    uint32_t magic;
+    int64_t wallTime;      // (us)
+    uint64_t rtcTime;      // (us) esp_clk_rtc_time() at wallTime
+    uint32_t uncertainty;  // (ms)
+    uint8_t source;
+    uint32_t crc;
+};
+
+// not initialized at boot, so after a soft reset it still holds the record of the previous run
+static RTC_NOINIT_ATTR rtcRecord_t rtcRecord;
+
+static uint32_t recordCrc()
+{
+    return crc32_le(0, (const uint8_t *) &rtcRecord, offsetof(rtcRecord_t, crc));
+}
+
+WallClock::WallClock(uint32_t checkpointInterval, uint32_t driftPpm, uint32_t resetMargin) :
+    checkpointInterval(checkpointInterval), driftPpm(driftPpm), resetMargin(resetMargin)
+{
+    mutex = xSemaphoreCreateMutex();
+    source = Source::None;
+    baseTime = 0;
+    baseUncertainty = 0;
+    lastWallTime = 0;
+    lastTime = 0;
+    lastCheckpointTime = 0;
+    hasCorrection = false;
+    lastCorrection = 0;
+}
+
+bool WallClock::restore()
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    nvs_handle_t nvs_handle;
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_UNKNOWN)
+    {
+        // the power was off for an unknown time, so neither the RTC memory nor the checkpoint can be used until the time is set again
+        LOG_D("Power-on reset, there is no time to restore");
+        rtcRecord.magic = 0;
+        if (nvs_open("state", NVS_READWRITE, &nvs_handle) == ESP_OK)
+        {
+            if (nvs_erase_key(nvs_handle, "clock") == ESP_OK)
+                nvs_commit(nvs_handle);
+            nvs_close(nvs_handle);
+        }
+        return false;
+    }
+
+    int64_t wallTime;
+    uint32_t uncertainty;
+    Source restoredSource;
+    if (rtcRecord.magic == recordMagic && rtcRecord.crc == recordCrc())
+    {
+        uint64_t rtcTime = esp_clk_rtc_time();
+        if (rtcTime >= rtcRecord.rtcTime)
+        {
+            // the RTC counter kept running through the reset, so we know how long it took
+            uint64_t elapsed = rtcTime - rtcRecord.rtcTime;
+            wallTime = rtcRecord.wallTime + elapsed;
+            uncertainty = rtcRecord.uncertainty + elapsed * rtcDriftPpm / 1000000000 + 1;
+        }
+        else
+        {
+            // the RTC counter was reset too, for example by a brownout
+            wallTime = rtcRecord.wallTime + resetMargin * 1000LL / 2;
+            uncertainty = rtcRecord.uncertainty + resetMargin / 2;
+        }
+        restoredSource = Source::RtcMemory;
+    }
+    else
+    {
+        checkpoint_t checkpoint;
+        size_t size = sizeof(checkpoint);
+        esp_err_t err = nvs_open("state", NVS_READONLY, &nvs_handle);
+        if (err == ESP_OK)
+        {
+            err = nvs_get_blob(nvs_handle, "clock", &checkpoint, &size);
+            nvs_close(nvs_handle);
+        }
+        if (err != ESP_OK || size != sizeof(checkpoint))
+        {
+            LOG_D("No time to restore");
+            return false;
+        }
+        // the reset happened somewhere between the checkpoint and the next one
+        uint32_t window = checkpointInterval + resetMargin;
+        wallTime = checkpoint.wallTime + window * 1000LL / 2;
+        uncertainty = checkpoint.uncertainty + window / 2;
+        restoredSource = Source::Checkpoint;
+    }
+
+    timeval now = { (time_t) (wallTime / 1000000), (suseconds_t) (wallTime % 1000000) };
+    settimeofday(&now, nullptr);
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int64_t time = esp_timer_get_time();
+    setBase(restoredSource, uncertainty, time);
+    lastWallTime = wallTime;
+    lastTime = time;
+    xSemaphoreGive(mutex);
+    LOG_D("Restored the time from %s: %lld, uncertainty: %u ms", sourceNames[(int) restoredSource], wallTime / 1000000, uncertainty);
+    return true;
+}
+
+void WallClock::update()
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    int64_t wallTime = now.tv_sec * 1000000LL + now.tv_usec;
+    int64_t time = esp_timer_get_time();
+    // the lowest bit of the reachability is the result of the last poll
+    bool ntpSynced = ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) & 1) != 0;
+    bool checkpointDue = false;
+    checkpoint_t checkpoint;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (wallTime >= minimumValidTime)
+    {
+        int64_t expectedWallTime = lastWallTime + (time - lastTime);
+        bool jumped = lastTime && llabs(wallTime - expectedWallTime) > jumpThreshold;
+        if (ntpSynced)
+        {
+            if (source == Source::RtcMemory || source == Source::Checkpoint)
+            {
+                hasCorrection = true;
+                lastCorrection = (wallTime - expectedWallTime) / 1000;
+                LOG_D("NTP corrected the restored time by %d ms, the uncertainty was %u ms", lastCorrection, internal_getUncertainty(time));
+            }
+            setBase(Source::Ntp, ntpUncertainty, time);
+        }
+        else if (source == Source::None || jumped)
+        {
+            LOG_D("The time was set by hand");
+            setBase(Source::Manual, manualUncertainty, time);
+        }
+
+        memset(&rtcRecord, 0, sizeof(rtcRecord));
+        rtcRecord.magic = recordMagic;
+        rtcRecord.wallTime = wallTime;
+        rtcRecord.rtcTime = esp_clk_rtc_time();
+        rtcRecord.uncertainty = internal_getUncertainty(time);
+        rtcRecord.source = (uint8_t) source;
+        rtcRecord.crc = recordCrc();
+
+        if (!lastCheckpointTime || time - lastCheckpointTime >= checkpointInterval * 1000LL)
+        {
+            checkpointDue = true;
+            lastCheckpointTime = time;
+            checkpoint.wallTime = wallTime;
+            checkpoint.uncertainty = rtcRecord.uncertainty;
+        }
+    }
+    lastWallTime = wallTime;
+    lastTime = time;
+    xSemaphoreGive(mutex);
+
+    if (checkpointDue)
+    {
+        nvs_handle_t nvs_handle;
+        esp_err_t err = nvs_open("state", NVS_READWRITE, &nvs_handle);
+        if (err == ESP_OK)
+        {
+            err = nvs_set_blob(nvs_handle, "clock", &checkpoint, sizeof(checkpoint));
+            if (err == ESP_OK)
+                err = nvs_commit(nvs_handle);
+            nvs_close(nvs_handle);
+        }
+        if (err != ESP_OK)
+        {
+            LOG_E("Error saving the clock checkpoint: %d", err);
+        }
+    }
+}
+
+WallClock::Source WallClock::getSource()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Source value = source;
+    xSemaphoreGive(mutex);
+    return value;
+}
+
+const char *WallClock::getSourceName()
+{
+    return sourceNames[(int) getSource()];
+}
+
+uint32_t WallClock::getUncertainty()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint32_t value = internal_getUncertainty(esp_timer_get_time());
+    xSemaphoreGive(mutex);
+    return value;
+}
+
+bool WallClock::getLastCorrection(int32_t &correction)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    correction = lastCorrection;
+    bool value = hasCorrection;
+    xSemaphoreGive(mutex);
+    return value;
+}
+
+int WallClock::toJson(char *buffer, size_t size)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    char uncertainty[12] = "null";
+    char correction[12] = "null";
+    if (source != Source::None)
+        snprintf(uncertainty, sizeof(uncertainty), "%u", internal_getUncertainty(esp_timer_get_time()));
+    if (hasCorrection)
+        snprintf(correction, sizeof(correction), "%d", lastCorrection);
+    int length = snprintf(buffer, size, R"==({"source": "%s", "uncertainty": %s, "correction": %s})==",
+        sourceNames[(int) source], uncertainty, correction);
+    xSemaphoreGive(mutex);
+    return length;
+}
+
+uint32_t WallClock::internal_getUncertainty(int64_t now)
+{
+    if (source == Source::None)
+        return UINT32_MAX;
+    uint64_t drift = (uint64_t) (now - baseTime) * driftPpm / 1000000000;
+    return (uint32_t) std::min<uint64_t>(baseUncertainty + drift, UINT32_MAX - 1);
+}
+
+void WallClock::setBase(Source source, uint32_t uncertainty, int64_t now)
+{
+    this->source = source;
+    baseUncertainty = uncertainty;
+    baseTime = now;
+}
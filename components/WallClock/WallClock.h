@@ -0,0 +1,106 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/* keeps the wall clock time across reboots, and tracks how far off it may be
+ * update() refreshes a record in RTC slow memory, which survives soft resets, and periodically saves a checkpoint to NVS
+ * after a reset that wasn't a power-on, restore() sets the time from them, so the thermostat doesn't have to wait for NTP
+ * the uncertainty grows with the drift of the clock since the time was last set, and the correction applied by
+ * the first NTP sync after a restore is kept, to check that the bound holds
+ */
+class WallClock
+{
+public:
+
+    enum class Source : uint8_t
+    {
+        None,        // the time isn't set
+        Ntp,
+        Manual,      // entered in Manual Time
+        RtcMemory,   // restored from RTC memory after a reset
+        Checkpoint   // restored from the NVS checkpoint after a reset
+    };
+
+    /* checkpointInterval - how often the time is saved to NVS (ms)
+     * driftPpm - the maximum drift of the system clock
+     * resetMargin - how long a reset may take, including the time since the last update (ms)
+     */
+    WallClock(uint32_t checkpointInterval, uint32_t driftPpm, uint32_t resetMargin);
+
+    // sets the time after a reset that wasn't a power-on, returns if it was set
+    bool restore();
+
+    /* notices when the time is set by NTP or by hand, refreshes the RTC memory record and saves the checkpoint when it is due
+     * it should be called at least every few seconds
+     */
+    void update();
+
+    Source getSource();
+
+    const char *getSourceName();
+
+    // how far the time may be from the real time (ms), UINT32_MAX if it isn't set
+    uint32_t getUncertainty();
+
+    /* the difference between the NTP time and the restored time, at the first NTP sync after a restore (ms)
+     * returns false if there was no such sync
+     */
+    bool getLastCorrection(int32_t &correction);
+
+    /* writes the source, the uncertainty and the last correction as a JSON object to buffer
+     * returns the length of the string, like snprintf
+     */
+    int toJson(char *buffer, size_t size);
+
+private:
+
+    struct checkpoint_t
+    {
+        int64_t wallTime;      // (us)
+        uint32_t uncertainty;  // (ms)
+    };
+
+    uint32_t internal_getUncertainty(int64_t now);
+    void setBase(Source source, uint32_t uncertainty, int64_t now);
+
+    const uint32_t checkpointInterval;
+    const uint32_t driftPpm;
+    const uint32_t resetMargin;
+
+    Source source;
+    // (us) esp_timer time when the uncertainty was baseUncertainty, it grows with the drift from there
+    int64_t baseTime;
+    uint32_t baseUncertainty;  // (ms)
+    // wall clock and esp_timer times of the last update, a time that doesn't follow from them was set by someone
+    int64_t lastWallTime;
+    int64_t lastTime;
+    int64_t lastCheckpointTime;
+    bool hasCorrection;
+    int32_t lastCorrection;
+    SemaphoreHandle_t mutex;
+};
+
+#endif
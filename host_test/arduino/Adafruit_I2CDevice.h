@@ -0,0 +1,6 @@
+#ifndef ADAFRUIT_I2CDEVICE_H
+#define ADAFRUIT_I2CDEVICE_H
+
+// included by Adafruit_GFX.h, the displays of the thermostat don't use I2C
+
+#endif
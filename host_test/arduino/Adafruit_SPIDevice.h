@@ -0,0 +1,6 @@
+#ifndef ADAFRUIT_SPIDEVICE_H
+#define ADAFRUIT_SPIDEVICE_H
+
+// included by Adafruit_GFX.h, on the host nothing is sent over SPI
+
+#endif
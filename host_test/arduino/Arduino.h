@@ -0,0 +1,64 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/* the part of the Arduino core that the libraries built by host_test use, on Linux
+ * only what Adafruit_GFX needs to draw into a Framebuffer is here, the hardware functions are left out on purpose
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+#define DEC 10
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class String
+{
+public:
+
+    String(const char *str = "") : value(str) {}
+
+    const char *c_str() const { return value.c_str(); }
+
+    unsigned int length() const { return value.length(); }
+
+private:
+
+    std::string value;
+};
+
+#include "Print.h"
+
+#endif
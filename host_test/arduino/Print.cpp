@@ -0,0 +1,181 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "Arduino.h"
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (size--)
+        written += write(*buffer++);
+    return written;
+}
+
+size_t Print::write(const char *str)
+{
+    return str ? write((const uint8_t *) str, strlen(str)) : 0;
+}
+
+size_t Print::write(const char *buffer, size_t size)
+{
+    return write((const uint8_t *) buffer, size);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char buffer[128];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+        return 0;
+    // nothing drawn on an 84x48 screen is longer than the buffer
+    return write(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+}
+
+size_t Print::print(const __FlashStringHelper *str)
+{
+    return write((const char *) str);
+}
+
+size_t Print::print(const String &str)
+{
+    return write(str.c_str(), str.length());
+}
+
+size_t Print::print(const char str[])
+{
+    return write(str);
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+    return print((unsigned long) n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+    return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+    return print((unsigned long) n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == 10 && n < 0)
+        return internal_printNumber(-(unsigned long) n, base, true);
+    return internal_printNumber(n, base, false);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return internal_printNumber(n, base, false);
+}
+
+size_t Print::print(double n, int digits)
+{
+    return printf("%.*f", digits, n);
+}
+
+size_t Print::println(const __FlashStringHelper *str)
+{
+    return print(str) + println();
+}
+
+size_t Print::println(const String &str)
+{
+    return print(str) + println();
+}
+
+size_t Print::println(const char str[])
+{
+    return print(str) + println();
+}
+
+size_t Print::println(char c)
+{
+    return print(c) + println();
+}
+
+size_t Print::println(unsigned char n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(long n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned long n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(double n, int digits)
+{
+    return print(n, digits) + println();
+}
+
+size_t Print::println()
+{
+    return write("\r\n");
+}
+
+size_t Print::internal_printNumber(unsigned long n, int base, bool negative)
+{
+    char buffer[8 * sizeof(long) + 2];
+    char *str = buffer + sizeof(buffer) - 1;
+    *str = '\0';
+    if (base < 2)
+        base = 10;
+    do
+    {
+        unsigned long digit = n % base;
+        n /= base;
+        *--str = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while (n);
+    if (negative)
+        *--str = '-';
+    return write(str);
+}
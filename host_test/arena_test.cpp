@@ -0,0 +1,306 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "host_test.h"
+#include "Arena.h"
+
+/* the arenas of FirebaseClient are allocated once and reset before every request, for as long as the device runs
+ * this runs as many requests as a year of polling would make, with allocations of random sizes,
+ * and checks that the arena never moves, never hands out overlapping or unaligned memory, and never runs out of room it had
+ * then it runs the requests against a model of the heap, with the TLS connection each request allocates and frees,
+ * and checks that the largest free block stays the same
+ */
+
+static const size_t capacity = 6144;
+static const size_t alignment = 8;
+// (bytes) FirebaseClient::streamArenaSize
+static const size_t streamArenaSize = 512;
+
+struct allocation_t
+{
+    uintptr_t start;
+    size_t size;
+};
+
+// the same sizes on every run, so a failure can be reproduced
+static uint32_t seed = 1;
+static size_t randomSize(size_t max)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % (max + 1);
+}
+
+static void testAllocate()
+{
+    Arena arena;
+    CHECK(arena.begin(capacity));
+    CHECK_EQUAL(capacity, arena.getAvailable());
+    CHECK(arena.allocate(capacity + 1) == nullptr);
+    // a failed allocation takes nothing
+    CHECK_EQUAL(capacity, arena.getAvailable());
+    char *first = (char *) arena.allocate(1);
+    char *second = (char *) arena.allocate(1);
+    CHECK(first != nullptr);
+    CHECK_EQUAL(alignment, second - first);
+    CHECK_EQUAL(capacity - 2 * alignment, arena.getAvailable());
+    // the rest of the arena, like the response of a request
+    CHECK(arena.allocate(arena.getAvailable()) != nullptr);
+    CHECK_EQUAL(0, arena.getAvailable());
+    CHECK(arena.allocate(1) == nullptr);
+    CHECK_EQUAL(capacity, arena.getPeak());
+    arena.reset();
+    CHECK(arena.allocate(1) == first);
+}
+
+static void testPrintf()
+{
+    Arena arena;
+    CHECK(arena.begin(64));
+    char *url = arena.printf("https://%s%s?%s", "example.firebaseio.com", "/Schedules.json", "auth=x");
+    CHECK(url != nullptr && strcmp(url, "https://example.firebaseio.com/Schedules.json?auth=x") == 0);
+    // a result that doesn't fit takes nothing
+    size_t available = arena.getAvailable();
+    CHECK(arena.printf("%064d", 0) == nullptr);
+    CHECK_EQUAL(available, arena.getAvailable());
+    // the terminating null must fit too
+    arena.reset();
+    CHECK(arena.printf("%063d", 0) != nullptr);
+    arena.reset();
+    CHECK(arena.printf("%064d", 0) == nullptr);
+}
+
+static void testLongRun()
+{
+    Arena arena;
+    CHECK(arena.begin(capacity));
+    char *buffer = (char *) arena.allocate(0);
+    // a year of requests, one every 10 s
+    const size_t requests = 365 * 24 * 360;
+    size_t failures = 0;
+    for (size_t request = 0; request < requests; request++)
+    {
+        // begin() with the same capacity keeps the buffer, like FirebaseClient::begin after a reconnect
+        if (request % 10000 == 0)
+            CHECK(arena.begin(capacity));
+        arena.reset();
+        CHECK_EQUAL(capacity, arena.getAvailable());
+        std::vector<allocation_t> allocations;
+        size_t used = 0;
+        for (size_t count = randomSize(8); count > 0; count--)
+        {
+            size_t size = randomSize(1024);
+            char *data = (char *) arena.allocate(size);
+            size_t start = (used + alignment - 1) & ~(alignment - 1);
+            if (start + size > capacity)
+            {
+                CHECK(data == nullptr);
+                continue;
+            }
+            // the allocations follow each other from the start of the same buffer, so nothing is lost between requests
+            if (data != buffer + start)
+                failures++;
+            memset(data, (int) request, size);
+            allocations.push_back({ (uintptr_t) data, size });
+            used = start + size;
+        }
+        for (size_t i = 1; i < allocations.size(); i++)
+        {
+            if (allocations[i].start % alignment || allocations[i].start < allocations[i - 1].start + allocations[i - 1].size)
+                failures++;
+        }
+    }
+    CHECK_EQUAL(0, failures);
+    CHECK(arena.getPeak() <= capacity);
+    arena.reset();
+    CHECK(arena.allocate(0) == buffer);
+    printf("%zu requests, peak %zu of %zu bytes\n", requests, arena.getPeak(), capacity);
+}
+
+/* a model of the heap of the ESP32: first fit in the order of the addresses, 4 byte aligned blocks with a 4 byte header,
+ * and a freed block is merged with the free blocks next to it
+ */
+class HeapModel
+{
+public:
+
+    explicit HeapModel(size_t size)
+    {
+        blocks.push_back({ 0, size, true });
+    }
+
+    // returns the address of the allocation in the heap, or SIZE_MAX if there is no free block large enough
+    size_t allocate(size_t size)
+    {
+        size = ((size + 3) & ~(size_t) 3) + 4;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (!blocks[i].free || blocks[i].size < size)
+                continue;
+            if (blocks[i].size > size)
+                blocks.insert(blocks.begin() + i + 1, { blocks[i].start + size, blocks[i].size - size, true });
+            blocks[i].size = size;
+            blocks[i].free = false;
+            return blocks[i].start;
+        }
+        return SIZE_MAX;
+    }
+
+    void free(size_t address)
+    {
+        size_t i = 0;
+        while (blocks[i].start != address)
+            i++;
+        blocks[i].free = true;
+        if (i + 1 < blocks.size() && blocks[i + 1].free)
+        {
+            blocks[i].size += blocks[i + 1].size;
+            blocks.erase(blocks.begin() + i + 1);
+        }
+        if (i > 0 && blocks[i - 1].free)
+        {
+            blocks[i - 1].size += blocks[i].size;
+            blocks.erase(blocks.begin() + i);
+        }
+    }
+
+    size_t getLargestFreeBlock() const
+    {
+        size_t largest = 0;
+        for (const block_t &block : blocks)
+        {
+            if (block.free)
+                largest = std::max(largest, block.size);
+        }
+        return largest;
+    }
+
+private:
+
+    struct block_t
+    {
+        size_t start;
+        size_t size;
+        bool free;
+    };
+    std::vector<block_t> blocks;  // in the order of the addresses, they cover the whole heap
+};
+
+// frees the allocations in a random order, like the parts of a TLS connection
+static void freeAll(HeapModel &heap, std::vector<size_t> &allocations)
+{
+    while (!allocations.empty())
+    {
+        size_t i = randomSize(allocations.size() - 1);
+        heap.free(allocations[i]);
+        allocations.erase(allocations.begin() + i);
+    }
+}
+
+/* a request of FirebaseClient: esp-tls allocates the TLS connection when the request starts
+ * (the contexts, the 16 KB input and 4 KB output records, and the certificates and handshake state of random sizes,
+ * the handshake state freed when the handshake is over) and frees it when the request ends
+ * the URL and the response come from the request arena, or from the heap if responseInHeap, like a response buffer
+ * that is allocated for each request and kept until the next one
+ * returns the address of the response in the heap, or SIZE_MAX
+ */
+static size_t runRequest(HeapModel &heap, Arena &arena, bool responseInHeap, size_t previousResponse)
+{
+    std::vector<size_t> connection;
+    for (size_t size : { 220, 440, 360, 16717, 4429 })
+        connection.push_back(heap.allocate(size));
+    std::vector<size_t> handshake;
+    for (size_t count = 8 + randomSize(16); count > 0; count--)
+    {
+        // the certificates of the server are kept until the connection is closed
+        std::vector<size_t> &allocations = randomSize(1) ? handshake : connection;
+        allocations.push_back(heap.allocate(16 + randomSize(2032)));
+    }
+    freeAll(heap, handshake);
+
+    size_t response = SIZE_MAX;
+    if (responseInHeap)
+    {
+        if (previousResponse != SIZE_MAX)
+            heap.free(previousResponse);
+        response = heap.allocate(256 + randomSize(8192));
+    }
+    else
+    {
+        arena.reset();
+        arena.printf("https://%s%s?%s", "example.firebaseio.com", "/Schedules.json", "auth=x");
+        arena.allocate(arena.getAvailable());
+    }
+
+    freeAll(heap, connection);
+    return response;
+}
+
+static void testHeapFragmentation()
+{
+    // (bytes) the request arena of the firmware, with 64 schedules of 224 bytes
+    const size_t requestArenaSize = 256 + 64 * 224 + 8;
+    // a week of requests, one every 10 s
+    const size_t requests = 7 * 24 * 360;
+
+    // the arenas are allocated once, when the Firebase client begins, before its first request
+    HeapModel heap(120 * 1024);
+    Arena arena;
+    CHECK(arena.begin(requestArenaSize));
+    CHECK(heap.allocate(requestArenaSize) != SIZE_MAX);
+    CHECK(heap.allocate(streamArenaSize) != SIZE_MAX);
+    runRequest(heap, arena, false, SIZE_MAX);
+    size_t largest = heap.getLargestFreeBlock();
+    size_t changes = 0;
+    for (size_t request = 1; request < requests; request++)
+    {
+        runRequest(heap, arena, false, SIZE_MAX);
+        if (heap.getLargestFreeBlock() != largest)
+            changes++;
+    }
+    CHECK_EQUAL(0, changes);
+
+    // the model has to notice fragmentation: a response kept in the heap is placed after the buffers of the connection,
+    // so it splits the free memory when the connection is freed
+    HeapModel fragmentedHeap(120 * 1024);
+    CHECK(fragmentedHeap.allocate(streamArenaSize) != SIZE_MAX);
+    size_t response = SIZE_MAX;
+    size_t smallest = SIZE_MAX;
+    for (size_t request = 0; request < requests; request++)
+    {
+        response = runRequest(fragmentedHeap, arena, true, response);
+        smallest = std::min(smallest, fragmentedHeap.getLargestFreeBlock());
+    }
+    CHECK(smallest < largest);
+    printf("largest free block after %zu requests: %zu bytes with the arena, down to %zu without\n", requests, largest, smallest);
+}
+
+int main()
+{
+    testAllocate();
+    testPrintf();
+    testLongRun();
+    testHeapFragmentation();
+    return hostTestResult();
+}
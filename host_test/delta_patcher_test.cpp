@@ -0,0 +1,202 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "host_test.h"
+#include "DeltaPatcher.h"
+
+/* applies a patch made by tools/ota_artifacts.py with DeltaPatcher, the way OtaUpdater does after decompressing it,
+ * and checks that the result is the target image byte for byte
+ * usage: delta_patcher_test <python> <ota_artifacts.py> <work directory>
+ */
+
+typedef std::vector<uint8_t> bytes_t;
+
+static bytes_t readFile(const std::string &path)
+{
+    bytes_t data;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return data;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + length);
+    fclose(file);
+    return data;
+}
+
+static bool writeFile(const std::string &path, const bytes_t &data)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && written;
+}
+
+// like the Inflater of the thermostat, it fails if the window of the stream is larger than 4 KB
+static bytes_t inflate(const bytes_t &compressed)
+{
+    bytes_t data;
+    z_stream stream = {};
+    inflateInit2(&stream, 12);
+    stream.next_in = const_cast<uint8_t *>(compressed.data());
+    stream.avail_in = compressed.size();
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        uint8_t buffer[4096];
+        stream.next_out = buffer;
+        stream.avail_out = sizeof(buffer);
+        status = ::inflate(&stream, Z_NO_FLUSH);
+        data.insert(data.end(), buffer, buffer + sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END)
+        data.clear();
+    return data;
+}
+
+// the same bytes on every run, so a failure can be reproduced
+static bytes_t randomBytes(size_t length, uint32_t seed)
+{
+    bytes_t data(length);
+    for (uint8_t &byte : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 16;
+    }
+    return data;
+}
+
+/* an image and the next version of it, with the changes a new firmware has:
+ * addresses that moved by a few bytes, new code, removed code and code that moved
+ */
+static void makeImages(bytes_t &source, bytes_t &target)
+{
+    source = randomBytes(48 * 1024, 1);
+    // hash_appended of the image header is set, so both sides take the last 32 bytes as the SHA-256 of the image
+    source[23] = 1;
+
+    target.assign(source.begin(), source.begin() + 8192);
+    for (size_t i = 0; i < 4096; i += 4)
+    {
+        target.insert(target.end(), source.begin() + 8192 + i, source.begin() + 8192 + i + 3);
+        target.push_back(source[8192 + i + 3] + 8);
+    }
+    bytes_t inserted = randomBytes(3000, 2);
+    target.insert(target.end(), inserted.begin(), inserted.end());
+    target.insert(target.end(), source.begin() + 24 * 1024, source.begin() + 40 * 1024);
+    target.insert(target.end(), source.begin() + 12 * 1024, source.begin() + 16 * 1024);
+    target.insert(target.end(), source.begin() + 40 * 1024, source.end());
+}
+
+static esp_err_t appendOutput(void *context, const uint8_t *data, size_t length)
+{
+    bytes_t *output = static_cast<bytes_t *>(context);
+    output->insert(output->end(), data, data + length);
+    return ESP_OK;
+}
+
+// applies the patch in pieces of chunkSize bytes, returns the first error
+static esp_err_t applyPatch(const bytes_t &source, const bytes_t &patch, size_t chunkSize, bytes_t &output, bool *done = nullptr)
+{
+    esp_partition_t partition = { 0x10000, (uint32_t) source.size(), source.data() };
+    DeltaPatcher patcher(appendOutput, &output);
+    patcher.begin(&partition, source.data() + source.size() - 32);
+    output.clear();
+    for (size_t offset = 0; offset < patch.size(); offset += chunkSize)
+    {
+        esp_err_t err = patcher.write(patch.data() + offset, std::min(chunkSize, patch.size() - offset));
+        if (err != ESP_OK)
+            return err;
+    }
+    if (done)
+        *done = patcher.isDone();
+    return ESP_OK;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <python> <ota_artifacts.py> <work directory>\n", argv[0]);
+        return 2;
+    }
+    std::string directory = argv[3];
+    bytes_t source, target;
+    makeImages(source, target);
+    CHECK(writeFile(directory + "/source.bin", source));
+    CHECK(writeFile(directory + "/target.bin", target));
+    std::string command = std::string(argv[1]) + " " + argv[2] + " delta "
+        + directory + "/source.bin " + directory + "/target.bin -o " + directory + "/patch.z";
+    CHECK_EQUAL(0, system(command.c_str()));
+    bytes_t patch = inflate(readFile(directory + "/patch.z"));
+    CHECK(!patch.empty());
+    if (patch.empty())
+        return hostTestResult();
+
+    // the pieces OtaUpdater gets from the decompressor have any size, the commands and the header are split between them
+    for (size_t chunkSize : { (size_t) 1, (size_t) 7, (size_t) 256, (size_t) 1024, patch.size() })
+    {
+        bytes_t output;
+        bool done = false;
+        CHECK_EQUAL(ESP_OK, applyPatch(source, patch, chunkSize, output, &done));
+        CHECK(done);
+        CHECK_EQUAL(target.size(), output.size());
+        CHECK(output == target);
+    }
+
+    bytes_t output;
+    // made against another image, OtaUpdater falls back to the full image
+    bytes_t otherSource = source;
+    otherSource[otherSource.size() - 1] ^= 1;
+    CHECK_EQUAL(ESP_ERR_INVALID_VERSION, applyPatch(otherSource, patch, 1024, output));
+
+    // an unknown command
+    bytes_t corrupted = patch;
+    corrupted[44] = 9;
+    CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, applyPatch(source, corrupted, 1024, output));
+
+    // a command that reads past the end of the source
+    corrupted = patch;
+    corrupted[44] = 1;
+    corrupted[45] = corrupted[46] = corrupted[47] = corrupted[48] = 0xff;
+    CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, applyPatch(source, corrupted, 1024, output));
+
+    // data after the end of the patch
+    corrupted = patch;
+    corrupted.push_back(3);
+    CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, applyPatch(source, corrupted, 1024, output));
+
+    // a patch cut short doesn't rebuild the whole image
+    corrupted.assign(patch.begin(), patch.end() - 100);
+    bool done = true;
+    CHECK_EQUAL(ESP_OK, applyPatch(source, corrupted, 1024, output, &done));
+    CHECK(!done);
+
+    printf("patch: %zu bytes, %zu bytes compressed, for a %zu bytes image\n",
+        patch.size(), readFile(directory + "/patch.z").size(), target.size());
+    return hostTestResult();
+}
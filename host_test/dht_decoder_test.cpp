@@ -0,0 +1,131 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <vector>
+#include "host_test.h"
+#include "DhtDecoder.h"
+
+/* feeds DhtDecoder the pulses a DHT22 and a DHT11 send, with the timings of DhtRmtSensor's captures:
+ * the start signal released by the ESP32, the 80 us answer of the sensor, the 40 bits, and the line going idle
+ */
+
+typedef std::vector<dhtPulse_t> pulses_t;
+
+// the capture of a frame with the 4 data bytes and their checksum, the pulse after the last bit is the idle line
+static pulses_t makeFrame(const uint8_t *bytes, uint16_t idleDuration)
+{
+    uint8_t data[5] = { bytes[0], bytes[1], bytes[2], bytes[3], 0 };
+    data[4] = data[0] + data[1] + data[2] + data[3];
+    pulses_t pulses = { { 0, 1500 }, { 1, 30 }, { 0, 80 }, { 1, 82 } };
+    for (int bit = 0; bit < 40; bit++)
+    {
+        bool one = data[bit / 8] & (0x80 >> (bit % 8));
+        pulses.push_back({ 0, 52 });
+        pulses.push_back({ 1, (uint16_t) (one ? 71 : 26) });
+    }
+    pulses.push_back({ 0, 50 });
+    pulses.push_back({ 1, idleDuration });
+    return pulses;
+}
+
+static DhtDecoder::Result decode(const pulses_t &pulses, bool dht11, float &temperature, float &humidity)
+{
+    return DhtDecoder::decode(pulses.data(), pulses.size(), dht11, temperature, humidity);
+}
+
+static void testValid()
+{
+    // 65.2 %, -10.1 °C
+    const uint8_t dht22[4] = { 0x02, 0x8C, 0x80, 0x65 };
+    float temperature = 0, humidity = 0;
+    CHECK_EQUAL((int) DhtDecoder::Result::Ok, (int) decode(makeFrame(dht22, 0), false, temperature, humidity));
+    CHECK_EQUAL(-101, (long long) (temperature * 10 - 0.5f));
+    CHECK_EQUAL(652, (long long) (humidity * 10 + 0.5f));
+
+    // 40 %, 23.5 °C
+    const uint8_t dht11[4] = { 40, 0, 23, 5 };
+    CHECK_EQUAL((int) DhtDecoder::Result::Ok, (int) decode(makeFrame(dht11, 0), true, temperature, humidity));
+    CHECK_EQUAL(235, (long long) (temperature * 10 + 0.5f));
+    CHECK_EQUAL(400, (long long) (humidity * 10 + 0.5f));
+
+    // the capture started late, after the answer of the sensor
+    pulses_t late = makeFrame(dht22, 0);
+    late.erase(late.begin(), late.begin() + 4);
+    CHECK_EQUAL((int) DhtDecoder::Result::Ok, (int) decode(late, false, temperature, humidity));
+}
+
+static void testTrailingIdle()
+{
+    // the line stays high after the last bit until the capture ends, longer than any bit
+    const uint8_t bytes[4] = { 0x01, 0xF4, 0x00, 0xD2 };
+    float temperature = 0, humidity = 0;
+    for (uint16_t idleDuration : { 121, 200, 1000, 32767 })
+    {
+        CHECK_EQUAL((int) DhtDecoder::Result::Ok, (int) decode(makeFrame(bytes, idleDuration), false, temperature, humidity));
+        CHECK_EQUAL(210, (long long) (temperature * 10 + 0.5f));
+        CHECK_EQUAL(500, (long long) (humidity * 10 + 0.5f));
+    }
+}
+
+static void testChecksumError()
+{
+    const uint8_t bytes[4] = { 0x02, 0x8C, 0x80, 0x65 };
+    pulses_t pulses = makeFrame(bytes, 200);
+    // the 10th bit, a 0, read as a 1
+    pulses[4 + 2 * 9 + 1].duration = 71;
+    float temperature = 0, humidity = 0;
+    CHECK_EQUAL((int) DhtDecoder::Result::ChecksumError, (int) decode(pulses, false, temperature, humidity));
+    CHECK_EQUAL(0, (long long) temperature);
+    CHECK_EQUAL(0, (long long) humidity);
+}
+
+static void testTruncated()
+{
+    const uint8_t bytes[4] = { 0x02, 0x8C, 0x80, 0x65 };
+    pulses_t pulses = makeFrame(bytes, 0);
+    float temperature, humidity;
+    // the capture ended in the middle of the frame
+    pulses_t truncated(pulses.begin(), pulses.begin() + 30);
+    CHECK_EQUAL((int) DhtDecoder::Result::TooFewBits, (int) decode(truncated, false, temperature, humidity));
+    // the start of the frame was lost
+    truncated.assign(pulses.begin() + 40, pulses.end());
+    CHECK_EQUAL((int) DhtDecoder::Result::TooFewBits, (int) decode(truncated, false, temperature, humidity));
+    CHECK_EQUAL((int) DhtDecoder::Result::TooFewBits, (int) DhtDecoder::decode(nullptr, 0, false, temperature, humidity));
+}
+
+static void testInvalidBit()
+{
+    // a high pulse too long to be a bit among the bits is still an error
+    const uint8_t bytes[4] = { 0x02, 0x8C, 0x80, 0x65 };
+    pulses_t pulses = makeFrame(bytes, 200);
+    pulses[4 + 2 * 20 + 1].duration = 150;
+    float temperature, humidity;
+    CHECK_EQUAL((int) DhtDecoder::Result::InvalidBit, (int) decode(pulses, false, temperature, humidity));
+}
+
+int main()
+{
+    testValid();
+    testTrailingIdle();
+    testChecksumError();
+    testTruncated();
+    testInvalidBit();
+    return hostTestResult();
+}
@@ -0,0 +1,62 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+
+/* checks for the test programs of host_test, built and run on Linux
+ * a failed check is printed and counted, the test program returns hostTestResult() from main()
+ */
+
+static int hostTestFailures = 0;
+
+#define CHECK(condition)                                                                               \
+    do                                                                                                 \
+    {                                                                                                  \
+        if (!(condition))                                                                              \
+        {                                                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);              \
+            hostTestFailures++;                                                                        \
+        }                                                                                              \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                                  \
+    do                                                                                                 \
+    {                                                                                                  \
+        long long expectedValue = (expected);                                                          \
+        long long actualValue = (actual);                                                              \
+        if (expectedValue != actualValue)                                                              \
+        {                                                                                              \
+            fprintf(stderr, "%s:%d: CHECK_EQUAL(%s, %s) failed: expected %lld, got %lld\n",            \
+                __FILE__, __LINE__, #expected, #actual, expectedValue, actualValue);                   \
+            hostTestFailures++;                                                                        \
+        }                                                                                              \
+    } while (0)
+
+inline int hostTestResult()
+{
+    if (hostTestFailures)
+        fprintf(stderr, "%d checks failed\n", hostTestFailures);
+    return hostTestFailures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstdio>
+
+// the errors and warnings of the components built in host_test are printed, the rest is left out like in release builds
+
+#define LOG_INIT()
+#define LOG_E(format, ...) fprintf(stderr, "E %s: " format "\n", __func__, ##__VA_ARGS__)
+#define LOG_W(format, ...) fprintf(stderr, "W %s: " format "\n", __func__, ##__VA_ARGS__)
+#define LOG_D(format, ...)
+#define LOG_T(format, ...)
+
+#endif
@@ -0,0 +1,46 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ESP_PARTITION_H
+#define ESP_PARTITION_H
+
+#include <cstddef>
+#include <cstring>
+#include "esp_err.h"
+
+/* a partition backed by a buffer in RAM, instead of the flash
+ * hostData is only in host_test, the tests point it at the contents of the partition
+ */
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+    const uint8_t *hostData;
+} esp_partition_t;
+
+inline esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset > partition->size || size > partition->size - src_offset)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, partition->hostData + src_offset, size);
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,213 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include "MemoryDisplay.h"
+#include "screens.h"
+#include "string_consts.h"
+#include "host_test.h"
+
+/* renders every screen into a MemoryDisplay and compares it with golden/<name>.pbm
+ * usage: screens_test <golden directory> <output directory> [--update-golden]
+ * the rendered images are written to the output directory, --update-golden also writes them over the golden ones,
+ * which is how a change of a screen is accepted, after looking at the new images
+ * the golden directory must exist, the first images are made with mkdir host_test/golden and --update-golden
+ * it also prints how long a frame takes to render and how many bytes would be sent to the display
+ */
+
+static const int benchmarkFrames = 1000;
+
+struct screenCase_t
+{
+    const char *name;
+    std::function<void(MemoryDisplay &)> draw;
+};
+
+static tm makeTime(int year, int mon, int mday, int wday, int hour, int min)
+{
+    tm time = {};
+    time.tm_year = year - 1900;
+    time.tm_mon = mon - 1;
+    time.tm_mday = mday;
+    time.tm_wday = wday;
+    time.tm_hour = hour;
+    time.tm_min = min;
+    return time;
+}
+
+static const mainScreenState_t mainScreen = { makeTime(2020, 6, 5, 5, 12, 34), 21.4f, 45, true, 0 };
+static const mainScreenState_t mainScreenNextMinute = { makeTime(2020, 6, 5, 5, 12, 35), 21.4f, 45, true, 0 };
+static const mainScreenState_t mainScreenErrors = { makeTime(2020, 12, 31, 4, 23, 59), NAN, -1, false, DisplayErrorWifi | DisplayErrorSensor };
+
+static const screenCase_t screens[] = {
+    { "simple_display", [](MemoryDisplay &display) { simpleDisplay(display, waitingForWifiString); } },
+    { "startup_menu_normal", [](MemoryDisplay &display) { startupMenuHelper(display, 0); } },
+    { "startup_menu_setup", [](MemoryDisplay &display) { startupMenuHelper(display, 1); } },
+    { "temporary_schedule_temp", [](MemoryDisplay &display) { temporaryScheduleHelper(display, 21.5f, 90, 0, 0, 0); } },
+    { "temporary_schedule_cancel", [](MemoryDisplay &display) { temporaryScheduleHelper(display, 19.0f, 30, 0, 1, 2); } },
+    { "temporary_schedule_active", [](MemoryDisplay &display) { temporaryScheduleHelper(display, 22.0f, -1, 125, 0, 1); } },
+    { "temporary_schedule_infinite", [](MemoryDisplay &display) { temporaryScheduleHelper(display, 22.0f, 24 * 60 + 30, 0, 0, 1); } },
+    { "manual_time_hour", [](MemoryDisplay &display) { manualTimeHelper(display, 7, 5, 1, 1, 2020, 0); } },
+    { "manual_time_year", [](MemoryDisplay &display) { manualTimeHelper(display, 23, 59, 31, 12, 2021, 4); } },
+    { "setup_info", [](MemoryDisplay &display) { setupDisplayInfo(display, "Thermostat", "Thermostat123"); } },
+    { "main_screen", [](MemoryDisplay &display) {
+        mainScreenCache_t cache;
+        drawMainScreen(display, mainScreen, cache);
+    } },
+    { "main_screen_errors", [](MemoryDisplay &display) {
+        mainScreenCache_t cache;
+        drawMainScreen(display, mainScreenErrors, cache);
+    } },
+    // only the clock is redrawn, the image has to be the same as if the whole screen was drawn with the new minute
+    { "main_screen_next_minute", [](MemoryDisplay &display) {
+        mainScreenCache_t cache;
+        drawMainScreen(display, mainScreen, cache);
+        display.resetStatistics();
+        drawMainScreen(display, mainScreenNextMinute, cache);
+    } },
+};
+
+static std::string readFile(const std::string &path, bool &found)
+{
+    std::ifstream file(path);
+    found = file.good();
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static bool writeFile(const std::string &path, const std::string &contents)
+{
+    std::ofstream file(path);
+    file << contents;
+    return file.good();
+}
+
+static std::string toPBM(const MemoryDisplay &display)
+{
+    char *buffer = nullptr;
+    size_t size = 0;
+    FILE *file = open_memstream(&buffer, &size);
+    display.writePBM(file);
+    fclose(file);
+    std::string pbm(buffer, size);
+    free(buffer);
+    return pbm;
+}
+
+// renders the screen benchmarkFrames times, each time on a display that was just drawn with the same screen
+static double benchmark(const screenCase_t &screen)
+{
+    MemoryDisplay display;
+    screen.draw(display);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < benchmarkFrames; i++)
+        screen.draw(display);
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / benchmarkFrames;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <golden directory> <output directory> [--update-golden]\n", argv[0]);
+        return 2;
+    }
+    std::string goldenDirectory = argv[1];
+    std::string outputDirectory = argv[2];
+    bool updateGolden = argc > 3 && strcmp(argv[3], "--update-golden") == 0;
+    if (!std::filesystem::is_directory(goldenDirectory))
+    {
+        fprintf(stderr, "the golden directory %s doesn't exist\n", goldenDirectory.c_str());
+        return 1;
+    }
+
+    printf("%-28s %10s %10s %10s\n", "screen", "us/frame", "data B", "command B");
+    for (const screenCase_t &screen : screens)
+    {
+        MemoryDisplay display;
+        // what the first display() after begin() sends is not part of the screen
+        display.display();
+        display.resetStatistics();
+        screen.draw(display);
+        std::string pbm = toPBM(display);
+
+        std::string name = screen.name;
+        CHECK(writeFile(outputDirectory + "/" + name + ".pbm", pbm));
+        std::string goldenPath = goldenDirectory + "/" + name + ".pbm";
+        if (updateGolden)
+        {
+            CHECK(writeFile(goldenPath, pbm));
+        }
+        else
+        {
+            bool found;
+            std::string golden = readFile(goldenPath, found);
+            if (!found)
+            {
+                fprintf(stderr, "%s: no golden image, check %s/%s.pbm and run with --update-golden\n", screen.name, outputDirectory.c_str(), screen.name);
+                hostTestFailures++;
+            }
+            else if (golden != pbm)
+            {
+                fprintf(stderr, "%s: differs from the golden image, see %s/%s.pbm\n", screen.name, outputDirectory.c_str(), screen.name);
+                hostTestFailures++;
+            }
+        }
+
+        printf("%-28s %10.2f %10zu %10zu\n", screen.name, benchmark(screen), display.getBytesSent(), display.getCommandBytesSent());
+    }
+
+    // redrawing only the widgets that changed has to give the same image as drawing the whole screen
+    MemoryDisplay incremental;
+    mainScreenCache_t incrementalCache;
+    MemoryDisplay full;
+    mainScreenCache_t fullCache;
+    drawMainScreen(incremental, mainScreen, incrementalCache);
+    for (const mainScreenState_t *state : { &mainScreenNextMinute, &mainScreenErrors, &mainScreen })
+    {
+        drawMainScreen(incremental, *state, incrementalCache);
+        fullCache = mainScreenCache_t();
+        drawMainScreen(full, *state, fullCache);
+        CHECK(toPBM(incremental) == toPBM(full));
+    }
+
+    // the main screen is mostly redrawn because the minute changed, then only the clock is drawn and sent
+    MemoryDisplay display;
+    mainScreenCache_t cache;
+    drawMainScreen(display, mainScreen, cache);
+    display.resetStatistics();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < benchmarkFrames; i++)
+        drawMainScreen(display, i % 2 ? mainScreen : mainScreenNextMinute, cache);
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-28s %10.2f %10zu %10zu\n", "main_screen (minute change)", elapsed.count() / benchmarkFrames,
+        display.getBytesSent() / benchmarkFrames, display.getCommandBytesSent() / benchmarkFrames);
+
+    printf("framebuffer: %d bytes, the PCD8544 driver has another one for the DMA transfer\n", FRAMEBUFFER_WIDTH * FRAMEBUFFER_BANKS);
+    return hostTestResult();
+}
@@ -1,7 +1,7 @@
 #include <Arduino.h>
 #include <Adafruit_GFX.h>
 
-const uint8_t DSEG7Classic_Bold6pt7bBitmaps[] = {
+constexpr uint8_t DSEG7Classic_Bold6pt7bBitmaps[] = {
   0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9, 0x99,
   0x99, 0x99, 0xF0, 0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9, 0x99, 0x99, 0x99,
   0xF0, 0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9,
@@ -66,7 +66,7 @@ const uint8_t DSEG7Classic_Bold6pt7bBitmaps[] = {
   0xC0, 0x7E, 0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9, 0x99, 0x99, 0x99, 0xF0,
   0xF9, 0x99, 0x99, 0x99, 0xF0, 0xF9, 0x99, 0x99, 0x99, 0xF0 };
 
-const GFXglyph DSEG7Classic_Bold6pt7bGlyphs[] = {
+constexpr GFXglyph DSEG7Classic_Bold6pt7bGlyphs[] = {
   {     0,   0,   0,   2,    0,    1 },   // 0x20 ' '
   {     0,   0,   0,  10,    0,    1 },   // 0x21 '!'
   {     0,   4,   9,   4,    0,   -8 },   // 0x22 '"'
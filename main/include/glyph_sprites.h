@@ -0,0 +1,94 @@
+#include <Arduino.h>
+#include <array>
+#include "DSEG7Classic-Bold6pt.h"
+
+// A glyph rasterized at compile time into columns of pixels (bit 0 is the top row), ready to be copied into the framebuffer
+struct glyphSprite_t
+{
+    int8_t   xOffset;   // from the cursor to the left edge of the sprite
+    int8_t   yOffset;   // from the cursor to the top edge of the sprite
+    uint8_t  width;
+    uint8_t  height;
+    uint8_t  xAdvance;  // how much the cursor moves after the glyph
+    uint16_t columns[10];
+};
+
+// rasterizes a glyph of a GFXfont exactly like Adafruit_GFX::drawChar does
+constexpr glyphSprite_t rasterizeFontGlyph(const uint8_t *bitmap, const GFXglyph &glyph)
+{
+    glyphSprite_t sprite = {};
+    sprite.xOffset = glyph.xOffset;
+    sprite.yOffset = glyph.yOffset;
+    sprite.width = glyph.width;
+    sprite.height = glyph.height;
+    sprite.xAdvance = glyph.xAdvance;
+    uint16_t bo = glyph.bitmapOffset;
+    uint8_t bits = 0, bit = 0;
+    for (uint8_t yy = 0; yy < glyph.height; yy++)
+    {
+        for (uint8_t xx = 0; xx < glyph.width; xx++)
+        {
+            if (!(bit++ & 7))
+                bits = bitmap[bo++];
+            if (bits & 0x80)
+                sprite.columns[xx] |= 1 << yy;
+            bits <<= 1;
+        }
+    }
+    return sprite;
+}
+
+// rasterizes a glyph of the built-in 5x7 font scaled by size (at most 2), like Adafruit_GFX::drawChar with setTextSize(size)
+constexpr glyphSprite_t rasterizeClassicGlyph(const uint8_t (&glyphColumns)[5], uint8_t size)
+{
+    glyphSprite_t sprite = {};
+    sprite.width = 5 * size;
+    sprite.height = 8 * size;
+    sprite.xAdvance = 6 * size;
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        uint16_t column = 0;
+        for (uint8_t j = 0; j < 8; j++)
+            if (glyphColumns[i] & (1 << j))
+                for (uint8_t k = 0; k < size; k++)
+                    column |= 1 << (j * size + k);
+        for (uint8_t k = 0; k < size; k++)
+            sprite.columns[i * size + k] = column;
+    }
+    return sprite;
+}
+
+// digits of the built-in 5x7 font (glcdfont.c in Adafruit_GFX), which can't be read at compile time
+constexpr uint8_t classicFontDigits[10][5] = {
+    {0x3E, 0x51, 0x49, 0x45, 0x3E},
+    {0x00, 0x42, 0x7F, 0x40, 0x00},
+    {0x72, 0x49, 0x49, 0x49, 0x46},
+    {0x21, 0x41, 0x49, 0x4D, 0x33},
+    {0x18, 0x14, 0x12, 0x7F, 0x10},
+    {0x27, 0x45, 0x45, 0x45, 0x39},
+    {0x3C, 0x4A, 0x49, 0x49, 0x31},
+    {0x41, 0x21, 0x11, 0x09, 0x07},
+    {0x36, 0x49, 0x49, 0x49, 0x36},
+    {0x46, 0x49, 0x49, 0x29, 0x1E},
+};
+
+// '0' to '9' and ':' in DSEG7 Classic Bold, used by the clock
+constexpr std::array<glyphSprite_t, 11> rasterizeClockGlyphs()
+{
+    std::array<glyphSprite_t, 11> sprites = {};
+    for (uint8_t i = 0; i < sprites.size(); i++)
+        sprites[i] = rasterizeFontGlyph(DSEG7Classic_Bold6pt7bBitmaps, DSEG7Classic_Bold6pt7bGlyphs['0' + i - 0x20]);
+    return sprites;
+}
+
+// '0' to '9' in the built-in font with text size 2, used by the temperature
+constexpr std::array<glyphSprite_t, 10> rasterizeTempGlyphs()
+{
+    std::array<glyphSprite_t, 10> sprites = {};
+    for (uint8_t i = 0; i < sprites.size(); i++)
+        sprites[i] = rasterizeClassicGlyph(classicFontDigits[i], 2);
+    return sprites;
+}
+
+constexpr std::array<glyphSprite_t, 11> clockGlyphSprites = rasterizeClockGlyphs();
+constexpr std::array<glyphSprite_t, 10> tempGlyphSprites  = rasterizeTempGlyphs();
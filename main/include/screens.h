@@ -0,0 +1,78 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCREENS_H
+#define SCREENS_H
+
+#include <ctime>
+#include "Framebuffer.h"
+
+/* the screens of the thermostat, drawn into any Framebuffer and sent with display()
+ * they only get the values they show, so they can be rendered without the hardware, see host_test
+ */
+
+enum DisplayError : uint8_t
+{
+    DisplayErrorWifi     = 1 << 0,
+    DisplayErrorNTP      = 1 << 1,
+    DisplayErrorFirebase = 1 << 2,
+    DisplayErrorSensor   = 1 << 3
+};
+
+// the values shown on the main screen
+struct mainScreenState_t
+{
+    tm    time;
+    float temp;
+    int   hum;
+    bool  heater;
+    uint8_t errors;
+};
+
+// what the main screen looked like the last time it was drawn on a display
+struct mainScreenCache_t
+{
+    mainScreenState_t state;
+    uint32_t generation = 0;
+    bool drawn = false;
+};
+
+// redraws only the widgets whose values changed since the last call with the same cache
+// if another screen was drawn in the meantime, the whole main screen is drawn again
+void drawMainScreen(Framebuffer &display, const mainScreenState_t &state, mainScreenCache_t &cache);
+
+// clears the display and prints the string in the top left corner
+void simpleDisplay(Framebuffer &display, const char *str);
+
+void startupMenuHelper(Framebuffer &display, int highlightedOption);
+
+/* displays the selected values of the temporary schedule menu
+ * duration is in minutes, -1 means the end of the active temporary schedule, which is minutesLeft away (-1 if it doesn't end)
+ * 24 * 60 + 30 means infinite duration
+ */
+void temporaryScheduleHelper(Framebuffer &display, float temp, int duration, int minutesLeft, int option, int sel);
+
+// displays the current selected date and time in manual time mode
+void manualTimeHelper(Framebuffer &display, int h, int m, int d, int mth, int y, int sel);
+
+// displays how to connect to the access point of the Setup mode
+void setupDisplayInfo(Framebuffer &display, const char *ssid, const char *password);
+
+#endif
@@ -1,5 +1,5 @@
 #include <Arduino.h>
-#include <DHTesp.h>
+#include "SensorDriver.h"
 
 // Pins
 // Display
@@ -21,8 +21,25 @@ const uint8_t pinDown  = 26;
 const uint8_t pinEnter = 27;
 
 
-// Sensor type
-const DHTesp::DHT_MODEL_t dhtType = DHTesp::DHT22;
+// Sensor type, a DHT is read with an RMT channel, the one with the index of its zone
+const SensorType sensorType = SensorType::DHT22;
+
+
+// Zones, each with its own sensor and relay, controlled to the schedules tagged with its name ("zone" in /Schedules.json)
+// the first zone is the one shown on the display and set from the menu, it also follows the schedules that aren't tagged
+struct zoneConfig_t
+{
+    const char *name;
+    uint8_t pinSensor;
+    SensorType sensorType;
+    uint8_t pinRelay;
+};
+const zoneConfig_t zoneConfigs[] = {
+    { "main", pinDHT, sensorType, pinHeater },
+};
+const size_t zoneCount = sizeof(zoneConfigs) / sizeof(zoneConfigs[0]);
+const size_t maxSchedules        = 64;   // The most schedules that are followed, of all the zones together; the ones after it are ignored
+const size_t maxScheduleJsonSize = 224;  // (bytes) The longest a schedule can be in /Schedules.json, with its key; the Firebase client has room for maxSchedules of them
 
 
 // NTP settings
@@ -36,14 +53,30 @@ const char setupAPSSID[]     = "Thermostat";
 const char setupAPPassword[] = "Thermostat123";
 
 
-// mDNS hostname used for Setup and OTA Update
+// mDNS hostname used for Setup, OTA Update and the local API
 const char mDNSHostname[] = "thermostat";
 
 
+// Local API settings
+const uint16_t localApiPort           = 80;  // The port of the HTTP server that lets clients on the same network control the thermostat in Normal Operation
+const size_t   localApiTokenMinLength = 16;  // The shortest local API token accepted in Setup
+const size_t   localApiRequestSockets = 6;   // (sockets) How many requests the local API serves at once, besides the event stream clients; with the 3 sockets of the server and the Firebase and update connections, they must fit in CONFIG_LWIP_MAX_SOCKETS
+const uint32_t streamTicketLifetime   = 30;  // (s) How long a ticket for the event stream can be used
+
+
 // Display settings
 const uint8_t displayContrast = 60;
 
 
+// Task settings
+const bool useCooperativeExecutor = true;  // If true, schedule evaluation and the sensor run as jobs on one task instead of a task each, which saves 2 KB of task stacks; a schedule evaluation waits for at most one sensor reading. Firebase and the updates always have a task each
+const bool useFastBoot            = true;  // If true, Normal Operation starts controlling the heater right away with the schedules saved at the last download, and connects to Wifi, NTP and Firebase in the background; the Startup Menu is shown only if a button is held at power-on
+
+
+// Wifi settings
+const uint8_t wifiFastPathAttempts = 2;  // How many times in a row we try to connect to the access point we were last connected to, on its channel, before scanning all channels
+
+
 // Firebase settings
 const int timesTryFirebase = 2;  // How many times we try to download the schedules from Firebase, before showing error
 
@@ -54,9 +87,17 @@ const unsigned long waitingTimeConnectWifi             = 10000;          // (ms)
 const unsigned long waitingTimeInTemporaryScheduleMenu = 5000;           // (ms) The time after which we go back to Normal Operation from Temporary Schedule if no button is pressed
 const unsigned long waitingTimeNTP                     = 10000;          // (ms) The time we wait for the first NTP sync, after which we enter Manual Time if the sync was not successful
 const unsigned long intervalRetryErrors                = 300000;         // (ms) The time interval at which we attempt to resolve errors (reconnect to Wifi, to Firebase etc.)
-const unsigned long intervalUpdateTemperature          = 10000;          // (ms) The time interval at which we read the temperature and humidity from the sensor
+const unsigned long intervalUpdateTemperature          = 10000;          // (ms) The usual time interval at which we read the temperature and humidity from the sensors, see the sensor sampling settings
 const unsigned long intervalUploadState                = 60000;          // (ms) The time interval at which we upload the current temperature, humidity and heater state to Firebase
 const unsigned long intervalCheckUpdate                = 24*60*60*1000;  // (ms) The time interval at which we check for firmware updates
+const unsigned long intervalRetryCheckUpdate           = 60*60*1000;     // (ms) The time after which a check for firmware updates that failed is made again
+const unsigned long minIntervalUpdateDisplay           = 200;            // (ms) The minimum time between two redraws of the main screen, changes that come faster are drawn together
+
+
+// Clock settings
+const uint32_t intervalClockCheckpoint = 600000;  // (ms) The time interval at which the time is saved to flash, so it can be restored after a reset that also cleared the RTC memory, like a brownout
+const uint32_t clockDriftPpm           = 100;     // The maximum drift of the clock while running, used to track how far the time may be from the real time
+const uint32_t clockResetMargin        = 60000;   // (ms) The maximum time a reset is assumed to take, when the time is restored after it
 
 
 // Temperature settings
@@ -64,9 +105,38 @@ const float temporaryScheduleTempResolution = 0.5f;  // The minimum increment in
 const float tempThreshold                   = 0.5f;  // The temperature difference needed between the set temperature and the current room temperature to trigger the heater
 
 
+// Sensor filter settings, the readings go through a median of 5, then an average, and the result is only used when it moved enough
+const uint8_t sensorSmoothingShift        = 2;    // The average moves by 1/2^sensorSmoothingShift of the way to each new median, higher is smoother but slower
+const uint8_t sensorTrendShift            = 2;    // The trend of the temperature moves by 1/2^sensorTrendShift of the way to each new slope
+const int32_t temperaturePublishThreshold = 10;   // (0.01 °C) How far the average temperature has to move from the one in use before it replaces it
+const int32_t humidityPublishThreshold    = 100;  // (0.01 %) The same for the humidity
+
+
+// Sensor sampling settings, the sensors are read faster while a temperature is close to its setpoint or changing, and slower while they are all stable and far from them
+const unsigned long intervalUpdateTemperatureMin = 5000;   // (ms) The shortest interval between readings, it is raised to the minimum interval of the sensor if that is longer
+const unsigned long intervalUpdateTemperatureMax = 60000;  // (ms) The longest interval between readings, reached by doubling intervalUpdateTemperature
+const float sensorFastBand  = 1.0f;  // (°C) The shortest interval is used when a temperature is this close to its setpoint, it should be more than tempThreshold
+const float sensorFastTrend   = 0.1f;   // (°C/min) The shortest interval is also used when a temperature changes this fast
+const float sensorSteadyTrend = 0.05f;  // (°C/min) A temperature that changed fast counts as stable again only when it changes slower than this, so the noise of the trend around sensorFastTrend doesn't keep the interval short
+const float sensorSlowBand    = 3.0f;   // (°C) The interval only grows when every temperature is farther than this from its setpoint, or has no setpoint
+const unsigned long sensorUnreachableTimeout = 30000;  // (ms) How long the readings of a sensor have to fail before its values are dropped and the error is shown; failed readings are retried at the shortest interval
+
+
+// Control latency SLOs, the maximum time from a cause until the signal is sent to the heater; slower ones are counted as violations
+const unsigned long sloSensorSample       = 500;    // (ms) From reading the sensor
+const unsigned long sloScheduleChange     = 5000;   // (ms) From receiving a change of the schedules on the Firebase stream, includes downloading them
+const unsigned long sloTemporarySchedule  = 500;    // (ms) From saving or deleting a temporary schedule in the menu
+const unsigned long sloScheduleBoundary   = 15000;  // (ms) From the minute when a schedule starts or ends, the sensor task wakes up at each minute to have the schedules evaluated
+
+
 // Button settings
-const unsigned long buttonDebounceTime = 200;  // (ms) The minimum time between two button presses, used to prevent registering the same button press multiple times due to bouncing
+const unsigned long buttonDebounceTime        = 30;   // (ms) Edges of a button that come sooner than this after its previous edge are not accepted right away, the pin is sampled again when this time is over
+const unsigned long buttonLongPressTime       = 600;  // (ms) How long a button has to be held to count as a long press, after which Up and Down start repeating
+const unsigned long buttonRepeatStartInterval = 250;  // (ms) The time between the first repeats of a held button
+const unsigned long buttonRepeatMinInterval   = 40;   // (ms) Each repeat comes faster than the previous one, until this interval is reached
 
 
 // Update settings
-const char latestReleaseURL[] = "https://clickau.github.io/ThermostatESP32/releases/latest.json";
\ No newline at end of file
+const char latestReleaseURL[] = "https://clickau.github.io/ThermostatESP32/releases/latest.json";
+const uint32_t otaMaxRate     = 32768;   // (bytes/s) The maximum rate at which the firmware image is downloaded, so the update leaves bandwidth for Firebase
+const uint32_t otaMaxDuration = 900000;  // (ms) The time after which an update is abandoned, including the retries after interruptions
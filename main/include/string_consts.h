@@ -40,7 +40,7 @@ const char displayHumidityNotAvailableString[] = "N/A";
 const char displayHumidityFormatString[]       = "%.2d%%";                                           // Humidity%
 const char displayDateLine1FormatString[]      = "%s. %d\n";                                         // Short weekday. Day
 const char displayDateLine2FormatString[]      = "%.2d.%d";                                          // Month.Year
-const char *displayShortWeekdayStrings[]       = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+const char *const displayShortWeekdayStrings[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 const char displayTempLetter                   = 'C';                                                // Celsius
 const char displayClockFormatString[]          = "%.2d:%.2d";                                        // Hour:Minute
 const char displayErrorWifiString[]            = "!W";
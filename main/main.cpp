@@ -18,25 +18,42 @@
 */
 
 #include <Arduino.h>
-#include <Adafruit_PCD8544.h>
+#include <PCD8544Display.h>
 #include <lwip/apps/sntp.h>
-#include <DHTesp.h>
 #include <ArduinoJson.h>
 #include <tcpip_adapter.h>
 #include <esp_event.h>
 #include <esp_wifi.h>
 #include <cstring>
+#include <strings.h>
+#include <cstdarg>
 #include <nvs_flash.h>
 #include <esp_http_server.h>
 #include <mdns.h>
-#include <esp_https_ota.h>
+#include <esp_http_client.h>
+#include <atomic>
+#include <algorithm>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <lwip/ip4_addr.h>
 
 #include "string_consts.h"
 #include "settings.h"
 #include "FirebaseClient.h"
+#include "Executor.h"
+#include "HealthMonitor.h"
+#include "LatencyHistogram.h"
+#include "EventStream.h"
+#include "PrometheusWriter.h"
+#include "WallClock.h"
+#include "OtaUpdater.h"
+#include "TlsMemory.h"
+#include "SensorDriver.h"
+#include "SensorFilter.h"
 #include "Logger.h"
-#include "DSEG7Classic-Bold6pt.h"
-#include "flame.h"
+#include "Trace.h"
+#include "screens.h"
 #include "version.h"
 
 enum class Button
@@ -47,6 +64,88 @@ enum class Button
     Down
 };
 
+enum class ButtonEventType
+{
+    Press,
+    LongPress,  // sent once, after the button is held for buttonLongPressTime
+    Repeat      // sent while Up or Down is held after a long press, faster and faster
+};
+
+struct buttonEvent_t
+{
+    Button          button;
+    ButtonEventType type;
+    int64_t         time;  // (us) from esp_timer_get_time
+};
+
+// a debounced change of a button's state, recorded by the ISR
+struct buttonEdge_t
+{
+    Button  button;
+    bool    pressed;
+    int64_t time;
+};
+
+// per button data used by the ISR and the debounce timer
+struct buttonInput_t
+{
+    uint8_t pin;
+    Button  button;
+    // the last accepted edge: bit 0 is the state, the other bits the low 32 bits of its time (us)
+    // changed with compare and swap, so the ISR and the debounce timer accept each edge once without a lock
+    std::atomic<uint32_t> acceptedEdge;
+    esp_timer_handle_t debounceTimer;  // samples the pin again when an edge came too early
+};
+
+// a slot of the button queue, sequence tells whether it is free or holds an edge, as in Vyukov's bounded queue
+struct buttonQueueSlot_t
+{
+    std::atomic<uint32_t> sequence;
+    buttonEdge_t          edge;
+};
+
+// per button data used by the task that reads the button events
+struct buttonState_t
+{
+    bool     held;
+    bool     longPressSent;
+    int64_t  lastEdgeTime;    // (us) of the newest edge read from the queue
+    int64_t  nextEventTime;   // (us) when the next long press or repeat event is due
+    uint32_t repeatInterval;  // (ms)
+};
+
+// Task notification bits
+// a task subscribed to button events gets notificationButtonEvent when there are new edges in the button queue
+// the UI task also gets notificationDisplayUpdate when something shown on the main screen changed,
+// notificationManualTime when the time couldn't be set after a fast boot
+// and notificationDisplayTransfer from the display driver when a bank of pixels was sent
+const uint32_t notificationButtonEvent     = 1 << 0;
+const uint32_t notificationDisplayUpdate   = 1 << 8;
+const uint32_t notificationManualTime      = 1 << 9;
+const uint32_t notificationDisplayTransfer = 1 << 10;
+
+// Causes that make the schedules be evaluated, the time from each one until the signal is sent to the heater is measured
+enum ControlCause
+{
+    CauseSensorSample = 0,
+    CauseScheduleChange,
+    CauseTemporarySchedule,
+    CauseScheduleBoundary,
+    CauseCount
+};
+
+const char *const controlCauseNames[CauseCount] = { "sensorSample", "scheduleChange", "temporarySchedule", "scheduleBoundary" };
+
+// the access point the thermostat was last connected to, a channel of 0 means there is none
+struct wifiProfile_t
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
+/* new fields are added at the end, so the settings saved by an older firmware can still be loaded
+ * the ones they don't have are left zero
+ */
 struct settings_t 
 {
     uint8_t ssid[32];
@@ -54,36 +153,190 @@ struct settings_t
     char firebaseURL[64];
     char firebaseSecret[41];
     char timezone[64];
+    wifiProfile_t wifiProfile;
+    // static IP configuration in network byte order, DHCP is used if staticIP is 0, the gateway is used as DNS if staticDNS is 0
+    uint32_t staticIP;
+    uint32_t staticGateway;
+    uint32_t staticNetmask;
+    uint32_t staticDNS;
+    // the token of the local API, which is plain HTTP, so it isn't the Firebase secret; the local API is off while it's empty
+    char localApiToken[41];
 } settings;
 
+/* a zone of zoneConfigs, with its own sensor, relay, setpoint and temporary schedule
+ * the fields are protected by the mutex of the same values for all the zones
+ */
+struct zone_t
+{
+    const zoneConfig_t *config = nullptr;
+    SensorDriver *sensor = nullptr;
+    // the readings of the sensor, filtered, only used by the task that reads the sensors
+    SensorFilter temperatureFilter{sensorSmoothingShift, sensorTrendShift, temperaturePublishThreshold};
+    SensorFilter humidityFilter{sensorSmoothingShift, sensorTrendShift, humidityPublishThreshold};
+    TickType_t lastReading = 0;
+    TickType_t failingSince = 0;  // the start of the first reading that failed after a good one
+    bool       changing = false;  // the temperature trend is fast, with the hysteresis of sensorFastTrend and sensorSteadyTrend
+    // protected by sensorValuesMutex, the published values of the filters
+    float   temperature      = NAN;
+    float   temperatureTrend = NAN;  // (°C/min)
+    int     humidity         = -1;
+    uint8_t reachability     = 0;     // the results of the last 8 readings, the last one in the lowest bit
+    bool    sensorError      = true;  // no reading succeeded yet, or they failed for sensorUnreachableTimeout
+    // protected by heaterStateMutex
+    bool  heaterState = false;
+    // the temperature the heater is controlled to and where it comes from, NAN if no schedule is active
+    float activeSetpoint = NAN;
+    const char *activeSetpointSource = "none";
+    // (us) the time the heater was on, not counting the time since it was last turned on, at heaterOnSince
+    int64_t heaterOnTime  = 0;
+    int64_t heaterOnSince = 0;
+    // protected by temporaryScheduleMutex
+    bool    temporaryScheduleActive = false;
+    float   temporaryScheduleTemp   = NAN;
+    int64_t temporaryScheduleEnd    = 0;
+    // the schedule in effect at the last evaluation, only used by the task that evaluates the schedules
+    // its position in scheduleString, -1 if there is none and -2 for the temporary schedule
+    int activeSchedule = -1;
+};
+
+enum class ScheduleRepeat : uint8_t
+{
+    Once,
+    Weekly,
+    Daily
+};
+
+/* a schedule from scheduleString, parsed once per download, so evaluating the schedules of all the zones is one pass over a table
+ * start and end are UNIX times for Once schedules and minutes since midnight for the others
+ */
+struct compiledSchedule_t
+{
+    uint8_t        zone;
+    ScheduleRepeat repeat;
+    uint8_t        weekDays;  // bit 0 is Sunday
+    time_t         start;
+    time_t         end;
+    float          setTemp;
+    int            position;  // in scheduleString, identifies the schedule
+};
+
 extern const char certificateBundle[] asm("_binary_root_certs_pem_start");
 
+OtaUpdater otaUpdater(certificateBundle, otaMaxRate, otaMaxDuration);
+
+// when the update being downloaded is a patch, what is downloaded instead if the patch can't be applied
+struct updateFallback_t
+{
+    std::string deltaURL;     // empty if the update isn't a patch
+    std::string url;
+    std::string sha256;       // empty if the release doesn't have it
+    OtaUpdater::Format format;
+};
+updateFallback_t updateFallback;
+// a patch that failed isn't used again by the next checks, they download the compressed or the full image
+std::string failedDeltaURL;
+
+/* the result of the last successful update check, saved in NVS
+ * the validators of latestReleaseURL are sent with the next check, so the server can answer 304 Not Modified,
+ * they are only kept when the release didn't lead to an update, so a failed update downloads the release again
+ */
+struct updateCheck_t
+{
+    int64_t lastCheck;       // (s) UNIX time, 0 if there was none
+    char etag[64];
+    char lastModified[32];
+};
+updateCheck_t updateCheck = {};
+// filled by update_http_event_handler
+struct updateCheckResponse_t
+{
+    std::string body;
+    char etag[sizeof(updateCheck_t::etag)];
+    char lastModified[sizeof(updateCheck_t::lastModified)];
+};
+// (ticks) when the last check that didn't get an answer was made, and if there was one since the last successful check
+TickType_t lastFailedUpdateCheck = 0;
+bool updateCheckFailed = false;
+
 volatile bool wifiWorking = false;
 SemaphoreHandle_t wifiWorkingMutex;
-
-bool heaterState = false;
+// the state of the connection attempts, only used by the Wifi event handler
+wifiProfile_t currentWifiProfile = {};
+bool wifiFastPath = false;
+uint8_t wifiFastPathFailures = 0;
+int64_t wifiConnectStart = 0;  // (us) the first attempt since the connection was lost, 0 while connected
+int64_t wifiAssociated = 0;    // (us)
+// the profile of the last connection, saved by the Firebase loop when it changes; protected by wifiWorkingMutex
+wifiProfile_t connectedWifiProfile = {};
+std::atomic<bool> wifiProfileChanged(false);
+std::atomic<uint32_t> wifiFastPathFallbacks(0);
+// from the first connection attempt until the access point accepted us, and from then until we had an IP address
+LatencyHistogram wifiAssociationLatencies;
+LatencyHistogram wifiAddressLatencies;
+
+// the clock is considered set when it is past this time (2020-01-01), the earliest date that can be entered in Manual Time
+const time_t minimumValidTime = 1577836800;
+// (ms) the time from boot until the heater was first controlled with both the temperature and the time known, -1 until then
+std::atomic<int32_t> firstControlDecisionTime(-1);
+// (ms) the time between the starts of two readings of the sensors, chosen after each reading by adaptSensorSampleInterval()
+std::atomic<uint32_t> sensorSampleInterval(intervalUpdateTemperature);
+WallClock wallClock(intervalClockCheckpoint, clockDriftPpm, clockResetMargin);
+
+// zones[0] is shown on the display and set from the menu
+zone_t zones[zoneCount];
 SemaphoreHandle_t heaterStateMutex;
 
+// (us) when the oldest cause of each type that wasn't handled by an evaluation of the schedules happened, 0 if there is none
+int64_t pendingControlCauses[CauseCount] = {};
+SemaphoreHandle_t pendingControlCausesMutex;
+// the causes handled by the current evaluation, only used by the task that evaluates the schedules
+int64_t claimedControlCauses[CauseCount] = {};
+LatencyHistogram controlLatencies[CauseCount] = {
+    LatencyHistogram(sloSensorSample),
+    LatencyHistogram(sloScheduleChange),
+    LatencyHistogram(sloTemporarySchedule),
+    LatencyHistogram(sloScheduleBoundary)
+};
+
 String scheduleString;
+// compiled from scheduleString by the first evaluation after it changed; also protected by scheduleStringMutex
+compiledSchedule_t compiledSchedules[maxSchedules];
+size_t compiledScheduleCount = 0;
+bool schedulesCompiled = false;
 SemaphoreHandle_t scheduleStringMutex;
 
-float   temperature     = NAN;
-int     humidity        = -1;
-uint8_t dhtReachability = 0;
 SemaphoreHandle_t sensorValuesMutex;
 
-volatile unsigned long lastButtonPress       = 0;
-portMUX_TYPE           lastButtonPressMux    = portMUX_INITIALIZER_UNLOCKED;
+// not const, so they are placed in DRAM and can be read by the ISR while the flash cache is disabled
+buttonInput_t buttonInputs[] = {
+    { pinEnter, Button::Enter, 0, nullptr },
+    { pinUp,    Button::Up,    0, nullptr },
+    { pinDown,  Button::Down,  0, nullptr },
+};
+buttonState_t buttonStates[3];
+
+// lock-free queue with many producers (the button ISR and the debounce timers) and one consumer (the subscribed task)
+// a producer reserves a slot by advancing buttonQueueHead with compare and swap, then publishes it with its sequence
+// the edges of one button can be published out of order, the consumer drops the ones older than the last it read
+const uint32_t buttonQueueSize = 16;  // must be a power of 2
+buttonQueueSlot_t buttonQueue[buttonQueueSize];
+std::atomic<uint32_t> buttonQueueHead{0};
+uint32_t buttonQueueTail = 0;  // only used by the consumer
 
-bool    temporaryScheduleActive = false;
-float   temporaryScheduleTemp   = NAN;
-int64_t temporaryScheduleEnd    = 0;
 SemaphoreHandle_t temporaryScheduleMutex;
 
 
-Adafruit_PCD8544 display{pinDC, pinCS, pinRST};
-FirebaseClient firebaseClient;
-DHTesp dht;
+PCD8544Display display{pinDC, pinCS, pinRST};
+/* the longest schedule in /Schedules.json: the fields of the one time and of the weekly schedules together, with their longest values,
+ * and a zone name of 31 characters
+ */
+constexpr char longestScheduleJson[] =
+    R"==("-M0123456789abcdefgh":{"eD":31,"eH":23,"eM":59,"eMth":11,"eY":2099,"repeat":"Weekly","sD":31,"sH":23,"sM":59,"sMth":11,"sY":2099,)=="
+    R"==("setTemp":-12.5,"weekDays":[1,2,3,4,5,6,7],"zone":"0123456789012345678901234567890"},)==";
+static_assert(sizeof(longestScheduleJson) - 1 <= maxScheduleJsonSize, "maxScheduleJsonSize is smaller than the longest schedule");
+// the request arena holds the URL and the response of /Schedules.json, with maxSchedules schedules and the braces around them
+FirebaseClient firebaseClient{FirebaseClient::maxUrlSize + maxSchedules * maxScheduleJsonSize + 8};
+HealthMonitor healthMonitor;
 
 TaskHandle_t setupTaskHandle;
 TaskHandle_t firebaseTaskHandle;
@@ -92,6 +345,27 @@ TaskHandle_t buttonSubscribedTaskHandle;
 TaskHandle_t sensorTaskHandle;
 TaskHandle_t evaluateSchedulesTaskHandle;
 TaskHandle_t updateTaskHandle;
+TaskHandle_t controlExecutorTaskHandle;
+
+httpd_handle_t localApiServer = nullptr;
+EventStream eventStream;
+
+// a ticket opens one event stream with ticket=<value> in the URL, because browsers can't add headers to event streams
+// so the local API token is never in a URL; only used by the task of the local API server
+struct streamTicket_t
+{
+    char value[33];
+    int64_t expiry;  // (us) the ticket can't be used after this time, 0 if it was used
+};
+streamTicket_t streamTickets[EventStream::maxClients];
+
+// the server uses 3 sockets of its own, and Firebase and the updates have a connection each
+static_assert(EventStream::maxClients + localApiRequestSockets + 3 + 2 <= CONFIG_LWIP_MAX_SOCKETS, "The local API needs more sockets than CONFIG_LWIP_MAX_SOCKETS");
+
+// used instead of the schedule evaluation and sensor tasks when useCooperativeExecutor is true
+// Firebase and the updates keep a task each, a job that blocks on the network would delay the other one
+Executor controlExecutor;  // evaluating schedules and reading the sensor
+int evaluateSchedulesJobId = -1;
 
 // Tasks
 void normalOperationTask(void *);
@@ -101,52 +375,106 @@ void uiLoopTask(void *);
 void sensorLoopTask(void *);
 void evaluateSchedulesLoopTask(void *);
 void updateLoopTask(void *);
+void executorTask(void *executor);
+
+// Loop steps, shared by the loop tasks and the executor jobs
+TickType_t firebaseStep(bool uploadTemporarySchedule);
+TickType_t updateSensorValues();
+uint32_t adaptSensorSampleInterval(uint32_t interval);
+bool scheduleBoundaryPassed();
+TickType_t ticksUntilScheduleBoundary();
+void evaluateSchedules();
+void checkForUpdate();
+TickType_t updateCheckDelay();
+TickType_t otaStep();
+
+// Executor jobs
+TickType_t sensorJob(bool notified);
+TickType_t evaluateSchedulesJob(bool notified);
 
 // General purpose
-void sendSignalToHeater(bool signal);
-void simpleDisplay(const char *str);
+void sendSignalToHeater(zone_t &zone, bool signal);
+void setActiveSetpoint(zone_t &zone, float setpoint, const char *source);
+int zonesToJson(char *buffer, size_t size);
+int findZone(const char *name);
 bool connectSTAMode();
+void configureSTAMode(bool fastPath);
 void subscribeToButtonEvents(TaskHandle_t taskHandle);
 void unsubscribeFromButtonEvents();
+void requestScheduleEvaluation(ControlCause cause, int64_t causeTime);
+void claimControlCauses();
+void claimScheduleBoundary(bool activeScheduleChanged);
+void recordControlLatencies(int64_t signalTime);
+int controlLatenciesToJson(char *buffer, size_t size);
+void requestTemporaryScheduleUpload();
+Button waitForButton(TickType_t timeout);
+bool waitForButtonEvent(buttonEvent_t &event, TickType_t timeout);
+TickType_t ticksUntilNextButtonEvent();
+bool popButtonEdge(buttonEdge_t &edge);
+void requestDisplayUpdate();
 bool loadSettings();
+bool saveSettings(const settings_t &newSettings);
+void loadSchedules();
+void saveSchedules();
+void loadUpdateCheck();
+void saveUpdateCheck();
+bool waitForNTP();
+bool timeIsSet();
+void notifyScheduleEvaluation();
+void startNormalOperation();
 
 // Startup Menu
 void showStartupMenu();
-void startupMenuHelper(int highlightedOption);
 
 // Manual Time
 void manualTimeSetup();
-void manualTimeHelper(int h, int m, int d, int mth, int y, int sel);
 
 // Setup helpers
-void setupDisplayInfo();
 esp_err_t setupGetInfoHandler(httpd_req_t *req);
 esp_err_t setupGetSettingsHandler(httpd_req_t *req);
 esp_err_t setupPostSettingsHandler(httpd_req_t *req);
 esp_err_t setupRestartHandler(httpd_req_t *req);
 
+// Local API
+void startLocalApi();
+bool localApiAuthorize(httpd_req_t *req);
+esp_err_t localApiGetStatusHandler(httpd_req_t *req);
+esp_err_t localApiGetSetpointHandler(httpd_req_t *req);
+esp_err_t localApiGetSchedulesHandler(httpd_req_t *req);
+esp_err_t localApiGetTemporaryScheduleHandler(httpd_req_t *req);
+esp_err_t localApiPutTemporaryScheduleHandler(httpd_req_t *req);
+esp_err_t localApiDeleteTemporaryScheduleHandler(httpd_req_t *req);
+esp_err_t localApiGetEventsHandler(httpd_req_t *req);
+esp_err_t localApiPostEventsTicketHandler(httpd_req_t *req);
+bool localApiAuthorizeStreamTicket(httpd_req_t *req);
+esp_err_t localApiGetMetricsHandler(httpd_req_t *req);
+zone_t *localApiGetZone(httpd_req_t *req);
+void writeLatencyHistogram(PrometheusWriter &writer, const char *name, const char *labels, LatencyHistogram &histogram);
+void publishEvent(const char *event, const char *format, ...);
+
 // Display helpers
 void updateDisplay();
-void displayDate(int day, int mth, int year, int wDay, int cursorX, int cursorY);
-void displayClock(int hour, int min, int cursorX, int cursorY);
-void displayTemp(float temp, int cursorX, int cursorY);
-void displayHumidity(int hum, int cursorX, int cursorY);
-void displayFlame(const uint8_t *flameBitmap, int cursorX, int cursorY, int width, int height);
-void displayErrors(int cursorX, int cursorY);
+TickType_t ticksUntilNextMinute();
+uint8_t getDisplayErrors();
 
 // Temporary Schedule
 void temporaryScheduleSetup();
-void temporaryScheduleHelper(float temp, int duration, int option, int sel);
+int temporaryScheduleMinutesLeft();
 
 // Schedule evaluation helpers
-bool cmpTempSetTemp(float temp, float setTemp);
-bool scheduleIsActive(JsonObjectConst schedule);
+bool cmpTempSetTemp(zone_t &zone, float temp, float setTemp);
+void compileSchedules();
+bool compileSchedule(JsonObjectConst schedule, compiledSchedule_t &compiled);
+bool scheduleIsActive(const compiledSchedule_t &schedule, time_t now, const tm &tmnow);
 
 // ISRs
 void buttonISR(void *button);
+void buttonDebounceTimerCallback(void *button);
+bool pushButtonEdge(const buttonEdge_t &edge);
+bool acceptButtonEdge(buttonInput_t *input, bool pressed, int64_t &remaining);
 
 // Event handlers
-void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *);
+void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *data);
 esp_err_t update_http_event_handler(esp_http_client_event_t *event);
 
 
@@ -155,26 +483,42 @@ const httpd_uri_t setupGetSettingsURI  = { "/settings", HTTP_GET, setupGetSettin
 const httpd_uri_t setupPostSettingsURI = { "/settings", HTTP_POST, setupPostSettingsHandler, nullptr };
 const httpd_uri_t setupRestartURI      = { "/restart", HTTP_GET, setupRestartHandler, nullptr };
 
+const httpd_uri_t localApiGetStatusURI               = { "/api/status", HTTP_GET, localApiGetStatusHandler, nullptr };
+const httpd_uri_t localApiGetSetpointURI             = { "/api/setpoint", HTTP_GET, localApiGetSetpointHandler, nullptr };
+const httpd_uri_t localApiGetSchedulesURI            = { "/api/schedules", HTTP_GET, localApiGetSchedulesHandler, nullptr };
+const httpd_uri_t localApiGetTemporaryScheduleURI    = { "/api/temporarySchedule", HTTP_GET, localApiGetTemporaryScheduleHandler, nullptr };
+const httpd_uri_t localApiPutTemporaryScheduleURI    = { "/api/temporarySchedule", HTTP_PUT, localApiPutTemporaryScheduleHandler, nullptr };
+const httpd_uri_t localApiDeleteTemporaryScheduleURI = { "/api/temporarySchedule", HTTP_DELETE, localApiDeleteTemporaryScheduleHandler, nullptr };
+const httpd_uri_t localApiGetEventsURI               = { "/api/events", HTTP_GET, localApiGetEventsHandler, nullptr };
+const httpd_uri_t localApiPostEventsTicketURI        = { "/api/events/ticket", HTTP_POST, localApiPostEventsTicketHandler, nullptr };
+const httpd_uri_t localApiGetMetricsURI              = { "/metrics", HTTP_GET, localApiGetMetricsHandler, nullptr };
+
 
 extern "C" void app_main()
 {
+    // before anything can allocate from mbedTLS, the allocations made before it couldn't be freed by the accounting
+    tlsMemoryInstall();
     initArduino();
     LOG_INIT();
     temporaryScheduleMutex = xSemaphoreCreateMutex();
     sensorValuesMutex = xSemaphoreCreateMutex();
     scheduleStringMutex = xSemaphoreCreateMutex();
     heaterStateMutex = xSemaphoreCreateMutex();
+    pendingControlCausesMutex = xSemaphoreCreateMutex();
     wifiWorkingMutex = xSemaphoreCreateMutex();
     LOG_D("Firmware version: %s", VERSION_STRING);
-    // stopping the heater right at startup
-    pinMode(pinHeater, OUTPUT);
+    // stopping the heaters right at startup
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        zones[i].config = &zoneConfigs[i];
+        pinMode(zoneConfigs[i].pinRelay, OUTPUT);
+        sendSignalToHeater(zones[i], false);
+    }
     pinMode(pinUp, INPUT_PULLDOWN);
     pinMode(pinDown, INPUT_PULLDOWN);
     pinMode(pinEnter, INPUT_PULLDOWN);
-    sendSignalToHeater(false);
     display.clearDisplay();
-    display.begin();
-    display.setContrast(displayContrast);
+    display.begin(displayContrast);
 
     tcpip_adapter_init();
     ESP_ERROR_CHECK(esp_event_loop_init(nullptr, nullptr));
@@ -185,7 +529,7 @@ extern "C" void app_main()
     if (!success)
     {
         LOG_D("Settings not found, entering Setup");
-        simpleDisplay(errorSettingsNotFound);
+        simpleDisplay(display, errorSettingsNotFound);
         delay(3000);
         xTaskCreate(
             setupTask,
@@ -198,7 +542,11 @@ extern "C" void app_main()
     }
 
     // menu where the user selects which operation mode should be used
-    showStartupMenu();
+    // with fast boot it is shown only if a button is held at power-on, otherwise Normal Operation starts right away
+    if (!useFastBoot || digitalRead(pinUp) || digitalRead(pinDown) || digitalRead(pinEnter))
+        showStartupMenu();
+    else
+        startNormalOperation();
 }
 
 
@@ -207,71 +555,89 @@ extern "C" void app_main()
 void normalOperationTask(void *)
 {
     LOG_T("begin");
-    LOG_T("Starting DHT sensor");
-    dht.setup(pinDHT, dhtType);
-    LOG_D("Started DHT sensor");
-    firebaseClient.begin(certificateBundle, settings.firebaseURL, settings.firebaseSecret, "/Schedules.json");
-    simpleDisplay(waitingForWifiString);
-    bool wifiWorking = true;
-    if (!connectSTAMode())
+    LOG_T("Starting sensors");
+    for (size_t i = 0; i < zoneCount; i++)
     {
-        LOG_D("Error connecting to Wifi");
-        simpleDisplay(errorWifiConnectString);
-        wifiWorking = false;
+        zones[i].sensor = SensorDriver::create(zoneConfigs[i].sensorType, zoneConfigs[i].pinSensor, i);
+        if (!zones[i].sensor)
+        {
+            LOG_E("Error starting the sensor of zone %s", zoneConfigs[i].name);
+        }
     }
+    LOG_D("Started sensors");
+    firebaseClient.begin(certificateBundle, settings.firebaseURL, settings.firebaseSecret, "/Schedules.json");
+    // the schedules from the last download, so the heater can be controlled before Firebase is reachable
+    loadSchedules();
+    loadUpdateCheck();
+    // after a reset that wasn't a power-on, the time is known before NTP is reachable
+    wallClock.restore();
     LOG_T("Starting NTP");
     configTzTime(settings.timezone, ntpServer0, ntpServer1, ntpServer2);
     LOG_D("Started NTP");
-    if (wifiWorking)
+    if (useFastBoot)
+    {
+        // Wifi, NTP and Firebase are brought up after the tasks are started, the Firebase loop initializes the stream
+        firebaseClient.setError(true);
+    }
+    else
     {
-        LOG_D("Trying to get NTP time");
-        simpleDisplay(waitingForNTPString);
-        uint32_t startMillis = millis();
-        while ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0 && millis() - startMillis < waitingTimeNTP)
+        simpleDisplay(display, waitingForWifiString);
+        bool wifiWorking = true;
+        if (!connectSTAMode())
         {
-            delay(100);
+            LOG_D("Error connecting to Wifi");
+            simpleDisplay(display, errorWifiConnectString);
+            wifiWorking = false;
         }
-        if ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0)
+        if (wifiWorking)
         {
-            LOG_D("Couldn't get NTP time");
-            LOG_D("Entering Manual Time Setup");
-            simpleDisplay(errorNTPString);
-            delay(3000);
-            manualTimeSetup();
+            simpleDisplay(display, waitingForNTPString);
+            if (!waitForNTP() && !timeIsSet())
+            {
+                LOG_D("Entering Manual Time Setup");
+                simpleDisplay(display, errorNTPString);
+                delay(3000);
+                manualTimeSetup();
+            }
+
+            simpleDisplay(display, waitingForFirebaseString);
+            LOG_D("Initializing Firebase stream");
+            firebaseClient.initializeStream();
         }
         else
         {
-            time_t now;
-            time(&now);
-            LOG_D("Got NTP time: %ld", now);
+            LOG_D("Bypassed initializing Firebase stream");
+            firebaseClient.setError(true);
+            if (!timeIsSet())
+            {
+                LOG_D("Entering Manual Time Setup");
+                delay(3000);
+                manualTimeSetup();
+            }
         }
 
-        simpleDisplay(waitingForFirebaseString);
-        LOG_D("Initializing Firebase stream");
-        firebaseClient.initializeStream();
-    }
-    else
-    {
-        LOG_D("Bypassed initializing Firebase stream");
-        firebaseClient.setError(true);
-        LOG_D("Entering Manual Time Setup");
-        delay(3000);
-        manualTimeSetup();
-    }
+        // we are sure we have the current time (either via ntp, restored or manual time)
+        time_t now;
+        tm tmnow;
+        time(&now);
+        localtime_r(&now, &tmnow);
+        LOG_D("Got Time: %s", ctime(&now));
 
-    // we are sure we have the current time (either via ntp or manual time)
-    time_t now;
-    tm tmnow;
-    time(&now);
-    localtime_r(&now, &tmnow);
-    LOG_D("Got Time: %s", ctime(&now));
+        display.clearDisplay();
+        display.setCursor(0, 0);
+        display.println(gotTimeString);
+        display.printf(gotTimeHourFormatString, tmnow.tm_hour, tmnow.tm_min);
+        display.printf(gotTimeDateFormatString, tmnow.tm_mday, tmnow.tm_mon + 1, tmnow.tm_year + 1900);
+        display.display();
+    }
 
-    display.clearDisplay();
-    display.setCursor(0, 0);
-    display.println(gotTimeString);
-    display.printf(gotTimeHourFormatString, tmnow.tm_hour, tmnow.tm_min);
-    display.printf(gotTimeDateFormatString, tmnow.tm_mday, tmnow.tm_mon + 1, tmnow.tm_year + 1900);
-    display.display();
+    // the handles of the tasks that aren't created stay null and are skipped
+    healthMonitor.addTask(&firebaseTaskHandle);
+    healthMonitor.addTask(&sensorTaskHandle);
+    healthMonitor.addTask(&evaluateSchedulesTaskHandle);
+    healthMonitor.addTask(&updateTaskHandle);
+    healthMonitor.addTask(&controlExecutorTaskHandle);
+    healthMonitor.addTask(&uiTaskHandle);
 
     xTaskCreatePinnedToCore(
         firebaseLoopTask,
@@ -283,43 +649,84 @@ void normalOperationTask(void *)
         0);
 
     xTaskCreatePinnedToCore(
-        uiLoopTask,
-        "uiLoopTask",
-        2048,
-        nullptr,
-        1,
-        &uiTaskHandle,
-        1);
-
-    xTaskCreatePinnedToCore(
-        sensorLoopTask,
-        "sensorLoopTask",
-        2048,
+        updateLoopTask,
+        "updateLoopTask",
+        6144,
         nullptr,
         1,
-        &sensorTaskHandle,
+        &updateTaskHandle,
         0);
 
-    xTaskCreatePinnedToCore(
-        evaluateSchedulesLoopTask,
-        "evaluateSchedulesLoopTask",
-        3096, 
-        nullptr,
-        2,
-        &evaluateSchedulesTaskHandle,
-        0);
+    if (useCooperativeExecutor)
+    {
+        // the schedule evaluation is added first, so it runs before the sensor when both are due
+        evaluateSchedulesJobId = controlExecutor.addJob("evaluateSchedules", evaluateSchedulesJob, portMAX_DELAY);
+        controlExecutor.addJob("sensor", sensorJob, 0);
+
+        xTaskCreatePinnedToCore(
+            executorTask,
+            "controlExecutorTask",
+            3072,
+            &controlExecutor,
+            2,
+            &controlExecutorTaskHandle,
+            0);
+    }
+    else
+    {
+        // created before the sensor task, which notifies it after every reading
+        xTaskCreatePinnedToCore(
+            evaluateSchedulesLoopTask,
+            "evaluateSchedulesLoopTask",
+            3072,
+            nullptr,
+            2,
+            &evaluateSchedulesTaskHandle,
+            0);
+
+        xTaskCreatePinnedToCore(
+            sensorLoopTask,
+            "sensorLoopTask",
+            2048,
+            nullptr,
+            1,
+            &sensorTaskHandle,
+            0);
+    }
 
     xTaskCreatePinnedToCore(
-        updateLoopTask,
-        "updateLoopTask",
-        6144,
+        uiLoopTask,
+        "uiLoopTask",
+        2048,
         nullptr,
         1,
-        &updateTaskHandle,
-        0);
+        &uiTaskHandle,
+        1);
+
+    startLocalApi();
 
     // deactivate the temporary schedule in Firebase
-    xTaskNotifyGive(firebaseTaskHandle);
+    requestTemporaryScheduleUpload();
+
+    if (useFastBoot)
+    {
+        // the control loops are already running, the rest of the bring-up happens in the background
+        if (!connectSTAMode())
+        {
+            LOG_D("Error connecting to Wifi");
+        }
+        if (!waitForNTP() && !timeIsSet())
+        {
+            // the UI task owns the display and the buttons now, so it asks for the time
+            LOG_D("Requesting Manual Time Setup");
+            xTaskNotify(uiTaskHandle, notificationManualTime, eSetBits);
+        }
+        else
+        {
+            notifyScheduleEvaluation();
+            requestDisplayUpdate();
+        }
+    }
 
     vTaskDelete(nullptr);
 }
@@ -327,7 +734,7 @@ void normalOperationTask(void *)
 void setupTask(void *)
 {
     LOG_T("begin");
-    setupDisplayInfo();
+    setupDisplayInfo(display, setupAPSSID, setupAPPassword);
 
     LOG_T("Starting Wifi AP");
     wifi_config_t wifi_config = {};
@@ -360,7 +767,7 @@ void setupTask(void *)
     if (err != ESP_OK)
     {
         LOG_E("Error starting server: %d", err);
-        simpleDisplay(errorSetupServer);
+        simpleDisplay(display, errorSetupServer);
         vTaskDelete(nullptr);
         return;
     }
@@ -377,101 +784,11 @@ void setupTask(void *)
 void firebaseLoopTask(void *)
 {
     LOG_T("begin");
-    unsigned long lastRetryErrors = 0;
-    unsigned long lastUploadState = 0;
+    bool uploadTemporarySchedule = false;
     while (true)
     {
-        if (!firebaseClient.getError())
-            if (firebaseClient.consumeStreamIfAvailable())
-            {
-                // something in the database changed, we download the whole database
-                // we try it for timesTryFirebase times, before we give up
-                LOG_D("New change in Firebase stream");
-                LOG_D("Trying to get new data");
-                for (int i = 1; i <= timesTryFirebase; i++)
-                {
-                    LOG_D("Attempt %d/%d", i, timesTryFirebase);
-                    xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
-                    firebaseClient.getJson("/Schedules.json", scheduleString);
-                    xSemaphoreGive(scheduleStringMutex);
-                    if (!firebaseClient.getError())
-                        break;
-                }
-                if (!firebaseClient.getError())
-                {
-                    LOG_D("Got new schedules");
-
-                    xTaskNotifyGive(evaluateSchedulesTaskHandle);
-                }
-                else
-                {
-                    LOG_D("Failed to get new schedules");
-                }
-            }
-
-        if (!firebaseClient.getError() && millis() - lastUploadState > intervalUploadState)
-        {
-            lastUploadState = millis();
-            char state[100];
-            xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
-            xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
-            if (!isnan(temperature))
-            {
-                snprintf(state, sizeof(state), 
-                    R"==({"temperature": %.1f, "humidity": %d, "state": %s, "time": {".sv": "timestamp"}})==",
-                    isnan(temperature) ? -1.0f : temperature, humidity, heaterState ? "true" : "false");
-            }
-            else
-            {
-                strcpy(state, R"==({"temperature": "nan", "humidity": -1, "state": false, "time": {".sv": "timestamp"}})==");
-            }
-            xSemaphoreGive(sensorValuesMutex);
-            xSemaphoreGive(heaterStateMutex);
-            firebaseClient.pushJson("/State.json", state);
-            if (firebaseClient.getError())
-            {
-                LOG_D("Error uploading state");
-            }
-        }
-
-        uint32_t notification = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500));
-        if (!firebaseClient.getError() && notification)
-        {
-            // upload temporary schedule
-            LOG_T("Uploading temporary schedule");
-            char string[100];
-            xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
-            if (temporaryScheduleActive)
-            {
-                snprintf(string, sizeof(string),
-                    R"==({"active": true, "temperature": %.1f, "remaining": %lld, "time": {".sv": "timestamp"}})==",
-                    temporaryScheduleTemp, (temporaryScheduleEnd == -1) ? -1 : temporaryScheduleEnd - millis());
-            }
-            else
-            {
-                strcpy(string, R"==({"active": false})==");
-            }
-            xSemaphoreGive(temporaryScheduleMutex);
-            firebaseClient.setJson("/TemporarySchedule.json", string);
-            if (firebaseClient.getError())
-            {
-                LOG_D("Error uploading temporary schedule");
-            }
-        }
-
-        if (millis() - lastRetryErrors > intervalRetryErrors)
-        {
-            lastRetryErrors = millis();
-            LOG_D("Trying to fix errors");
-            xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
-            bool wifiWorkingCopy = wifiWorking;
-            xSemaphoreGive(wifiWorkingMutex);
-            if (firebaseClient.getError() && wifiWorkingCopy)
-            {
-                LOG_T("Initializing Firebase stream");
-                firebaseClient.initializeStream();
-            }
-        }
+        TickType_t delay = firebaseStep(uploadTemporarySchedule);
+        uploadTemporarySchedule = ulTaskNotifyTake(pdTRUE, delay) != 0;
     }
 
     vTaskDelete(nullptr);
@@ -481,24 +798,61 @@ void uiLoopTask(void *)
 {
     LOG_T("begin");
     subscribeToButtonEvents(uiTaskHandle);
+    display.notifyOnTransfer(uiTaskHandle, notificationDisplayTransfer);
+    TickType_t lastDisplayUpdate = 0;
     while (true)
     {
+        // bursts of changes are merged into one redraw
+        TickType_t sinceLastUpdate = xTaskGetTickCount() - lastDisplayUpdate;
+        if (sinceLastUpdate < pdMS_TO_TICKS(minIntervalUpdateDisplay))
+        {
+            vTaskDelay(pdMS_TO_TICKS(minIntervalUpdateDisplay) - sinceLastUpdate);
+        }
         updateDisplay();
+        lastDisplayUpdate = xTaskGetTickCount();
+
+        // we sleep until something on the main screen changes, a button is pressed, the minute changes
+        // or a held button is due for a long press, which doesn't come with an edge
         uint32_t notificationValue = 0;
-        BaseType_t result = xTaskNotifyWait(
-            pdFALSE,
-            ULONG_MAX,
-            &notificationValue,
-            100); // wait maximum 100 ticks (100 ms)
-        if (result == pdTRUE)
-        {
-            Button pressed = static_cast<Button>(notificationValue);
-            if (pressed == Button::Enter)
+        BaseType_t result;
+        do
+        {
+            result = xTaskNotifyWait(
+                0,
+                ULONG_MAX,
+                &notificationValue,
+                std::min(ticksUntilNextMinute(), ticksUntilNextButtonEvent()));
+            // the results of the SPI transfer are taken when it ends, so the next redraw doesn't wait for them
+            if (result == pdTRUE && (notificationValue & notificationDisplayTransfer))
+                display.transferDone();
+        } while (result == pdTRUE && notificationValue == notificationDisplayTransfer);
+        if (result == pdTRUE && (notificationValue & notificationManualTime) && !timeIsSet())
+        {
+            LOG_D("Entering Manual Time Setup");
+            simpleDisplay(display, errorNTPString);
+            delay(3000);
+            manualTimeSetup();
+            notifyScheduleEvaluation();
+            lastDisplayUpdate = 0;
+        }
+        // the events are read after every wake-up, the long presses are generated here when they are due
+        buttonEvent_t event;
+        while (waitForButtonEvent(event, 0))
+        {
+            if (event.button == Button::Enter && event.type == ButtonEventType::Press)
             {
                 temporaryScheduleSetup();
+                // the menu drew over the main screen
+                lastDisplayUpdate = 0;
+            }
+            else if (event.button == Button::Down && event.type == ButtonEventType::LongPress)
+            {
+                // prints the trace to the serial port, it does nothing if tracing isn't enabled
+                traceDump();
             }
         }
     }
+    display.notifyOnTransfer(nullptr, 0);
     unsubscribeFromButtonEvents();
     vTaskDelete(nullptr);
 }
@@ -509,30 +863,8 @@ void sensorLoopTask(void *)
     TickType_t lastTemperatureUpdate = xTaskGetTickCount();
     while (true)
     {
-        LOG_T("Updating temperature and humidity");
-        auto[temp, hum] = dht.getTempAndHumidity();
-        xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
-        dhtReachability <<= 1;
-        if (dht.getStatus() == DHTesp::ERROR_NONE)
-        {
-            temperature = temp;
-            humidity = hum;
-            dhtReachability |= 1;
-            LOG_D("Temperature: %.1f, humidity: %d, reachability: %hho", temperature, humidity, dhtReachability);
-        }
-        else
-        {
-            LOG_D("Error reading sensor, reachability: %hho", dhtReachability);
-            if (dhtReachability == 0)
-            {
-                temperature = NAN;
-                humidity = -1;
-            }
-        }
-        xSemaphoreGive(sensorValuesMutex);
-        xTaskNotifyGive(evaluateSchedulesTaskHandle);
-
-        vTaskDelayUntil(&lastTemperatureUpdate, pdMS_TO_TICKS(intervalUpdateTemperature));
+        TickType_t delay = updateSensorValues();
+        vTaskDelayUntil(&lastTemperatureUpdate, delay);
     }
     vTaskDelete(nullptr);
 }
@@ -543,116 +875,7 @@ void evaluateSchedulesLoopTask(void *)
     while (true)
     {
         ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-
-        xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
-        if (isnan(temperature))
-        {
-            xSemaphoreGive(sensorValuesMutex);
-            sendSignalToHeater(false);
-            continue;
-        }
-        xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
-        if (temporaryScheduleActive)
-        {
-            LOG_D("Temporary schedule is active");
-            if (temporaryScheduleEnd == -1 || millis() < temporaryScheduleEnd)
-            {
-                bool signal = cmpTempSetTemp(temperature, temporaryScheduleTemp);
-                sendSignalToHeater(signal);
-            }
-            else
-            {
-                LOG_D("Temporary schedule expired");
-                temporaryScheduleActive = false;
-                xTaskNotifyGive(firebaseTaskHandle);
-            }
-            xSemaphoreGive(sensorValuesMutex);
-            xSemaphoreGive(temporaryScheduleMutex);
-        }
-        else
-        {
-            xSemaphoreGive(temporaryScheduleMutex);
-            float temperatureCopy = temperature;
-            xSemaphoreGive(sensorValuesMutex);
-            LOG_D("Evaluating schedules");
-            xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
-            // we find the active schedule from each category (daily, weekly, nonrepeating) if it exists
-            // in the end we give priority to the nonrepeating one, then to the weekly, then daily
-            bool onceScheduleActive = false, weeklyScheduleActive = false, dailyScheduleActive = false;
-            bool onceScheduleSignal = false, weeklyScheduleSignal = false, dailyScheduleSignal = false;
-            // we find the first occurrence of the character '{', excluding the first character; this is the beggining of the first schedule object
-            int beginIndex = scheduleString.indexOf('{', 1);
-            while (beginIndex != -1)
-            {
-                // we find the next occurrence of '}', starting at beginIndex; this is the end of the first schedule object
-                int endIndex = scheduleString.indexOf('}', beginIndex + 1);
-                StaticJsonDocument<400> doc;
-                auto error = deserializeJson(doc, scheduleString.c_str() + beginIndex, endIndex - beginIndex + 1);
-                if (error)
-                {
-                    LOG_D("Invalid schedule");
-                }
-                else
-                {
-                    auto schedule = doc.as<JsonObjectConst>();
-                    if (scheduleIsActive(schedule))
-                    {
-                        float setTemp = schedule["setTemp"];
-                        const char *repeat = schedule["repeat"];
-                        bool signal = cmpTempSetTemp(temperatureCopy, setTemp);
-
-                        // if a one-time schedule is active, then it has the highest priority, so we stop the loop after it
-                        if (strcmp(repeat, "Once") == 0)
-                        {
-                            onceScheduleActive = true;
-                            onceScheduleSignal = signal;
-                            break;
-                        }
-                        
-                        if (strcmp(repeat, "Weekly") == 0)
-                        {
-                            weeklyScheduleActive = true;
-                            weeklyScheduleSignal = signal;
-                        } 
-                        else if (strcmp(repeat, "Daily") == 0)
-                        {
-                            dailyScheduleActive = true;
-                            dailyScheduleSignal = signal;
-                        }
-                    }
-                }
-                beginIndex = scheduleString.indexOf('{', endIndex + 1);
-            }
-            xSemaphoreGive(scheduleStringMutex);
-
-            // if there was a nonrepeating schedule active, we pass its signal on
-            if (onceScheduleActive)
-            {
-                LOG_D("Following a one time schedule");
-                sendSignalToHeater(onceScheduleSignal);
-                continue;
-            }
-
-            // otherwise, if there was a weekly schedule active, we pass its signal on
-            if (weeklyScheduleActive)
-            {
-                LOG_D("Following a weekly schedule");
-                sendSignalToHeater(weeklyScheduleSignal);
-                continue;
-            }
-
-            // otherwise, if there was a daily schedule active, we pass its signal on
-            if (dailyScheduleActive)
-            {
-                LOG_D("Following a daily schedule");
-                sendSignalToHeater(dailyScheduleSignal);
-                continue;
-            }
-
-            // if there was no schedule active, we don't turn on the heater
-            LOG_D("No schedule is active");
-            sendSignalToHeater(false);
-        }
+        evaluateSchedules();
     }
     vTaskDelete(nullptr);
 }
@@ -661,88 +884,767 @@ void updateLoopTask(void *)
 {
     LOG_T("begin");
 
-    TickType_t lastCheckUpdate = 0;
     while (true)
     {
-        vTaskDelayUntil(&lastCheckUpdate, pdMS_TO_TICKS(intervalCheckUpdate));
-        std::string response;
-        esp_http_client_config_t config = {};
-        config.url = latestReleaseURL;
-        config.cert_pem = certificateBundle;
-        config.event_handler = update_http_event_handler;
-        // we make the buffers bigger to fit all the headers from Github and AWS
-        config.buffer_size = 2048;
-        config.buffer_size_tx = 2048;
-        config.user_data = &response;
-        LOG_D("Checking for updates");
-        esp_http_client_handle_t client = esp_http_client_init(&config);
-        esp_err_t err = esp_http_client_perform(client);
-        if (err != ESP_OK)
-        {
-            LOG_E("esp_http_client_perform error: %d", err);
-            esp_http_client_cleanup(client);
-            continue;
-        }
-        int code = esp_http_client_get_status_code(client);
-        if (code != 200)
-        {
-            LOG_E("Server returned status code: %d", code);
-            esp_http_client_cleanup(client);
-            continue;
-        }
-        esp_http_client_cleanup(client);
-        StaticJsonDocument<256> doc;
-        DeserializationError desErr = deserializeJson(doc, response);
-        if (desErr)
+        TickType_t ticks = updateCheckDelay();
+        if (ticks)
         {
-            LOG_E("Error deserializing message: %s", desErr.c_str());
+            vTaskDelay(ticks);
             continue;
         }
-        const char *version = doc["version"];
-        const char *updateURL = doc["url"];
-        if (!version || !updateURL)
+        checkForUpdate();
+        while (otaUpdater.isActive())
         {
-            LOG_E("Received incomplete message");
-            continue;
+            vTaskDelay(otaStep());
         }
-        LOG_T("current version | latest version: %s|%s", VERSION_STRING, version);
-        int major = atoi(version), minor = 0, patch = 0;
-        const char *next = strchr(version, '.');
-        if (next)
-        {
-            minor = atoi(++next);
-            next = strchr(next, '.');
-            if (next)
+    }
+    vTaskDelete(nullptr);
+}
+
+// runs the jobs of the Executor passed as parameter
+void executorTask(void *executor)
+{
+    LOG_T("begin");
+    static_cast<Executor *>(executor)->run();
+    vTaskDelete(nullptr);
+}
+
+
+/* Loop steps */
+
+// handles the Firebase stream, uploads the state and the temporary schedule and tries to fix errors
+// returns the number of ticks after which it should be called again
+TickType_t firebaseStep(bool uploadTemporarySchedule)
+{
+    static unsigned long lastRetryErrors = 0;
+    static unsigned long lastUploadState = 0;
+    static bool lastFirebaseError = false;
+    static bool lastNtpError = false;
+    // after a fast boot the stream is initialized here, as soon as there is a connection and the time is set
+    static bool streamInitialized = !useFastBoot;
+
+    healthMonitor.sample();
+    wallClock.update();
+
+    // saved from here, so the Wifi event handler doesn't write to flash
+    if (wifiProfileChanged.exchange(false))
+    {
+        xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+        settings.wifiProfile = connectedWifiProfile;
+        xSemaphoreGive(wifiWorkingMutex);
+        if (saveSettings(settings))
+        {
+            LOG_D("Saved the Wifi profile");
+        }
+    }
+
+    bool firebaseError = firebaseClient.getError();
+    if (firebaseError != lastFirebaseError)
+    {
+        lastFirebaseError = firebaseError;
+        requestDisplayUpdate();
+    }
+    // the NTP error is shown when no server answered, it changes without any event we could wait for
+    bool ntpError = (sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0;
+    if (ntpError != lastNtpError)
+    {
+        lastNtpError = ntpError;
+        requestDisplayUpdate();
+    }
+
+    if (!firebaseClient.getError())
+        if (firebaseClient.consumeStreamIfAvailable())
+        {
+            // something in the database changed, we download the whole database
+            // we try it for timesTryFirebase times, before we give up
+            int64_t changeTime = esp_timer_get_time();
+            LOG_D("New change in Firebase stream");
+            LOG_D("Trying to get new data");
+            for (int i = 1; i <= timesTryFirebase; i++)
+            {
+                LOG_D("Attempt %d/%d", i, timesTryFirebase);
+                xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
+                firebaseClient.getJson("/Schedules.json", scheduleString);
+                schedulesCompiled = false;
+                xSemaphoreGive(scheduleStringMutex);
+                if (!firebaseClient.getError())
+                    break;
+            }
+            if (!firebaseClient.getError())
+            {
+                LOG_D("Got new schedules");
+                saveSchedules();
+
+                requestScheduleEvaluation(CauseScheduleChange, changeTime);
+                publishEvent("schedules", R"==({"time": %ld})==", time(nullptr));
+            }
+            else
             {
-                patch = atoi(++next);
+                LOG_D("Failed to get new schedules");
             }
         }
-        if ((major > VERSION_MAJOR) || 
-            (major == VERSION_MAJOR && minor > VERSION_MINOR) || 
-            (major == VERSION_MAJOR && minor == VERSION_MINOR && patch > VERSION_PATCH))
+
+    if (!firebaseClient.getError() && millis() - lastUploadState > intervalUploadState)
+    {
+        lastUploadState = millis();
+        // static, so they don't take up space on the stack of the task
+        static char health[768];
+        static char latency[512];
+        static char clock[100];
+        static char zonesJson[144 * zoneCount];
+        static char state[190 + sizeof(health) + sizeof(latency) + sizeof(clock) + sizeof(zonesJson)];
+        healthMonitor.recordTlsUsage(firebaseClient.takeTlsPeakUsage());
+        if (healthMonitor.toJson(health, sizeof(health)) >= (int) sizeof(health))
+        {
+            LOG_D("Health doesn't fit in buffer");
+            strcpy(health, "null");
+        }
+        if (controlLatenciesToJson(latency, sizeof(latency)) >= (int) sizeof(latency))
+        {
+            LOG_D("Latency doesn't fit in buffer");
+            strcpy(latency, "null");
+        }
+        if (wallClock.toJson(clock, sizeof(clock)) >= (int) sizeof(clock))
+        {
+            LOG_D("Clock doesn't fit in buffer");
+            strcpy(clock, "null");
+        }
+        // every zone is in the same request, the first one also at the top level, where it was before there were zones
+        if (zonesToJson(zonesJson, sizeof(zonesJson)) >= (int) sizeof(zonesJson))
+        {
+            LOG_D("Zones don't fit in buffer");
+            strcpy(zonesJson, "null");
+        }
+        xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+        xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+        if (!isnan(zones[0].temperature))
+        {
+            snprintf(state, sizeof(state), 
+                R"==({"temperature": %.1f, "humidity": %d, "state": %s, "time": {".sv": "timestamp"}, "health": %s, "latency": %s, "firstDecision": %d, "clock": %s, "zones": %s})==",
+                zones[0].temperature, zones[0].humidity, zones[0].heaterState ? "true" : "false", health, latency, firstControlDecisionTime.load(), clock, zonesJson);
+        }
+        else
+        {
+            snprintf(state, sizeof(state),
+                R"==({"temperature": "nan", "humidity": -1, "state": false, "time": {".sv": "timestamp"}, "health": %s, "latency": %s, "firstDecision": %d, "clock": %s, "zones": %s})==",
+                health, latency, firstControlDecisionTime.load(), clock, zonesJson);
+        }
+        xSemaphoreGive(sensorValuesMutex);
+        xSemaphoreGive(heaterStateMutex);
+        firebaseClient.pushJson("/State.json", state);
+        if (firebaseClient.getError())
+        {
+            LOG_D("Error uploading state");
+        }
+    }
+
+    // the temporary schedule of the first zone is at /TemporarySchedule.json, the others at /Zones/<name>/TemporarySchedule.json
+    for (size_t i = 0; i < zoneCount && !firebaseClient.getError() && uploadTemporarySchedule; i++)
+    {
+        // upload temporary schedule
+        LOG_T("Uploading temporary schedule of zone %s", zones[i].config->name);
+        char string[100];
+        xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+        if (zones[i].temporaryScheduleActive)
+        {
+            snprintf(string, sizeof(string),
+                R"==({"active": true, "temperature": %.1f, "remaining": %lld, "time": {".sv": "timestamp"}})==",
+                zones[i].temporaryScheduleTemp, (zones[i].temporaryScheduleEnd == -1) ? -1 : zones[i].temporaryScheduleEnd - millis());
+        }
+        else
+        {
+            strcpy(string, R"==({"active": false})==");
+        }
+        xSemaphoreGive(temporaryScheduleMutex);
+        char path[80];
+        if (i == 0)
+            strcpy(path, "/TemporarySchedule.json");
+        else
+            snprintf(path, sizeof(path), "/Zones/%s/TemporarySchedule.json", zones[i].config->name);
+        firebaseClient.setJson(path, string);
+        if (firebaseClient.getError())
+        {
+            LOG_D("Error uploading temporary schedule");
+        }
+    }
+
+    if (!streamInitialized)
+    {
+        xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+        bool wifiWorkingCopy = wifiWorking;
+        xSemaphoreGive(wifiWorkingMutex);
+        if (wifiWorkingCopy && timeIsSet())
+        {
+            LOG_D("Initializing Firebase stream");
+            firebaseClient.initializeStream();
+            streamInitialized = true;
+            lastRetryErrors = millis();
+        }
+    }
+    else if (millis() - lastRetryErrors > intervalRetryErrors)
+    {
+        lastRetryErrors = millis();
+        LOG_D("Trying to fix errors");
+        xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+        bool wifiWorkingCopy = wifiWorking;
+        xSemaphoreGive(wifiWorkingMutex);
+        if (firebaseClient.getError() && wifiWorkingCopy)
+        {
+            LOG_T("Initializing Firebase stream");
+            firebaseClient.initializeStream();
+        }
+    }
+
+    return pdMS_TO_TICKS(500);
+}
+
+/* reads the sensor of each zone and publishes the values
+ * the sensors are read at the same time and without blocking, the first call starts the readings and the next ones advance them
+ * returns the number of ticks after which it should be called again, when the readings finished it's the time until the next ones,
+ * or until the next schedule boundary if it comes first, so the schedules don't wait for a slow reading to be evaluated
+ */
+TickType_t updateSensorValues()
+{
+    TRACE_SCOPE(TraceSpan::SensorRead);
+    static bool reading = false;
+    static bool pending[zoneCount];
+    static TickType_t readingStart;
+    static bool waiting = false;
+    static TickType_t nextReadingStart;
+
+    TickType_t delay = portMAX_DELAY;
+    if (!reading)
+    {
+        TickType_t untilReading = nextReadingStart - xTaskGetTickCount();
+        if (waiting && (int32_t) untilReading > 0)
+        {
+            // woken up at a schedule boundary
+            if (scheduleBoundaryPassed())
+                notifyScheduleEvaluation();
+            return std::min(untilReading, ticksUntilScheduleBoundary());
+        }
+        LOG_T("Updating temperature and humidity");
+        reading = true;
+        readingStart = xTaskGetTickCount();
+        for (size_t i = 0; i < zoneCount; i++)
+        {
+            pending[i] = zones[i].sensor != nullptr;
+            if (pending[i])
+                delay = std::min(delay, zones[i].sensor->startReading());
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < zoneCount; i++)
         {
-            LOG_D("New update");
-            config = {};
-            config.url = updateURL;
-            config.cert_pem = certificateBundle;
-            // we make the buffers bigger to fit all the headers from Github and AWS
-            config.buffer_size = 2048;
-            config.buffer_size_tx = 2048;
+            if (!pending[i])
+                continue;
+            TickType_t stepDelay = zones[i].sensor->step();
+            if (stepDelay == 0)
+                pending[i] = false;
+            else
+                delay = std::min(delay, stepDelay);
+        }
+    }
+    // some readings are still in progress
+    if (delay != portMAX_DELAY)
+        return delay;
+    reading = false;
 
-            err = esp_https_ota(&config);
-            if (err == ESP_OK)
+    // the schedules are evaluated when a published temperature changed, and at the schedule boundaries
+    bool temperatureChanged = false;
+    bool displayChanged = false;
+    for (zone_t &zone : zones)
+    {
+        SensorDriver::Status status = zone.sensor ? zone.sensor->getStatus() : SensorDriver::Status::None;
+        xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+        float oldTemperature = zone.temperature;
+        int oldHumidity = zone.humidity;
+        bool oldSensorError = zone.sensorError;
+        bool previousFailed = !(zone.reachability & 1);
+        zone.reachability <<= 1;
+        if (status == SensorDriver::Status::Ok)
+        {
+            uint32_t interval = zone.temperatureFilter.hasValue() ? (readingStart - zone.lastReading) * portTICK_PERIOD_MS : 0;
+            zone.lastReading = readingStart;
+            float temp = zone.sensor->getTemperature();
+            float hum = zone.sensor->getHumidity();
+            zone.temperatureFilter.add(lroundf(temp * 100), interval);
+            if (!isnan(hum))
+                zone.humidityFilter.add(lroundf(hum * 100), interval);
+            zone.temperature = zone.temperatureFilter.getPublished() / 100.0f;
+            zone.temperatureTrend = zone.temperatureFilter.getTrend() / 100.0f;
+            zone.humidity = zone.humidityFilter.hasValue() ? (zone.humidityFilter.getPublished() + 50) / 100 : -1;
+            zone.reachability |= 1;
+            zone.sensorError = false;
+            LOG_D("Zone %s temperature: %.1f (read %.1f, trend %.2f/min), humidity: %d (read %.1f), reachability: %hho",
+                zone.config->name, zone.temperature, temp, zone.temperatureTrend, zone.humidity, hum, zone.reachability);
+        }
+        else
+        {
+            LOG_D("Error reading the sensor of zone %s: %s, reachability: %hho", zone.config->name, SensorDriver::getStatusName(status), zone.reachability);
+            if (!previousFailed)
+                zone.failingSince = readingStart;
+            // the values are kept through a few failed readings, but not for longer than sensorUnreachableTimeout
+            if (!zone.temperatureFilter.hasValue() || readingStart - zone.failingSince >= pdMS_TO_TICKS(sensorUnreachableTimeout))
             {
-                LOG_D("Update successful");
-                delay(3000);
-                esp_restart();
+                zone.sensorError = true;
+                zone.temperature = NAN;
+                zone.temperatureTrend = NAN;
+                zone.humidity = -1;
+                zone.temperatureFilter.reset();
+                zone.humidityFilter.reset();
             }
+        }
+        bool zoneTemperatureChanged = !(zone.temperature == oldTemperature || (isnan(zone.temperature) && isnan(oldTemperature)));
+        bool valuesChanged = zoneTemperatureChanged || zone.humidity != oldHumidity;
+        temperatureChanged |= zoneTemperatureChanged;
+        // the sensor error is shown for every zone, the values only for the first one
+        displayChanged |= zone.sensorError != oldSensorError;
+        if (&zone == &zones[0])
+            displayChanged |= valuesChanged;
+        if (valuesChanged)
+        {
+            if (isnan(zone.temperature))
+                publishEvent("sensor", R"==({"zone": "%s", "temperature": null, "humidity": null})==", zone.config->name);
             else
+                publishEvent("sensor", R"==({"zone": "%s", "temperature": %.1f, "humidity": %d})==", zone.config->name, zone.temperature, zone.humidity);
+        }
+        xSemaphoreGive(sensorValuesMutex);
+    }
+
+    bool boundaryPassed = scheduleBoundaryPassed();
+    if (temperatureChanged)
+        requestScheduleEvaluation(CauseSensorSample, esp_timer_get_time());
+    else if (boundaryPassed)
+        notifyScheduleEvaluation();
+    if (displayChanged)
+        requestDisplayUpdate();
+
+    // the interval is kept from the start of the readings
+    uint32_t interval = adaptSensorSampleInterval(sensorSampleInterval);
+    if (interval != sensorSampleInterval)
+        LOG_D("Sensor sample interval: %u ms", interval);
+    sensorSampleInterval = interval;
+    waiting = true;
+    nextReadingStart = readingStart + pdMS_TO_TICKS(interval);
+    TickType_t untilReading = nextReadingStart - xTaskGetTickCount();
+    return (int32_t) untilReading > 0 ? std::min(untilReading, ticksUntilScheduleBoundary()) : 1;
+}
+
+/* chooses the interval until the next readings of the sensors, from the filtered temperatures and the setpoints
+ * it's intervalUpdateTemperatureMin while a temperature is close to its setpoint or changing fast, since that's when its heater is about to switch,
+ * and after a failed reading, so a sensor that fails is retried soon;
+ * it doubles up to intervalUpdateTemperatureMax while every temperature is stable and far from its setpoint (or has none),
+ * and it's intervalUpdateTemperature otherwise, also while a temperature isn't known
+ * it's never shorter than the minimum interval of a sensor
+ */
+uint32_t adaptSensorSampleInterval(uint32_t interval)
+{
+    uint32_t minInterval = intervalUpdateTemperatureMin;
+    for (const zone_t &zone : zones)
+        if (zone.sensor)
+            minInterval = std::max(minInterval, zone.sensor->getMinInterval());
+
+    float setpoints[zoneCount];
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+        setpoints[i] = zones[i].activeSetpoint;
+    xSemaphoreGive(heaterStateMutex);
+
+    bool fast = false;
+    bool slow = true;
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        zone_t &zone = zones[i];
+        if (!zone.sensor)
+            continue;
+        if (!(zone.reachability & 1))
+            fast = true;
+        if (isnan(zone.temperature) || isnan(zone.temperatureTrend))
+        {
+            zone.changing = false;
+            slow = false;
+            continue;
+        }
+        float distance = isnan(setpoints[i]) ? INFINITY : fabsf(zone.temperature - setpoints[i]);
+        zone.changing = fabsf(zone.temperatureTrend) >= (zone.changing ? sensorSteadyTrend : sensorFastTrend);
+        if (distance <= sensorFastBand || zone.changing)
+            fast = true;
+        if (distance <= sensorSlowBand || zone.changing)
+            slow = false;
+    }
+    xSemaphoreGive(sensorValuesMutex);
+
+    if (fast)
+        interval = intervalUpdateTemperatureMin;
+    else if (slow)
+        interval = std::min<uint32_t>(std::max<uint32_t>(interval, intervalUpdateTemperature) * 2, intervalUpdateTemperatureMax);
+    else
+        interval = intervalUpdateTemperature;
+    return std::max(interval, minInterval);
+}
+
+/* tells if a schedule boundary passed since the previous call: a minute started, when the schedules can start and end, or a temporary schedule expired
+ * the schedules have to be evaluated then even if no temperature changed
+ */
+bool scheduleBoundaryPassed()
+{
+    static time_t lastMinute = 0;
+
+    bool temporaryScheduleExpired = false;
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    for (const zone_t &zone : zones)
+        if (zone.temporaryScheduleActive && zone.temporaryScheduleEnd != -1 && millis() >= zone.temporaryScheduleEnd)
+            temporaryScheduleExpired = true;
+    xSemaphoreGive(temporaryScheduleMutex);
+    time_t minute = time(nullptr) / 60;
+    bool passed = minute != lastMinute || temporaryScheduleExpired;
+    lastMinute = minute;
+    return passed;
+}
+
+// returns the number of ticks until the next minute, or until the earliest temporary schedule ends if it's sooner, at most intervalUpdateTemperatureMax
+TickType_t ticksUntilScheduleBoundary()
+{
+    TickType_t ticks = timeIsSet() ? ticksUntilNextMinute() : pdMS_TO_TICKS(intervalUpdateTemperatureMax);
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    for (const zone_t &zone : zones)
+    {
+        // the ones that already expired are found by scheduleBoundaryPassed()
+        int64_t remaining = zone.temporaryScheduleEnd - (int64_t) millis();
+        if (zone.temporaryScheduleActive && zone.temporaryScheduleEnd != -1 && remaining > 0 && remaining < (int64_t) intervalUpdateTemperatureMax)
+            ticks = std::min(ticks, pdMS_TO_TICKS(remaining) + 1);
+    }
+    xSemaphoreGive(temporaryScheduleMutex);
+    return ticks;
+}
+
+/* decides if the heater of each zone should be on, based on its temperature and the schedule in effect for it, and sends the signals
+ * the schedules of all the zones are found in one pass over the compiled schedules
+ */
+void evaluateSchedules()
+{
+    TRACE_SCOPE(TraceSpan::ScheduleEvaluation);
+    claimControlCauses();
+    // without the time the schedules can't be followed, so the heaters stay off
+    if (!timeIsSet())
+    {
+        for (zone_t &zone : zones)
+            sendSignalToHeater(zone, false);
+        recordControlLatencies(esp_timer_get_time());
+        return;
+    }
+
+    LOG_D("Evaluating schedules");
+    time_t now;
+    tm tmnow;
+    time(&now);
+    localtime_r(&now, &tmnow);
+    // the index in compiledSchedules of the active schedule of each zone and category (the index of ScheduleRepeat), -1 if there is none
+    // the nonrepeating one has priority, then the weekly one, then the daily one
+    int activeSchedules[zoneCount][3];
+    for (auto &zoneSchedules : activeSchedules)
+        std::fill(std::begin(zoneSchedules), std::end(zoneSchedules), -1);
+    // the schedule in effect for each zone
+    float setTemps[zoneCount];
+    int positions[zoneCount];
+    const char *sources[zoneCount];
+    const char *const repeatSources[] = { "once", "weekly", "daily" };
+    xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
+    if (!schedulesCompiled)
+        compileSchedules();
+    for (size_t i = 0; i < compiledScheduleCount; i++)
+    {
+        const compiledSchedule_t &schedule = compiledSchedules[i];
+        int &active = activeSchedules[schedule.zone][(int) schedule.repeat];
+        // the first active one time schedule is followed, of the repeating ones the last one
+        if (schedule.repeat == ScheduleRepeat::Once && active != -1)
+            continue;
+        if (scheduleIsActive(schedule, now, tmnow))
+            active = i;
+    }
+    for (size_t zone = 0; zone < zoneCount; zone++)
+    {
+        setTemps[zone] = NAN;
+        positions[zone] = -1;
+        sources[zone] = "none";
+        for (int category = 0; category < 3; category++)
+        {
+            int active = activeSchedules[zone][category];
+            if (active != -1)
             {
-                LOG_E("Update failed with error: %d", err);
+                setTemps[zone] = compiledSchedules[active].setTemp;
+                positions[zone] = compiledSchedules[active].position;
+                sources[zone] = repeatSources[category];
+                break;
             }
         }
     }
-    vTaskDelete(nullptr);
+    xSemaphoreGive(scheduleStringMutex);
+
+    // a temporary schedule has priority over all the schedules of its zone
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        zone_t &zone = zones[i];
+        if (!zone.temporaryScheduleActive)
+            continue;
+        if (zone.temporaryScheduleEnd == -1 || millis() < zone.temporaryScheduleEnd)
+        {
+            setTemps[i] = zone.temporaryScheduleTemp;
+            positions[i] = -2;
+            sources[i] = "temporary";
+        }
+        else
+        {
+            LOG_D("Temporary schedule of zone %s expired", zone.config->name);
+            zone.temporaryScheduleActive = false;
+            requestTemporaryScheduleUpload();
+            // the end of the temporary schedule is the cause of following the schedules again
+            if (!claimedControlCauses[CauseScheduleBoundary])
+                claimedControlCauses[CauseScheduleBoundary] = zone.temporaryScheduleEnd * 1000;
+        }
+    }
+    xSemaphoreGive(temporaryScheduleMutex);
+
+    float temperatures[zoneCount];
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+        temperatures[i] = zones[i].temperature;
+    xSemaphoreGive(sensorValuesMutex);
+
+    bool activeScheduleChanged = false;
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        zone_t &zone = zones[i];
+        LOG_D("Zone %s follows schedule: %s", zone.config->name, sources[i]);
+        setActiveSetpoint(zone, setTemps[i], sources[i]);
+        activeScheduleChanged |= positions[i] != zone.activeSchedule;
+        zone.activeSchedule = positions[i];
+        // without the temperature the schedule can't be followed, so the heater stays off
+        if (isnan(temperatures[i]))
+        {
+            sendSignalToHeater(zone, false);
+            continue;
+        }
+        if (firstControlDecisionTime == -1)
+        {
+            firstControlDecisionTime = esp_timer_get_time() / 1000;
+            LOG_D("First control decision after %d ms", firstControlDecisionTime.load());
+        }
+        // if there was no schedule active, we don't turn on the heater
+        sendSignalToHeater(zone, !isnan(setTemps[i]) && cmpTempSetTemp(zone, temperatures[i], setTemps[i]));
+    }
+    claimScheduleBoundary(activeScheduleChanged);
+    recordControlLatencies(esp_timer_get_time());
+}
+
+/* downloads the description of the latest release, and installs it if it is newer than the current firmware
+ * the request is conditional, when the release didn't change since the last check the server answers without it
+ */
+void checkForUpdate()
+{
+    TLS_MEMORY_SCOPE(TlsConnection::UpdateCheck);
+    updateCheckResponse_t response = {};
+    esp_http_client_config_t config = {};
+    config.url = latestReleaseURL;
+    config.cert_pem = certificateBundle;
+    config.event_handler = update_http_event_handler;
+    // we make the buffers bigger to fit all the headers from Github and AWS
+    config.buffer_size = 2048;
+    config.buffer_size_tx = 2048;
+    config.user_data = &response;
+    LOG_D("Checking for updates");
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (updateCheck.etag[0])
+        esp_http_client_set_header(client, "If-None-Match", updateCheck.etag);
+    if (updateCheck.lastModified[0])
+        esp_http_client_set_header(client, "If-Modified-Since", updateCheck.lastModified);
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK)
+    {
+        LOG_E("esp_http_client_perform error: %d", err);
+        esp_http_client_cleanup(client);
+        lastFailedUpdateCheck = xTaskGetTickCount();
+        updateCheckFailed = true;
+        return;
+    }
+    int code = esp_http_client_get_status_code(client);
+    esp_http_client_cleanup(client);
+    if (code == 304)
+    {
+        LOG_D("The latest release didn't change");
+        updateCheckFailed = false;
+        updateCheck.lastCheck = time(nullptr);
+        saveUpdateCheck();
+        return;
+    }
+    if (code != 200)
+    {
+        LOG_E("Server returned status code: %d", code);
+        lastFailedUpdateCheck = xTaskGetTickCount();
+        updateCheckFailed = true;
+        return;
+    }
+    updateCheckFailed = false;
+    updateCheck.lastCheck = time(nullptr);
+    // a release that can't be used is downloaded again at the next check, it may have been fixed in the meantime
+    updateCheck.etag[0] = '\0';
+    updateCheck.lastModified[0] = '\0';
+    // the strings stay in the response instead of being copied to the document
+    StaticJsonDocument<1024> doc;
+    DeserializationError desErr = deserializeJson(doc, &response.body[0]);
+    if (desErr)
+    {
+        LOG_E("Error deserializing message: %s", desErr.c_str());
+        saveUpdateCheck();
+        return;
+    }
+    const char *version = doc["version"];
+    const char *updateURL = doc["url"];
+    // optional, the SHA-256 of the image in hex
+    const char *sha256 = doc["sha256"];
+    if (!version || !updateURL)
+    {
+        LOG_E("Received incomplete message");
+        saveUpdateCheck();
+        return;
+    }
+    LOG_T("current version | latest version: %s|%s", VERSION_STRING, version);
+    int major = atoi(version), minor = 0, patch = 0;
+    const char *next = strchr(version, '.');
+    if (next)
+    {
+        minor = atoi(++next);
+        next = strchr(next, '.');
+        if (next)
+        {
+            patch = atoi(++next);
+        }
+    }
+    if ((major > VERSION_MAJOR) || 
+        (major == VERSION_MAJOR && minor > VERSION_MINOR) || 
+        (major == VERSION_MAJOR && minor == VERSION_MINOR && patch > VERSION_PATCH))
+    {
+        LOG_D("New update");
+        /* the smallest download that results in the image: a patch against the running image,
+         * the compressed image, or the image itself, the release has the ones that are smaller than the image
+         */
+        OtaUpdater::Format format = OtaUpdater::Format::Image;
+        const char *compressedURL = doc["compressed"];
+        if (compressedURL)
+        {
+            format = OtaUpdater::Format::Compressed;
+            updateURL = compressedURL;
+        }
+        updateFallback = { "", updateURL, sha256 ? sha256 : "", format };
+        char runningSha256[65];
+        if (OtaUpdater::getRunningSha256(runningSha256))
+        {
+            for (JsonObject delta : doc["deltas"].as<JsonArray>())
+            {
+                const char *from = delta["from"];
+                const char *deltaURL = delta["url"];
+                if (from && deltaURL && strcmp(from, runningSha256) == 0 && failedDeltaURL != deltaURL)
+                {
+                    format = OtaUpdater::Format::Delta;
+                    updateURL = deltaURL;
+                    updateFallback.deltaURL = deltaURL;
+                    break;
+                }
+            }
+        }
+        // the image is downloaded by otaStep()
+        otaUpdater.start(updateURL, sha256, format);
+    }
+    else
+    {
+        strlcpy(updateCheck.etag, response.etag, sizeof(updateCheck.etag));
+        strlcpy(updateCheck.lastModified, response.lastModified, sizeof(updateCheck.lastModified));
+    }
+    saveUpdateCheck();
+}
+
+/* returns the number of ticks until the next update check, 0 if it is due
+ * the time of the last check is kept across restarts, so the check right after boot only happens if it is stale
+ */
+TickType_t updateCheckDelay()
+{
+    if (updateCheckFailed)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - lastFailedUpdateCheck;
+        if (elapsed < pdMS_TO_TICKS(intervalRetryCheckUpdate))
+            return pdMS_TO_TICKS(intervalRetryCheckUpdate) - elapsed;
+        return 0;
+    }
+    // we can't tell how old the last check is before the time is known
+    if (!timeIsSet())
+        return pdMS_TO_TICKS(intervalRetryErrors);
+    int64_t elapsed = (int64_t) time(nullptr) - updateCheck.lastCheck;
+    // a last check in the future means the time was wrong when it was made
+    if (updateCheck.lastCheck == 0 || elapsed < 0 || elapsed >= intervalCheckUpdate / 1000)
+        return 0;
+    return pdMS_TO_TICKS(intervalCheckUpdate - elapsed * 1000);
+}
+
+/* downloads the next chunk of the update, and restarts when the update is installed
+ * returns the number of ticks after which it should be called again, the delays between chunks limit the bandwidth of the update
+ */
+TickType_t otaStep()
+{
+    static uint32_t lastPublishedPercent = 0;
+    TickType_t ticks = otaUpdater.step();
+    uint32_t total = otaUpdater.getTotal();
+    uint32_t percent = total ? (uint64_t) otaUpdater.getReceived() * 100 / total : 0;
+    if (percent < lastPublishedPercent || percent >= lastPublishedPercent + 5)
+    {
+        lastPublishedPercent = percent;
+        publishEvent("update", R"==({"received": %u, "total": %u, "written": %u, "throughput": %u})==",
+            otaUpdater.getReceived(), total, otaUpdater.getWritten(), otaUpdater.getThroughput());
+    }
+    switch (otaUpdater.getState())
+    {
+    case OtaUpdater::State::Succeeded:
+        LOG_D("Update successful");
+        publishEvent("update", R"==({"result": "installed"})==");
+        delay(3000);
+        esp_restart();
+        break;
+    case OtaUpdater::State::Failed:
+        lastPublishedPercent = 0;
+        if (!updateFallback.deltaURL.empty())
+        {
+            // the patch may be corrupted or made against another image, the release also has the image itself
+            LOG_E("The patch couldn't be applied, downloading the image");
+            publishEvent("update", R"==({"result": "deltaFailed"})==");
+            failedDeltaURL = updateFallback.deltaURL;
+            updateFallback.deltaURL.clear();
+            if (otaUpdater.start(updateFallback.url.c_str(), updateFallback.sha256.empty() ? nullptr : updateFallback.sha256.c_str(), updateFallback.format))
+                return 0;
+        }
+        LOG_E("Update failed");
+        publishEvent("update", R"==({"result": "failed"})==");
+        break;
+    default:
+        break;
+    }
+    return ticks;
+}
+
+
+/* Executor jobs */
+
+TickType_t sensorJob(bool)
+{
+    return updateSensorValues();
+}
+
+TickType_t evaluateSchedulesJob(bool)
+{
+    evaluateSchedules();
+    return portMAX_DELAY;
 }
 
 
@@ -755,36 +1657,26 @@ void showStartupMenu()
     // first the selected option is Normal Operation
     LOG_T("begin");
     size_t selectedOption = 0;
-    startupMenuHelper(selectedOption);
+    startupMenuHelper(display, selectedOption);
     subscribeToButtonEvents(xTaskGetCurrentTaskHandle());
 
-    uint32_t notificationValue;
-    BaseType_t result = xTaskNotifyWait(
-        pdFALSE,
-        ULONG_MAX,
-        &notificationValue,
-        pdMS_TO_TICKS(waitingTimeInStartupMenu));
-    if (result == pdTRUE)
+    Button pressed = waitForButton(pdMS_TO_TICKS(waitingTimeInStartupMenu));
+    if (pressed != Button::None)
     {
         // a button was pressed, do not autoselect
         while (true)
         {
-            Button pressed = static_cast<Button>(notificationValue);
             if (pressed == Button::Up || pressed == Button::Down)
             {
                 selectedOption = (selectedOption + 1) % 2;
-                startupMenuHelper(selectedOption);
+                startupMenuHelper(display, selectedOption);
             }
             else if (pressed == Button::Enter)
             {
                 break;
             }
             
-            xTaskNotifyWait(
-                pdFALSE,
-                ULONG_MAX,
-                &notificationValue,
-                portMAX_DELAY);
+            pressed = waitForButton(portMAX_DELAY);
         }
     }
     unsubscribeFromButtonEvents();
@@ -795,13 +1687,7 @@ void showStartupMenu()
     switch (selectedOption)
     {
     case 0:
-        xTaskCreate(
-            normalOperationTask,
-            "normalOperationTask",
-            8192,
-            nullptr,
-            1,
-            &setupTaskHandle);
+        startNormalOperation();
         break;
     case 1:
         xTaskCreate(
@@ -815,34 +1701,19 @@ void showStartupMenu()
     }
 }
 
-void startupMenuHelper(int highlightedOption)
+void startNormalOperation()
 {
-    display.clearDisplay();
-    display.setTextSize(1);
-    display.setCursor(0, 0);
-
-    display.println(menuTitleString);
-
-    if (highlightedOption == 0)
-        display.setTextColor(WHITE, BLACK);
-    else
-        display.setTextColor(BLACK);
-
-    display.println(menuNormalModeString);
+    xTaskCreate(
+        normalOperationTask,
+        "normalOperationTask",
+        8192,
+        nullptr,
+        1,
+        &setupTaskHandle);
+}
 
-    if (highlightedOption == 1)
-        display.setTextColor(WHITE, BLACK);
-    else
-        display.setTextColor(BLACK);
 
-    display.println(menuSetupString);
-
-    display.setTextColor(BLACK);
-    display.display();
-}
-
-
-/* Temporary Schedule */
+/* Temporary Schedule */
 
 void temporaryScheduleSetup()
 {
@@ -853,11 +1724,12 @@ void temporaryScheduleSetup()
     int duration = 30;
     int option = 0;
     int sel = 0;
+    // the menu sets the temporary schedule of the zone shown on the display
     xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
-    if (temporaryScheduleActive)
+    if (zones[0].temporaryScheduleActive)
     {
         LOG_T("Modifying current temporary schedule");
-        temp = temporaryScheduleTemp;
+        temp = zones[0].temporaryScheduleTemp;
         // the new temporary schedule will end at the same time as the old one
         duration = -1;
     }
@@ -867,22 +1739,16 @@ void temporaryScheduleSetup()
         "option=%d\n"
         "sel=%d",
         temp, duration, option, sel);
-    temporaryScheduleHelper(temp, duration, option, sel);
+    temporaryScheduleHelper(display, temp, duration, temporaryScheduleMinutesLeft(), option, sel);
 
-    uint32_t notificationValue;
-    BaseType_t result = xTaskNotifyWait(
-        pdFALSE,
-        ULONG_MAX,
-        &notificationValue,
-        pdMS_TO_TICKS(waitingTimeInTemporaryScheduleMenu));
-    if (result == pdFALSE)
+    Button pressed = waitForButton(pdMS_TO_TICKS(waitingTimeInTemporaryScheduleMenu));
+    if (pressed == Button::None)
     {
         LOG_D("Exiting menu because nothing was pressed");
         return;
     }
     while (true)
     {
-        Button pressed = static_cast<Button>(notificationValue);
         if (pressed == Button::Enter)
         {
             sel++;
@@ -958,678 +1824,1623 @@ void temporaryScheduleSetup()
                 break;
             }
         }
-        temporaryScheduleHelper(temp, duration, option, sel);
+        temporaryScheduleHelper(display, temp, duration, temporaryScheduleMinutesLeft(), option, sel);
 
-        xTaskNotifyWait(
-            pdFALSE,
-            ULONG_MAX,
-            &notificationValue,
-            portMAX_DELAY);
+        pressed = waitForButton(portMAX_DELAY);
     }
 
     xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
     switch (option)
     {
     case 0:
-        temporaryScheduleActive = true;
-        temporaryScheduleTemp = temp;
+        zones[0].temporaryScheduleActive = true;
+        zones[0].temporaryScheduleTemp = temp;
         if (duration != -1)
         {
             if (duration == 24 * 60 + 30)
-                temporaryScheduleEnd = -1;
+                zones[0].temporaryScheduleEnd = -1;
             else
             {
-                temporaryScheduleEnd = millis() + duration * 60 * 1000;
+                zones[0].temporaryScheduleEnd = millis() + duration * 60 * 1000;
             }
         }
         LOG_D("Saved temporary schedule");
-        xTaskNotifyGive(evaluateSchedulesTaskHandle);
-        xTaskNotifyGive(firebaseTaskHandle);
+        requestScheduleEvaluation(CauseTemporarySchedule, esp_timer_get_time());
+        requestTemporaryScheduleUpload();
         break;
     case 1:
         LOG_D("Return without changing anything");
         break;
     case 2:
-        temporaryScheduleActive = false;
+        zones[0].temporaryScheduleActive = false;
         LOG_D("Deleted temporary schedule");
-        xTaskNotifyGive(evaluateSchedulesTaskHandle);
-        xTaskNotifyGive(firebaseTaskHandle);
+        requestScheduleEvaluation(CauseTemporarySchedule, esp_timer_get_time());
+        requestTemporaryScheduleUpload();
         break;
     }
-    xSemaphoreGive(temporaryScheduleMutex);
+    xSemaphoreGive(temporaryScheduleMutex);
+}
+
+
+// (min) the time left of the temporary schedule of the zone shown on the display, -1 if it doesn't end
+int temporaryScheduleMinutesLeft()
+{
+    int minutesLeft;
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    if (zones[0].temporaryScheduleEnd == -1)
+        minutesLeft = -1;
+    else
+        minutesLeft = (zones[0].temporaryScheduleEnd - millis()) / 1000 / 60;
+    xSemaphoreGive(temporaryScheduleMutex);
+    return minutesLeft;
+}
+
+
+/* Display helpers */
+
+// draws the main screen with the values of the zone shown on the display, only the widgets that changed are redrawn
+void updateDisplay()
+{
+    TRACE_SCOPE(TraceSpan::DisplayRender);
+    static mainScreenCache_t cache;
+
+    mainScreenState_t state;
+    time_t now;
+    time(&now);
+    localtime_r(&now, &state.time);
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    state.temp = zones[0].temperature;
+    state.hum = zones[0].humidity;
+    xSemaphoreGive(sensorValuesMutex);
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    state.heater = zones[0].heaterState;
+    xSemaphoreGive(heaterStateMutex);
+    state.errors = getDisplayErrors();
+    if (!cache.drawn || state.errors != cache.state.errors)
+    {
+        publishEvent("errors", R"==({"wifi": %s, "ntp": %s, "firebase": %s, "sensor": %s})==",
+            (state.errors & DisplayErrorWifi) ? "true" : "false",
+            (state.errors & DisplayErrorNTP) ? "true" : "false",
+            (state.errors & DisplayErrorFirebase) ? "true" : "false",
+            (state.errors & DisplayErrorSensor) ? "true" : "false");
+    }
+
+    drawMainScreen(display, state, cache);
+}
+
+// returns the number of ticks until the clock on the main screen has to change
+TickType_t ticksUntilNextMinute()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    tm tmnow;
+    localtime_r(&tv.tv_sec, &tmnow);
+    uint32_t ms = (60 - tmnow.tm_sec) * 1000 - tv.tv_usec / 1000;
+    // we wake up slightly after the minute changed, so we don't draw the old minute again
+    return pdMS_TO_TICKS(ms + 10);
+}
+
+// returns the errors that should be shown on the main screen, as a combination of DisplayError flags
+uint8_t getDisplayErrors()
+{
+    uint8_t errors = 0;
+    xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+    bool wifiWorkingCopy = wifiWorking;
+    xSemaphoreGive(wifiWorkingMutex);
+    if (!wifiWorkingCopy)
+    {
+        // error with wifi, no need to check if firebase and ntp work because they don't
+        // also no need to display ntp and firebase errors, just wifi error
+        errors |= DisplayErrorWifi;
+    }
+    else
+    {
+        if ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0)
+            errors |= DisplayErrorNTP;
+
+        if (firebaseClient.getError())
+            errors |= DisplayErrorFirebase;
+    }
+
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    for (const zone_t &zone : zones)
+        if (zone.sensorError)
+            errors |= DisplayErrorSensor;
+    xSemaphoreGive(sensorValuesMutex);
+    return errors;
+}
+
+
+/* Manual Time */
+
+// prompts the user to enter the current date and time
+void manualTimeSetup()
+{
+    LOG_T("begin");
+    int manualTime[] = {0, 0, 1, 1, 2020}; // int h=0, m=0, d=1, mth=1, y=2020;
+    const int maxValue[] = {23, 59, 31, 12, 2100};
+    const int minValue[] = {0, 0, 1, 1, 2020};
+    int sel = 0;
+    manualTimeHelper(display, manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4], sel);
+    LOG_T("hour=%d\n"
+          "minute=%d\n"
+          "day=%d\n"
+          "month=%d\n"
+          "year=%d\n"
+          "Selected=%d",
+          manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4], sel);
+    
+    // after a fast boot it runs on the UI task, which is already subscribed
+    bool subscribe = !useFastBoot;
+    if (subscribe)
+        subscribeToButtonEvents(setupTaskHandle);
+    while (sel < 5)
+    {
+        Button pressed = waitForButton(portMAX_DELAY);
+        switch (pressed)
+        {
+        case Button::Up:
+            if (manualTime[sel] < maxValue[sel])
+                manualTime[sel]++;
+            else
+                manualTime[sel] = minValue[sel];
+            LOG_T("Value=%d", manualTime[sel]);
+            break;
+        case Button::Down:
+            if (manualTime[sel] > minValue[sel])
+                manualTime[sel]--;
+            else
+                manualTime[sel] = maxValue[sel];
+            LOG_T("Value=%d", manualTime[sel]);
+            break;
+        case Button::Enter:
+            sel++;
+            LOG_T("Selected=%d", sel);
+            break;
+        default:
+            break;
+        }
+        manualTimeHelper(display, manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4], sel);
+    }
+    if (subscribe)
+        unsubscribeFromButtonEvents();
+
+    LOG_T("hour=%d\n"
+          "minute=%d\n"
+          "day=%d\n"
+          "month=%d\n"
+          "year=%d",
+          manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4]);
+    tm newTm;
+    newTm.tm_sec = 0;
+    newTm.tm_hour = manualTime[0];
+    newTm.tm_min = manualTime[1];
+    newTm.tm_mday = manualTime[2];
+    newTm.tm_mon = manualTime[3] - 1;
+    newTm.tm_year = manualTime[4] - 1900;
+    newTm.tm_isdst = -1; // let mktime decide if the DST is active at the respective time
+    time_t newTime = mktime(&newTm);
+    timeval newTv = {newTime, 0};
+    settimeofday(&newTv, nullptr);
+}
+
+
+/* Setup Helpers */
+
+esp_err_t setupGetInfoHandler(httpd_req_t *req)
+{
+    const char *infoString = R"==({"version": 1.0, "settings": ["wifi", "firebase", "timezone", "staticIP"]})==";
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, infoString, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+esp_err_t setupGetSettingsHandler(httpd_req_t *req)
+{
+    char response[512];
+    StaticJsonDocument<512> doc;
+    doc["ssid"] = settings.ssid;
+    doc["firebaseURL"] = settings.firebaseURL;
+    doc["timezone"] = settings.timezone;
+    // the static IP configuration is left out if DHCP is used
+    char staticIP[16], staticGateway[16], staticNetmask[16], staticDNS[16];
+    if (settings.staticIP)
+    {
+        ip4_addr_t address;
+        address.addr = settings.staticIP;
+        doc["staticIP"] = ip4addr_ntoa_r(&address, staticIP, sizeof(staticIP));
+        address.addr = settings.staticGateway;
+        doc["gateway"] = ip4addr_ntoa_r(&address, staticGateway, sizeof(staticGateway));
+        address.addr = settings.staticNetmask;
+        doc["netmask"] = ip4addr_ntoa_r(&address, staticNetmask, sizeof(staticNetmask));
+        address.addr = settings.staticDNS;
+        if (settings.staticDNS)
+            doc["dns"] = ip4addr_ntoa_r(&address, staticDNS, sizeof(staticDNS));
+    }
+    serializeJson(doc, response);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+esp_err_t setupPostSettingsHandler(httpd_req_t *req)
+{
+    char buffer[512];
+    if (req->content_len > sizeof(buffer) - 1)
+    {
+        LOG_E("content_len too large: %d", req->content_len);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Content-Length too large");
+        return ESP_FAIL;
+    }
+
+    int ret = httpd_req_recv(req, buffer, sizeof(buffer) - 1);
+    if (ret < 0)
+    {
+        LOG_E("Error httpd_req_recv: %d", ret);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error reading request");
+        return ESP_FAIL;
+    }
+    buffer[ret] = 0;
+
+    StaticJsonDocument<512> doc;
+    deserializeJson(doc, buffer);
+    const char *ssid = doc["ssid"];
+    const char *password = doc["password"];
+    const char *firebaseURL = doc["firebaseURL"];
+    const char *firebaseSecret = doc["firebaseSecret"];
+    const char *timezone = doc["timezone"];
+    if (!ssid || !password || !firebaseURL || !firebaseSecret || !timezone)
+    {
+        LOG_W("Not all settings are present");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not all settings are present");
+        return ESP_FAIL;
+    }
+
+    // the wifi profile is left empty, the first connection does a full scan
+    settings_t new_settings = {};
+    strncpy((char *) new_settings.ssid, ssid, 31);
+    strncpy((char *) new_settings.password, password, 63);
+    strncpy(new_settings.firebaseURL, firebaseURL, 63);
+    strncpy(new_settings.firebaseSecret, firebaseSecret, 40);
+    strncpy(new_settings.timezone, timezone, 63);
+
+    // the local API token is optional, without it the local API isn't started
+    const char *localApiToken = doc["localApiToken"];
+    if (localApiToken && *localApiToken)
+    {
+        size_t length = strlen(localApiToken);
+        if (length < localApiTokenMinLength || length >= sizeof(new_settings.localApiToken) || strcmp(localApiToken, firebaseSecret) == 0)
+        {
+            LOG_W("Invalid local API token");
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid local API token");
+            return ESP_FAIL;
+        }
+        strcpy(new_settings.localApiToken, localApiToken);
+    }
+
+    // the static IP configuration is optional, but if the address is present, the gateway and the netmask must be too
+    const char *staticIP = doc["staticIP"];
+    if (staticIP && *staticIP)
+    {
+        const char *gateway = doc["gateway"];
+        const char *netmask = doc["netmask"];
+        const char *dns = doc["dns"];
+        ip4_addr_t address, gatewayAddress, netmaskAddress, dnsAddress;
+        dnsAddress.addr = 0;
+        if (!gateway || !netmask
+            || !ip4addr_aton(staticIP, &address) || !ip4addr_aton(gateway, &gatewayAddress) || !ip4addr_aton(netmask, &netmaskAddress)
+            || (dns && *dns && !ip4addr_aton(dns, &dnsAddress)))
+        {
+            LOG_W("Invalid static IP configuration");
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid static IP configuration");
+            return ESP_FAIL;
+        }
+        new_settings.staticIP = address.addr;
+        new_settings.staticGateway = gatewayAddress.addr;
+        new_settings.staticNetmask = netmaskAddress.addr;
+        new_settings.staticDNS = dnsAddress.addr;
+    }
+
+    if (!saveSettings(new_settings))
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error saving settings");
+        return ESP_FAIL;
+    }
+
+    settings = new_settings;
+
+    simpleDisplay(display, setupReceivedSettingsString);
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+esp_err_t setupRestartHandler(httpd_req_t *req)
+{
+    simpleDisplay(display, setupRestartingString);
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    delay(3000);
+    esp_restart();
+}
+
+
+/* Local API */
+
+/* starts an HTTP server with a JSON API for clients on the same network, so they don't have to go through Firebase
+ * every request must have the header "Authorization: Bearer <local API token>", except the event stream,
+ * which can also be opened with a stream ticket, because browsers can't add headers to event streams
+ * the server is advertised with mDNS as mDNSHostname.local, and isn't started if no local API token was set in Setup
+ */
+void startLocalApi()
+{
+    LOG_T("Starting mDNS");
+    esp_err_t err = mdns_init();
+    if (err != ESP_OK)
+    {
+        LOG_E("Error starting mDNS");
+    }
+    else
+    {
+        LOG_D("Started mDNS");
+        mdns_hostname_set(mDNSHostname);
+        mdns_instance_name_set("Thermostat");
+        mdns_txt_item_t txt[] = { { (char *) "api", (char *) "/api" } };
+        mdns_service_add(nullptr, "_http", "_tcp", localApiPort, txt, 1);
+    }
+
+    if (!settings.localApiToken[0])
+    {
+        LOG_D("No local API token, the local API is off");
+        return;
+    }
+
+    LOG_T("Starting local API server");
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = localApiPort;
+    config.max_uri_handlers = 12;
+    // the event stream clients keep their sockets, the others are left for requests
+    config.max_open_sockets = EventStream::maxClients + localApiRequestSockets;
+    // the control tasks run on core 0, the server shouldn't delay them
+    config.core_id = 1;
+    err = httpd_start(&localApiServer, &config);
+    if (err != ESP_OK)
+    {
+        LOG_E("Error starting local API server: %d", err);
+        localApiServer = nullptr;
+        return;
+    }
+
+    httpd_register_uri_handler(localApiServer, &localApiGetStatusURI);
+    httpd_register_uri_handler(localApiServer, &localApiGetSetpointURI);
+    httpd_register_uri_handler(localApiServer, &localApiGetSchedulesURI);
+    httpd_register_uri_handler(localApiServer, &localApiGetTemporaryScheduleURI);
+    httpd_register_uri_handler(localApiServer, &localApiPutTemporaryScheduleURI);
+    httpd_register_uri_handler(localApiServer, &localApiDeleteTemporaryScheduleURI);
+    httpd_register_uri_handler(localApiServer, &localApiGetEventsURI);
+    httpd_register_uri_handler(localApiServer, &localApiPostEventsTicketURI);
+    httpd_register_uri_handler(localApiServer, &localApiGetMetricsURI);
+    LOG_D("Started local API server");
+}
+
+// checks the bearer token of the request, and if it's wrong, responds with 401
+bool localApiAuthorize(httpd_req_t *req)
+{
+    char token[sizeof(settings.localApiToken)] = "";
+    char header[sizeof("Bearer ") + sizeof(settings.localApiToken)];
+    if (httpd_req_get_hdr_value_str(req, "Authorization", header, sizeof(header)) == ESP_OK)
+    {
+        if (strncmp(header, "Bearer ", 7) == 0)
+            strncpy(token, header + 7, sizeof(token) - 1);
+    }
+
+    // compares all the characters, so the time doesn't depend on how much of the token is right
+    size_t length = strlen(settings.localApiToken);
+    uint8_t difference = strlen(token) != length;
+    for (size_t i = 0; i < length; i++)
+        difference |= token[i] ^ settings.localApiToken[i];
+    bool authorized = length > 0 && difference == 0;
+    if (!authorized)
+    {
+        LOG_W("Unauthorized request to %s", req->uri);
+        httpd_resp_set_status(req, "401 Unauthorized");
+        httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+        httpd_resp_send(req, "Unauthorized", HTTPD_RESP_USE_STRLEN);
+    }
+    return authorized;
+}
+
+esp_err_t localApiGetStatusHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+
+    uint8_t errors = getDisplayErrors();
+    float temperatureCopies[zoneCount];
+    int humidityCopies[zoneCount];
+    bool heaterStateCopies[zoneCount];
+    float setpointCopies[zoneCount];
+    const char *setpointSourceCopies[zoneCount];
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        temperatureCopies[i] = zones[i].temperature;
+        humidityCopies[i] = zones[i].humidity;
+    }
+    xSemaphoreGive(sensorValuesMutex);
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        heaterStateCopies[i] = zones[i].heaterState;
+        setpointCopies[i] = zones[i].activeSetpoint;
+        setpointSourceCopies[i] = zones[i].activeSetpointSource;
+    }
+    xSemaphoreGive(heaterStateMutex);
+
+    StaticJsonDocument<512 + 160 * zoneCount> doc;
+    doc["version"] = VERSION_STRING;
+    doc["uptime"] = esp_timer_get_time() / 1000000;
+    doc["time"] = time(nullptr);
+    JsonObject zonesObject = doc.createNestedObject("zones");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        // the first zone is also at the top level, where it was before there were zones
+        JsonObject targets[] = { zonesObject.createNestedObject(zones[i].config->name), doc.as<JsonObject>() };
+        for (size_t j = 0; j < (i == 0 ? 2u : 1u); j++)
+        {
+            JsonObject zoneObject = targets[j];
+            if (!isnan(temperatureCopies[i]))
+                zoneObject["temperature"] = temperatureCopies[i];
+            else
+                zoneObject["temperature"] = nullptr;
+            if (humidityCopies[i] != -1)
+                zoneObject["humidity"] = humidityCopies[i];
+            else
+                zoneObject["humidity"] = nullptr;
+            zoneObject["heater"] = heaterStateCopies[i];
+            if (!isnan(setpointCopies[i]))
+                zoneObject["setpoint"] = setpointCopies[i];
+            else
+                zoneObject["setpoint"] = nullptr;
+            zoneObject["setpointSource"] = setpointSourceCopies[i];
+        }
+    }
+    JsonObject errorsObject = doc.createNestedObject("errors");
+    errorsObject["wifi"] = (errors & DisplayErrorWifi) != 0;
+    errorsObject["ntp"] = (errors & DisplayErrorNTP) != 0;
+    errorsObject["firebase"] = (errors & DisplayErrorFirebase) != 0;
+    errorsObject["sensor"] = (errors & DisplayErrorSensor) != 0;
+
+    char response[512 + 160 * zoneCount];
+    serializeJson(doc, response);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+esp_err_t localApiGetSetpointHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+
+    zone_t *zone = localApiGetZone(req);
+    if (!zone)
+        return ESP_FAIL;
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    float setpointCopy = zone->activeSetpoint;
+    const char *setpointSourceCopy = zone->activeSetpointSource;
+    bool heaterStateCopy = zone->heaterState;
+    xSemaphoreGive(heaterStateMutex);
+
+    char response[100];
+    if (!isnan(setpointCopy))
+        snprintf(response, sizeof(response), R"==({"setpoint": %.1f, "source": "%s", "heater": %s})==",
+            setpointCopy, setpointSourceCopy, heaterStateCopy ? "true" : "false");
+    else
+        snprintf(response, sizeof(response), R"==({"setpoint": null, "source": "%s", "heater": %s})==",
+            setpointSourceCopy, heaterStateCopy ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// sends the schedules as they were downloaded from Firebase
+esp_err_t localApiGetSchedulesHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+
+    // the schedules are copied, so the mutex isn't held while sending them
+    xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
+    String schedules = scheduleString;
+    xSemaphoreGive(scheduleStringMutex);
+
+    httpd_resp_set_type(req, "application/json");
+    if (schedules.length() == 0)
+        httpd_resp_send(req, "null", HTTPD_RESP_USE_STRLEN);
+    else
+        httpd_resp_send(req, schedules.c_str(), schedules.length());
+    return ESP_OK;
+}
+
+esp_err_t localApiGetTemporaryScheduleHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+
+    zone_t *zone = localApiGetZone(req);
+    if (!zone)
+        return ESP_FAIL;
+    char response[100];
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    if (!zone->temporaryScheduleActive)
+        strcpy(response, R"==({"active": false})==");
+    else if (zone->temporaryScheduleEnd == -1)
+        snprintf(response, sizeof(response), R"==({"active": true, "temperature": %.1f, "remaining": -1})==", zone->temporaryScheduleTemp);
+    else
+        snprintf(response, sizeof(response), R"==({"active": true, "temperature": %.1f, "remaining": %lld})==",
+            zone->temporaryScheduleTemp, std::max<int64_t>(zone->temporaryScheduleEnd - millis(), 0));
+    xSemaphoreGive(temporaryScheduleMutex);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+/* sets the temporary schedule, like the menu does
+ * the body is {"temperature": 21.5, "duration": 90}, the duration is in minutes and if it's missing or -1, the schedule doesn't end
+ * like the other temporary schedule and setpoint requests, it is for the zone in the query parameter zone=<name>, or the first zone
+ */
+esp_err_t localApiPutTemporaryScheduleHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+    zone_t *zone = localApiGetZone(req);
+    if (!zone)
+        return ESP_FAIL;
+
+    char buffer[128];
+    if (req->content_len > sizeof(buffer) - 1)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content-Length too large");
+        return ESP_FAIL;
+    }
+    int ret = httpd_req_recv(req, buffer, sizeof(buffer) - 1);
+    if (ret < 0)
+    {
+        LOG_E("Error httpd_req_recv: %d", ret);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error reading request");
+        return ESP_FAIL;
+    }
+    buffer[ret] = 0;
+
+    StaticJsonDocument<128> doc;
+    if (deserializeJson(doc, buffer) || !doc["temperature"].is<float>())
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid temporary schedule");
+        return ESP_FAIL;
+    }
+    float temp = doc["temperature"];
+    int duration = doc["duration"] | -1;
+    // the same limits as in the menu
+    if (temp < 5.0f || temp > 35.0f || duration == 0 || duration < -1 || duration > 24 * 60)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Temperature or duration out of range");
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    zone->temporaryScheduleActive = true;
+    zone->temporaryScheduleTemp = temp;
+    zone->temporaryScheduleEnd = duration == -1 ? -1 : millis() + duration * 60 * 1000;
+    LOG_D("Saved temporary schedule of zone %s from local API", zone->config->name);
+    requestScheduleEvaluation(CauseTemporarySchedule, esp_timer_get_time());
+    requestTemporaryScheduleUpload();
+    xSemaphoreGive(temporaryScheduleMutex);
+
+    return localApiGetTemporaryScheduleHandler(req);
+}
+
+esp_err_t localApiDeleteTemporaryScheduleHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+    zone_t *zone = localApiGetZone(req);
+    if (!zone)
+        return ESP_FAIL;
+
+    xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
+    zone->temporaryScheduleActive = false;
+    LOG_D("Deleted temporary schedule of zone %s from local API", zone->config->name);
+    requestScheduleEvaluation(CauseTemporarySchedule, esp_timer_get_time());
+    requestTemporaryScheduleUpload();
+    xSemaphoreGive(temporaryScheduleMutex);
+
+    return localApiGetTemporaryScheduleHandler(req);
+}
+
+/* the zone named by the query parameter zone=<name>, the first zone if there is none
+ * if there is no zone with that name, responds with 404 and returns nullptr
+ */
+zone_t *localApiGetZone(httpd_req_t *req)
+{
+    char query[sizeof("zone=") + 32 + 64];
+    char name[32];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || httpd_query_key_value(query, "zone", name, sizeof(name)) != ESP_OK)
+    {
+        return &zones[0];
+    }
+    int zone = findZone(name);
+    if (zone == -1)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown zone");
+        return nullptr;
+    }
+    return &zones[zone];
+}
+
+/* live events for dashboards, as Server-Sent Events
+ * sensor: every change of the filtered sensor values, heater: every change of the heater state, errors: every change of the errors shown on the display,
+ * schedules: new schedules were downloaded from Firebase, setpoint: the setpoint or the schedule it comes from changed
+ * the sensor, heater and setpoint events have the name of their zone
+ */
+esp_err_t localApiGetEventsHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorizeStreamTicket(req) && !localApiAuthorize(req))
+        return ESP_OK;
+    return eventStream.handleRequest(req);
+}
+
+/* issues a stream ticket, which opens the event stream once with /api/events?ticket=<ticket> in the next streamTicketLifetime seconds
+ * there are as many tickets as event stream clients, the one that expires first is replaced
+ */
+esp_err_t localApiPostEventsTicketHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+
+    streamTicket_t *ticket = &streamTickets[0];
+    for (streamTicket_t &candidate : streamTickets)
+    {
+        if (candidate.expiry < ticket->expiry)
+            ticket = &candidate;
+    }
+    uint8_t bytes[(sizeof(ticket->value) - 1) / 2];
+    esp_fill_random(bytes, sizeof(bytes));
+    for (size_t i = 0; i < sizeof(bytes); i++)
+        sprintf(ticket->value + i * 2, "%02x", bytes[i]);
+    ticket->expiry = esp_timer_get_time() + (int64_t) streamTicketLifetime * 1000000;
+
+    char response[80];
+    snprintf(response, sizeof(response), R"==({"ticket": "%s", "expiresIn": %u})==", ticket->value, streamTicketLifetime);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// checks the ticket query parameter of a request to the event stream, a valid ticket is used up
+bool localApiAuthorizeStreamTicket(httpd_req_t *req)
+{
+    char query[sizeof("ticket=") + sizeof(streamTicket_t::value) + 32];
+    char value[sizeof(streamTicket_t::value)];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || httpd_query_key_value(query, "ticket", value, sizeof(value)) != ESP_OK
+        || strlen(value) != sizeof(value) - 1)
+    {
+        return false;
+    }
+
+    int64_t now = esp_timer_get_time();
+    for (streamTicket_t &ticket : streamTickets)
+    {
+        // compares all the characters, so the time doesn't depend on how much of the ticket is right
+        uint8_t difference = 0;
+        for (size_t i = 0; i < sizeof(value) - 1; i++)
+            difference |= value[i] ^ ticket.value[i];
+        if (difference == 0 && now < ticket.expiry)
+        {
+            ticket.expiry = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* metrics in the Prometheus text format
+ * the duty cycle of the heater is the rate of thermostat_heater_on_seconds_total
+ */
+esp_err_t localApiGetMetricsHandler(httpd_req_t *req)
+{
+    if (!localApiAuthorize(req))
+        return ESP_OK;
+
+    float temperatureCopies[zoneCount];
+    float trendCopies[zoneCount];
+    int humidityCopies[zoneCount];
+    uint8_t reachabilityCopies[zoneCount];
+    bool heaterStateCopies[zoneCount];
+    float setpointCopies[zoneCount];
+    int64_t heaterOnTimeCopies[zoneCount];
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        temperatureCopies[i] = zones[i].temperature;
+        trendCopies[i] = zones[i].temperatureTrend;
+        humidityCopies[i] = zones[i].humidity;
+        reachabilityCopies[i] = zones[i].reachability;
+    }
+    xSemaphoreGive(sensorValuesMutex);
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        heaterStateCopies[i] = zones[i].heaterState;
+        setpointCopies[i] = zones[i].activeSetpoint;
+        heaterOnTimeCopies[i] = zones[i].heaterOnTime + (zones[i].heaterState ? now - zones[i].heaterOnSince : 0);
+    }
+    xSemaphoreGive(heaterStateMutex);
+    xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+    bool wifiWorkingCopy = wifiWorking;
+    xSemaphoreGive(wifiWorkingMutex);
+
+    PrometheusWriter writer(req);
+    char labels[64];
+
+    writer.describe("thermostat_uptime_seconds", "gauge", "Time since boot");
+    writer.sample("thermostat_uptime_seconds", nullptr, now / 1e6);
+    writer.describe("thermostat_build_info", "gauge", "Firmware version");
+    snprintf(labels, sizeof(labels), "version=\"%s\"", VERSION_STRING);
+    writer.sample("thermostat_build_info", labels, (uint64_t) 1);
+
+    writer.describe("thermostat_first_control_decision_seconds", "gauge", "Time from boot until the heater was first controlled with both the temperature and the time known");
+    int32_t firstDecision = firstControlDecisionTime;
+    writer.sample("thermostat_first_control_decision_seconds", nullptr, firstDecision == -1 ? NAN : firstDecision / 1e3);
+
+    writer.describe("thermostat_clock_source", "gauge", "Where the time comes from: none, ntp, manual, rtcMemory or checkpoint");
+    snprintf(labels, sizeof(labels), "source=\"%s\"", wallClock.getSourceName());
+    writer.sample("thermostat_clock_source", labels, (uint64_t) 1);
+    writer.describe("thermostat_clock_uncertainty_seconds", "gauge", "How far the time may be from the real time");
+    uint32_t clockUncertainty = wallClock.getUncertainty();
+    writer.sample("thermostat_clock_uncertainty_seconds", nullptr, clockUncertainty == UINT32_MAX ? INFINITY : clockUncertainty / 1e3);
+    writer.describe("thermostat_clock_last_correction_seconds", "gauge", "Correction of a restored time by the first NTP sync after it");
+    int32_t clockCorrection;
+    bool hasCorrection = wallClock.getLastCorrection(clockCorrection);
+    writer.sample("thermostat_clock_last_correction_seconds", nullptr, hasCorrection ? clockCorrection / 1e3 : NAN);
+
+    // the metrics of the zones have the name of the zone as label
+    writer.describe("thermostat_temperature_celsius", "gauge", "Temperature in use, the filtered readings of the sensor");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_temperature_celsius", labels, (double) temperatureCopies[i]);
+    }
+    writer.describe("thermostat_temperature_trend_celsius_per_minute", "gauge", "Trend of the filtered temperature");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_temperature_trend_celsius_per_minute", labels, (double) trendCopies[i]);
+    }
+    writer.describe("thermostat_humidity_percent", "gauge", "Humidity in use, the filtered readings of the sensor");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_humidity_percent", labels, humidityCopies[i] == -1 ? NAN : (double) humidityCopies[i]);
+    }
+    writer.describe("thermostat_sensor_sample_interval_seconds", "gauge", "Time between the readings of the sensors, shorter when a temperature is close to its setpoint or changing");
+    writer.sample("thermostat_sensor_sample_interval_seconds", nullptr, sensorSampleInterval / 1e3);
+    writer.describe("thermostat_sensor_reachability_ratio", "gauge", "Fraction of the last 8 sensor readings that succeeded");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_sensor_reachability_ratio", labels, __builtin_popcount(reachabilityCopies[i]) / 8.0);
+    }
+
+    writer.describe("thermostat_setpoint_celsius", "gauge", "Temperature the heater is controlled to, NaN if no schedule is active");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_setpoint_celsius", labels, (double) setpointCopies[i]);
+    }
+    writer.describe("thermostat_heater_on", "gauge", "State of the heater");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_heater_on", labels, (uint64_t) heaterStateCopies[i]);
+    }
+    writer.describe("thermostat_heater_on_seconds_total", "counter", "Time the heater was on since boot");
+    for (size_t i = 0; i < zoneCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "zone=\"%s\"", zones[i].config->name);
+        writer.sample("thermostat_heater_on_seconds_total", labels, heaterOnTimeCopies[i] / 1e6);
+    }
+
+    writer.describe("thermostat_control_latency_seconds", "histogram", "Time from a cause until the signal was sent to the heater");
+    for (int cause = 0; cause < CauseCount; cause++)
+    {
+        snprintf(labels, sizeof(labels), "cause=\"%s\"", controlCauseNames[cause]);
+        writeLatencyHistogram(writer, "thermostat_control_latency_seconds", labels, controlLatencies[cause]);
+    }
+    writer.describe("thermostat_control_slo_violations_total", "counter", "Control latencies over their SLO");
+    for (int cause = 0; cause < CauseCount; cause++)
+    {
+        uint32_t buckets[LatencyHistogram::bucketCount];
+        uint64_t sum;
+        uint32_t violations;
+        controlLatencies[cause].getTotals(buckets, sum, violations);
+        snprintf(labels, sizeof(labels), "cause=\"%s\"", controlCauseNames[cause]);
+        writer.sample("thermostat_control_slo_violations_total", labels, (uint64_t) violations);
+    }
+
+    writer.describe("thermostat_wifi_connected", "gauge", "State of the Wifi connection");
+    writer.sample("thermostat_wifi_connected", nullptr, (uint64_t) wifiWorkingCopy);
+    writer.describe("thermostat_wifi_connect_duration_seconds", "histogram", "Time from the first connection attempt until the access point accepted us (association), and from then until we had an IP address (address)");
+    writeLatencyHistogram(writer, "thermostat_wifi_connect_duration_seconds", "phase=\"association\"", wifiAssociationLatencies);
+    writeLatencyHistogram(writer, "thermostat_wifi_connect_duration_seconds", "phase=\"address\"", wifiAddressLatencies);
+    writer.describe("thermostat_wifi_fast_path_fallbacks_total", "counter", "Connections that fell back to a full scan, because the cached access point couldn't be joined");
+    writer.sample("thermostat_wifi_fast_path_fallbacks_total", nullptr, (uint64_t) wifiFastPathFallbacks.load());
+    writer.describe("thermostat_firebase_error", "gauge", "Whether the last request to Firebase failed");
+    writer.sample("thermostat_firebase_error", nullptr, (uint64_t) firebaseClient.getError());
+    writer.describe("thermostat_firebase_stream_connects_total", "counter", "Connections of the Firebase stream, including reconnects and redirects");
+    writer.sample("thermostat_firebase_stream_connects_total", nullptr, (uint64_t) firebaseClient.getStreamConnects());
+    writer.describe("thermostat_firebase_request_duration_seconds", "histogram", "Duration of the requests to Firebase");
+    writeLatencyHistogram(writer, "thermostat_firebase_request_duration_seconds", nullptr, firebaseClient.getRequestLatencies());
+    writer.describe("thermostat_firebase_arena_peak_bytes", "gauge", "Most used from the preallocated buffers of the Firebase client");
+    writer.sample("thermostat_firebase_arena_peak_bytes", "arena=\"request\"", (uint64_t) firebaseClient.getRequestArenaPeak());
+    writer.sample("thermostat_firebase_arena_peak_bytes", "arena=\"stream\"", (uint64_t) firebaseClient.getStreamArenaPeak());
+
+    struct { uint32_t caps; const char *name; } heaps[] = {
+        { MALLOC_CAP_8BIT, "8bit" },
+        { MALLOC_CAP_INTERNAL, "internal" },
+        { MALLOC_CAP_DMA, "dma" }
+    };
+    writer.describe("thermostat_heap_free_bytes", "gauge", "Free heap");
+    for (auto &heap : heaps)
+    {
+        snprintf(labels, sizeof(labels), "caps=\"%s\"", heap.name);
+        writer.sample("thermostat_heap_free_bytes", labels, (uint64_t) heap_caps_get_free_size(heap.caps));
+    }
+    writer.describe("thermostat_heap_min_free_bytes", "gauge", "Minimum free heap since boot");
+    for (auto &heap : heaps)
+    {
+        snprintf(labels, sizeof(labels), "caps=\"%s\"", heap.name);
+        writer.sample("thermostat_heap_min_free_bytes", labels, (uint64_t) heap_caps_get_minimum_free_size(heap.caps));
+    }
+    writer.describe("thermostat_heap_largest_free_block_bytes", "gauge", "Largest free block of the heap, a measure of fragmentation");
+    for (auto &heap : heaps)
+    {
+        snprintf(labels, sizeof(labels), "caps=\"%s\"", heap.name);
+        writer.sample("thermostat_heap_largest_free_block_bytes", labels, (uint64_t) heap_caps_get_largest_free_block(heap.caps));
+    }
+    writer.describe("thermostat_tls_memory_bytes", "gauge", "Memory used by mbedTLS for each kind of connection");
+    for (size_t i = 0; i < (size_t) TlsConnection::Count; i++)
+    {
+        snprintf(labels, sizeof(labels), "connection=\"%s\"", tlsMemoryGetName((TlsConnection) i));
+        writer.sample("thermostat_tls_memory_bytes", labels, (uint64_t) tlsMemoryGetCurrent((TlsConnection) i));
+    }
+    writer.describe("thermostat_tls_memory_peak_bytes", "gauge", "Maximum memory used by mbedTLS for each kind of connection since boot");
+    for (size_t i = 0; i < (size_t) TlsConnection::Count; i++)
+    {
+        snprintf(labels, sizeof(labels), "connection=\"%s\"", tlsMemoryGetName((TlsConnection) i));
+        writer.sample("thermostat_tls_memory_peak_bytes", labels, (uint64_t) tlsMemoryGetPeak((TlsConnection) i));
+    }
+    writer.describe("thermostat_task_stack_free_bytes", "gauge", "Minimum free stack of a task since it was created");
+    TaskHandle_t task;
+    for (size_t i = 0; i < HealthMonitor::maxTasks; i++)
+    {
+        if (!(task = healthMonitor.getTask(i)))
+            continue;
+        snprintf(labels, sizeof(labels), "task=\"%s\"", pcTaskGetTaskName(task));
+        writer.sample("thermostat_task_stack_free_bytes", labels, (uint64_t) uxTaskGetStackHighWaterMark(task));
+    }
+
+    const char *otaStates[] = { "idle", "downloading", "succeeded", "failed" };
+    writer.describe("thermostat_update_state", "gauge", "State of the last firmware update");
+    snprintf(labels, sizeof(labels), "state=\"%s\"", otaStates[(int) otaUpdater.getState()]);
+    writer.sample("thermostat_update_state", labels, (uint64_t) 1);
+    const char *otaFormats[] = { "image", "compressed", "delta" };
+    writer.describe("thermostat_update_format", "gauge", "What the last update downloaded: the image, the compressed image or a patch");
+    snprintf(labels, sizeof(labels), "format=\"%s\"", otaFormats[(int) otaUpdater.getFormat()]);
+    writer.sample("thermostat_update_format", labels, (uint64_t) 1);
+    writer.describe("thermostat_update_written_bytes", "gauge", "Part of the firmware image of the last update written to flash");
+    writer.sample("thermostat_update_written_bytes", nullptr, (uint64_t) otaUpdater.getWritten());
+    writer.describe("thermostat_update_downloaded_bytes", "gauge", "Part of the download of the last update received");
+    writer.sample("thermostat_update_downloaded_bytes", nullptr, (uint64_t) otaUpdater.getReceived());
+    writer.describe("thermostat_update_size_bytes", "gauge", "Size of the download of the last update, 0 if it isn't known");
+    writer.sample("thermostat_update_size_bytes", nullptr, (uint64_t) otaUpdater.getTotal());
+    writer.describe("thermostat_update_throughput_bytes_per_second", "gauge", "Download rate of the last update, since its last connection");
+    writer.sample("thermostat_update_throughput_bytes_per_second", nullptr, (uint64_t) otaUpdater.getThroughput());
+    writer.describe("thermostat_update_resumes", "gauge", "Times the download of the last update was resumed after an interruption");
+    writer.sample("thermostat_update_resumes", nullptr, (uint64_t) otaUpdater.getResumes());
+    writer.describe("thermostat_update_last_check_timestamp_seconds", "gauge", "UNIX time of the last update check that got an answer, 0 if there was none");
+    writer.sample("thermostat_update_last_check_timestamp_seconds", nullptr, (uint64_t) std::max<int64_t>(updateCheck.lastCheck, 0));
+
+    writer.describe("thermostat_event_stream_clients", "gauge", "Clients connected to /api/events");
+    writer.sample("thermostat_event_stream_clients", nullptr, (uint64_t) eventStream.getClientCount());
+    writer.describe("thermostat_event_stream_dropped_clients_total", "counter", "Clients of /api/events disconnected because they were too slow");
+    writer.sample("thermostat_event_stream_dropped_clients_total", nullptr, (uint64_t) eventStream.getDroppedClients());
+
+    return writer.finish();
+}
+
+// writes the totals of a LatencyHistogram as a Prometheus histogram in seconds
+void writeLatencyHistogram(PrometheusWriter &writer, const char *name, const char *labels, LatencyHistogram &histogram)
+{
+    uint32_t buckets[LatencyHistogram::bucketCount];
+    uint64_t sum;
+    uint32_t violations;
+    histogram.getTotals(buckets, sum, violations);
+
+    char sampleName[64];
+    char bucketLabels[96];
+    const char *separator = labels ? "," : "";
+    if (!labels)
+        labels = "";
+    snprintf(sampleName, sizeof(sampleName), "%s_bucket", name);
+    uint64_t count = 0;
+    for (size_t i = 0; i < LatencyHistogram::bucketCount; i++)
+    {
+        // Prometheus buckets are cumulative
+        count += buckets[i];
+        uint32_t bound = LatencyHistogram::getBucketBound(i);
+        if (bound == UINT32_MAX)
+            snprintf(bucketLabels, sizeof(bucketLabels), "%s%sle=\"+Inf\"", labels, separator);
+        else
+            snprintf(bucketLabels, sizeof(bucketLabels), "%s%sle=\"%g\"", labels, separator, bound / 1000.0);
+        writer.sample(sampleName, bucketLabels, count);
+    }
+    snprintf(sampleName, sizeof(sampleName), "%s_sum", name);
+    writer.sample(sampleName, *labels ? labels : nullptr, sum / 1000.0);
+    snprintf(sampleName, sizeof(sampleName), "%s_count", name);
+    writer.sample(sampleName, *labels ? labels : nullptr, count);
+}
+
+// sends an event to the clients of the event stream, data is formatted like printf
+void publishEvent(const char *event, const char *format, ...)
+{
+    // there's no point in formatting the event if nobody listens
+    if (eventStream.getClientCount() == 0)
+        return;
+    char data[200];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(data, sizeof(data), format, args);
+    va_end(args);
+    eventStream.publish(event, data);
+}
+
+
+/* General purpose */
+
+// connects to wifi
+// if it can't connect in waitingTimeConnectWifi milliseconds, it aborts
+bool connectSTAMode()
+{
+    LOG_T("begin");
+    LOG_D("Trying to connect to Wifi");
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, nullptr));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, nullptr));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    if (settings.staticIP)
+    {
+        // no DHCP, so we have an address as soon as the access point accepts us
+        LOG_D("Using a static IP");
+        tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+        tcpip_adapter_ip_info_t ipInfo = {};
+        ipInfo.ip.addr = settings.staticIP;
+        ipInfo.gw.addr = settings.staticGateway;
+        ipInfo.netmask.addr = settings.staticNetmask;
+        tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &ipInfo);
+        tcpip_adapter_dns_info_t dnsInfo = {};
+        dnsInfo.ip.type = IPADDR_TYPE_V4;
+        dnsInfo.ip.u_addr.ip4.addr = settings.staticDNS ? settings.staticDNS : settings.staticGateway;
+        tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dnsInfo);
+    }
+
+    // the event handler isn't running yet, so the profile can be set from here
+    currentWifiProfile = settings.wifiProfile;
+    configureSTAMode(currentWifiProfile.channel != 0);
+    ESP_ERROR_CHECK(esp_wifi_start());
+
+    // wait for got ip event or timeout
+    bool success = false;
+    unsigned long lastMillis = millis();
+    while (true)
+    {
+        xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+        success = wifiWorking;
+        xSemaphoreGive(wifiWorkingMutex);
+        if (success || millis() - lastMillis > waitingTimeConnectWifi)
+            break;
+        delay(100);
+    }
+    
+    if (success)
+    {
+        LOG_D("Connected");
+        return true;
+    }
+    else
+    {
+        LOG_D("Failed to connect");
+        return false;
+    }
 }
 
-// helper function that displays the selected values on the screen
-void temporaryScheduleHelper(float temp, int duration, int option, int sel)
+/* sets the configuration used by the next connection attempt
+ * the fast path scans only the channel of currentWifiProfile and joins only its access point,
+ * otherwise all channels are scanned and the access point with the strongest signal is joined
+ */
+void configureSTAMode(bool fastPath)
 {
-    display.clearDisplay();
-    display.println(temporaryScheduleTitleString);
-    display.println();
-
-    if (sel == 0)
+    wifi_config_t wifi_config = {};
+    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    wifi_config.sta.pmf_cfg.capable = true;
+    wifi_config.sta.pmf_cfg.required = false;
+    strncpy((char *) wifi_config.sta.ssid, (const char *) settings.ssid, 31);
+    strncpy((char *) wifi_config.sta.password, (const char *) settings.password, 63);
+    if (fastPath)
     {
-        display.setTextColor(WHITE, BLACK);
+        wifi_config.sta.channel = currentWifiProfile.channel;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, currentWifiProfile.bssid, sizeof(wifi_config.sta.bssid));
     }
     else
     {
-        display.setTextColor(BLACK);
-    }
-    display.printf(temporaryScheduleTempFormatString, temp);
-    if (sel == 1)
-    {
-        display.setTextColor(WHITE, BLACK);
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
     }
-    else
+    wifiFastPath = fastPath;
+    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+}
+
+void subscribeToButtonEvents(TaskHandle_t taskHandle)
+{
+    // the interrupts are detached and the timers stopped, so nothing writes to the queue
+    // we drop the edges the previous subscriber didn't read
+    for (uint32_t i = 0; i < buttonQueueSize; i++)
     {
-        display.setTextColor(BLACK);
+        buttonQueue[i].sequence.store(i, std::memory_order_relaxed);
     }
-    if (duration == -1)
+    buttonQueueHead.store(0, std::memory_order_relaxed);
+    buttonQueueTail = 0;
+    for (buttonInput_t &input : buttonInputs)
     {
-        int ptDuration;
-        xSemaphoreTake(temporaryScheduleMutex, portMAX_DELAY);
-        if (temporaryScheduleEnd == -1)
-            ptDuration = -1;
-        else
-        {
-            ptDuration = (temporaryScheduleEnd - millis()) / 1000 / 60;
-        }
-        xSemaphoreGive(temporaryScheduleMutex);
-        if (ptDuration == -1)
-        {
-            display.print(temporaryScheduleDurationInfiniteString);
-        }
-        else if (ptDuration < 60)
+        input.acceptedEdge.store(((uint32_t) esp_timer_get_time() & ~1u) | digitalRead(input.pin), std::memory_order_release);
+        if (!input.debounceTimer)
         {
-            display.printf(temporaryScheduleDuration1FormatString, ptDuration);
+            esp_timer_create_args_t timerArgs = {};
+            timerArgs.callback = buttonDebounceTimerCallback;
+            timerArgs.arg = &input;
+            timerArgs.name = "buttonDebounce";
+            ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &input.debounceTimer));
         }
-        else
-        {
-            display.printf(temporaryScheduleDuration2FormatString, ((float)ptDuration) / 60);
-        }
-    }
-    else if (duration < 60)
-    {
-        display.printf(temporaryScheduleDuration1FormatString, duration);
-    }
-    else
-    {
-        if (duration == 24 * 60 + 30)
-            display.print(temporaryScheduleDurationInfiniteString);
-        else
-            display.printf(temporaryScheduleDuration2FormatString, ((float)duration) / 60);
     }
-    if (sel == 2)
+    for (buttonState_t &state : buttonStates)
     {
-        if (option == 0)
-        {
-            display.setTextColor(WHITE, BLACK);
-        }
-        else
-        {
-            display.setTextColor(BLACK);
-        }
-        display.print(temporaryScheduleOkString);
-        display.setTextColor(BLACK);
-        display.write(' ');
-        if (option == 1)
-        {
-            display.setTextColor(WHITE, BLACK);
-        }
-        else
-        {
-            display.setTextColor(BLACK);
-        }
-        display.print(temporaryScheduleCancelString);
-        display.setTextColor(BLACK);
-        display.write(' ');
-        if (option == 2)
-        {
-            display.setTextColor(WHITE, BLACK);
-        }
-        else
-        {
-            display.setTextColor(BLACK);
-        }
-        display.println(temporaryScheduleDeleteString);
+        // a button held while subscribing is not a press
+        state = {};
     }
-    else
+    buttonSubscribedTaskHandle = taskHandle;
+    for (buttonInput_t &input : buttonInputs)
     {
-        display.setTextColor(BLACK);
-        display.print(temporaryScheduleOkString);
-        display.write(' ');
-        display.print(temporaryScheduleCancelString);
-        display.write(' ');
-        display.println(temporaryScheduleDeleteString);
+        attachInterruptArg(input.pin, buttonISR, &input, CHANGE);
     }
-    display.setTextColor(BLACK);
-    display.display();
 }
 
-
-/* Display helpers */
-
-void updateDisplay()
+void unsubscribeFromButtonEvents()
 {
-    display.clearDisplay();
-    time_t now;
-    tm tmnow;
-    time(&now);
-    localtime_r(&now, &tmnow);
-    displayDate(tmnow.tm_mday, tmnow.tm_mon + 1, tmnow.tm_year + 1900, tmnow.tm_wday, 3, 32);
-    displayClock(tmnow.tm_hour, tmnow.tm_min, 42, 20);
-    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
-    displayTemp(temperature, 48, 32);
-    displayHumidity(humidity, 3, 18);
-    xSemaphoreGive(sensorValuesMutex);
-    displayFlame(flame, 75, 0, 8, 12); // the last two arguments are the width and the height of the flame icon
-    displayErrors(0, 0);
-    display.display();
+    for (buttonInput_t &input : buttonInputs)
+    {
+        detachInterrupt(input.pin);
+        // fails harmlessly if the timer isn't running
+        esp_timer_stop(input.debounceTimer);
+    }
+    buttonSubscribedTaskHandle = nullptr;
 }
 
-// cursorX and cursorY are the location of the top left corner
-void displayErrors(int cursorX, int cursorY)
+// waits for a button press or auto-repeat, the current task must be subscribed to button events
+// returns Button::None if nothing was pressed in timeout ticks
+Button waitForButton(TickType_t timeout)
 {
-    display.setCursor(cursorX, cursorY);
-    xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
-    bool wifiWorkingCopy = wifiWorking;
-    xSemaphoreGive(wifiWorkingMutex);
-    if (!wifiWorkingCopy)
+    TickType_t start = xTaskGetTickCount();
+    while (true)
     {
-        // error with wifi, no need to check if firebase and ntp work because they don't
-        // also no need to display ntp and firebase errors, just wifi error
-        display.print(displayErrorWifiString);
-        display.write(' ');
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        TickType_t remaining = timeout;
+        if (timeout != portMAX_DELAY)
+            remaining = elapsed >= timeout ? 0 : timeout - elapsed;
+        buttonEvent_t event;
+        if (!waitForButtonEvent(event, remaining))
+            return Button::None;
+        if (event.type != ButtonEventType::LongPress)
+            return event.button;
     }
-    else
+}
+
+/* waits for the next button event, the current task must be subscribed to button events
+ * it turns the edges from the button queue into presses, and generates the long press and repeat events of held buttons
+ * other notifications are left for the task to handle later
+ * returns false if there was no event in timeout ticks
+ */
+bool waitForButtonEvent(buttonEvent_t &event, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true)
     {
-        if ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0)
+        buttonEdge_t edge;
+        while (popButtonEdge(edge))
         {
-            display.print(displayErrorNTPString);
-            display.write(' ');
+            buttonState_t &state = buttonStates[(int) edge.button - 1];
+            // a producer that was interrupted between accepting an edge and publishing it can publish it after a newer one
+            if (edge.time <= state.lastEdgeTime)
+                continue;
+            state.lastEdgeTime = edge.time;
+            if (edge.pressed == state.held)
+                continue;
+            state.held = edge.pressed;
+            if (edge.pressed)
+            {
+                state.longPressSent = false;
+                state.nextEventTime = edge.time + buttonLongPressTime * 1000;
+                state.repeatInterval = buttonRepeatStartInterval;
+                event = { edge.button, ButtonEventType::Press, edge.time };
+                return true;
+            }
         }
 
-        if (firebaseClient.getError())
+        int64_t now = esp_timer_get_time();
+        int64_t nextEventTime = INT64_MAX;
+        for (const buttonInput_t &input : buttonInputs)
         {
-            display.print(displayErrorFirebaseString);
-            display.write(' ');
+            buttonState_t &state = buttonStates[(int) input.button - 1];
+            if (!state.held)
+                continue;
+            // the release can be lost if the button bounced during the debounce time
+            if (!digitalRead(input.pin))
+            {
+                state.held = false;
+                continue;
+            }
+            if (now >= state.nextEventTime)
+            {
+                if (!state.longPressSent)
+                {
+                    state.longPressSent = true;
+                    event = { input.button, ButtonEventType::LongPress, now };
+                }
+                else
+                {
+                    event = { input.button, ButtonEventType::Repeat, now };
+                    // every repeat comes faster than the previous one
+                    state.repeatInterval = std::max<uint32_t>(state.repeatInterval * 3 / 4, buttonRepeatMinInterval);
+                }
+                if (input.button == Button::Enter)
+                    state.nextEventTime = INT64_MAX;
+                else
+                    state.nextEventTime = now + state.repeatInterval * 1000;
+                return true;
+            }
+            nextEventTime = std::min(nextEventTime, state.nextEventTime);
         }
-    }
 
-    if (dhtReachability == 0)
-    {
-        display.print(displayErrorSensorString);
-        display.write(' ');
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        TickType_t waitTicks = portMAX_DELAY;
+        if (timeout != portMAX_DELAY)
+        {
+            if (elapsed >= timeout)
+                return false;
+            waitTicks = timeout - elapsed;
+        }
+        if (nextEventTime != INT64_MAX)
+        {
+            TickType_t ticksUntilEvent = pdMS_TO_TICKS((nextEventTime - now) / 1000) + 1;
+            if (ticksUntilEvent < waitTicks)
+                waitTicks = ticksUntilEvent;
+        }
+        xTaskNotifyWait(
+            0,
+            notificationButtonEvent,
+            nullptr,
+            waitTicks);
     }
 }
 
-// cursorX and cursorY are the location of the top left corner
-void displayHumidity(int hum, int cursorX, int cursorY)
+// returns the ticks until waitForButtonEvent has to generate the next long press or repeat event
+// or portMAX_DELAY if no button is held
+TickType_t ticksUntilNextButtonEvent()
 {
-    display.setCursor(cursorX, cursorY);
-    display.setFont();
-    display.setTextSize(1);
-    if (hum == -1)
-    {
-        display.print(displayHumidityNotAvailableString);
-        return;
-    }
-    display.printf(displayHumidityFormatString, hum);
+    int64_t nextEventTime = INT64_MAX;
+    for (const buttonState_t &state : buttonStates)
+    {
+        if (state.held)
+            nextEventTime = std::min(nextEventTime, state.nextEventTime);
+    }
+    if (nextEventTime == INT64_MAX)
+        return portMAX_DELAY;
+    int64_t now = esp_timer_get_time();
+    if (nextEventTime <= now)
+        return 0;
+    return pdMS_TO_TICKS((nextEventTime - now) / 1000) + 1;
 }
 
-// cursorX and cursorY are the location of the top left corner
-// only displays the flame if the heater is on
-void displayFlame(const uint8_t *flameBitmap, int cursorX, int cursorY, int width, int height)
+// removes the oldest edge from the button queue, returns false if it is empty
+bool popButtonEdge(buttonEdge_t &edge)
 {
-    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
-    if (heaterState)
-        display.drawBitmap(cursorX, cursorY, flameBitmap, width, height, BLACK);
-    xSemaphoreGive(heaterStateMutex);
+    buttonQueueSlot_t &slot = buttonQueue[buttonQueueTail % buttonQueueSize];
+    // the slot is published when its sequence is one after its position
+    if (slot.sequence.load(std::memory_order_acquire) != buttonQueueTail + 1)
+        return false;
+    edge = slot.edge;
+    // frees the slot for the producers of the next lap
+    slot.sequence.store(buttonQueueTail + buttonQueueSize, std::memory_order_release);
+    buttonQueueTail++;
+    return true;
 }
 
-// cursorX and cursorY are the location of the top left corner
-// sunday is wDay 0
-void displayDate(int day, int mth, int year, int wDay, int cursorX, int cursorY)
+/* makes the schedules be evaluated again, because something they depend on changed
+ * causeTime is when the change happened (us, from esp_timer_get_time), the time until the signal is sent to the heater is measured from it
+ */
+void requestScheduleEvaluation(ControlCause cause, int64_t causeTime)
 {
-    display.setCursor(cursorX, cursorY);
-    display.setFont();
-    display.setTextSize(1);
-    display.printf(displayDateLine1FormatString, displayShortWeekdayStrings[wDay], day);
-    display.setCursor(cursorX, display.getCursorY());
-    display.printf(displayDateLine2FormatString, mth, year);
+    xSemaphoreTake(pendingControlCausesMutex, portMAX_DELAY);
+    // if the cause is already pending, the older one is kept
+    if (!pendingControlCauses[cause])
+        pendingControlCauses[cause] = causeTime;
+    xSemaphoreGive(pendingControlCausesMutex);
+    notifyScheduleEvaluation();
 }
 
-// cursorX and cursorY are the location of the middle left point
-// it uses the DSEG7 Classic Bold font
-void displayClock(int hour, int min, int cursorX, int cursorY)
+// makes the schedules be evaluated, without a cause whose latency is measured
+void notifyScheduleEvaluation()
 {
-    display.setCursor(cursorX, cursorY);
-    display.setFont(&DSEG7Classic_Bold6pt7b);
-    display.setTextSize(1);
-    display.printf(displayClockFormatString, hour, min);
+    if (useCooperativeExecutor)
+        controlExecutor.notify(evaluateSchedulesJobId);
+    else
+        xTaskNotifyGive(evaluateSchedulesTaskHandle);
 }
 
-// cursorX and cursorY are the location of the top left corner
-// needs at least 2 free pixels above(for the degree symbol and C)
-void displayTemp(float temp, int cursorX, int cursorY)
+// makes the Firebase loop upload the current temporary schedule
+void requestTemporaryScheduleUpload()
 {
-    display.setFont();
-    if (isnan(temp))
-    {
-        display.setCursor(cursorX, cursorY);
-        display.setTextSize(2);
-        display.write('N');
-        display.setTextSize(1, 2);
-        display.write('/');
-        display.setTextSize(2);
-        display.write('A');
-        return;
-    }
-    display.setCursor(cursorX, cursorY);
-    display.setTextSize(2);
-    display.print((int)temp);
-    display.setTextSize(1);
-    int x = display.getCursorX() - 1;
-    int y = display.getCursorY();
-    display.setCursor(x, y - 2);
-    display.printf("%c%c", char(247), displayTempLetter); // char(247) is the degree symbol °
-    display.setCursor(x, y + 7);
-    float decimals = temp - floorf(temp);
-    decimals *= 10;
-    display.printf(".%d", (int)(decimals + 0.5f));
+    xTaskNotifyGive(firebaseTaskHandle);
 }
 
-
-/* Manual Time */
-
-// prompts the user to enter the current date and time
-void manualTimeSetup()
+// wakes up the UI task to redraw the parts of the main screen that changed
+void requestDisplayUpdate()
 {
-    LOG_T("begin");
-    int manualTime[] = {0, 0, 1, 1, 2020}; // int h=0, m=0, d=1, mth=1, y=2020;
-    const int maxValue[] = {23, 59, 31, 12, 2100};
-    const int minValue[] = {0, 0, 1, 1, 2020};
-    int sel = 0;
-    manualTimeHelper(manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4], sel);
-    LOG_T("hour=%d\n"
-          "minute=%d\n"
-          "day=%d\n"
-          "month=%d\n"
-          "year=%d\n"
-          "Selected=%d",
-          manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4], sel);
-    
-    subscribeToButtonEvents(setupTaskHandle);
-    while (sel < 5)
-    {
-        uint32_t notificationValue;
-        xTaskNotifyWait(
-            pdFALSE,
-            ULONG_MAX,
-            &notificationValue,
-            portMAX_DELAY);
-        Button pressed = static_cast<Button>(notificationValue);
-        switch (pressed)
-        {
-        case Button::Up:
-            if (manualTime[sel] < maxValue[sel])
-                manualTime[sel]++;
-            else
-                manualTime[sel] = minValue[sel];
-            LOG_T("Value=%d", manualTime[sel]);
-            break;
-        case Button::Down:
-            if (manualTime[sel] > minValue[sel])
-                manualTime[sel]--;
-            else
-                manualTime[sel] = maxValue[sel];
-            LOG_T("Value=%d", manualTime[sel]);
-            break;
-        case Button::Enter:
-            sel++;
-            LOG_T("Selected=%d", sel);
-            break;
-        default:
-            break;
-        }
-        manualTimeHelper(manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4], sel);
-    }
-    unsubscribeFromButtonEvents();
-
-    LOG_T("hour=%d\n"
-          "minute=%d\n"
-          "day=%d\n"
-          "month=%d\n"
-          "year=%d",
-          manualTime[0], manualTime[1], manualTime[2], manualTime[3], manualTime[4]);
-    tm newTm;
-    newTm.tm_sec = 0;
-    newTm.tm_hour = manualTime[0];
-    newTm.tm_min = manualTime[1];
-    newTm.tm_mday = manualTime[2];
-    newTm.tm_mon = manualTime[3] - 1;
-    newTm.tm_year = manualTime[4] - 1900;
-    newTm.tm_isdst = -1; // let mktime decide if the DST is active at the respective time
-    time_t newTime = mktime(&newTm);
-    timeval newTv = {newTime, 0};
-    settimeofday(&newTv, nullptr);
+    if (uiTaskHandle)
+        xTaskNotify(uiTaskHandle, notificationDisplayUpdate, eSetBits);
 }
 
-// helper function that displays the current selected date and time in manual time mode
-void manualTimeHelper(int h, int m, int d, int mth, int y, int sel)
+// the latencies of the causes are recorded by the caller, after the signals of all the zones are sent
+void sendSignalToHeater(zone_t &zone, bool signal)
 {
-    display.clearDisplay();
-    display.setTextSize(1);
-    display.setTextColor(BLACK);
-    display.setCursor(10, 0);
-    display.println(manualTimeTitleString);
-
-    display.setCursor(27, 15);
-    if (sel == 0)
-    {
-        display.setTextColor(WHITE, BLACK);
-        display.printf(manualTimeFormatString, h);
-        display.setTextColor(BLACK);
-    }
-    else
-    {
-        display.setTextColor(BLACK);
-        display.printf(manualTimeFormatString, h);
-    }
-    display.print(':');
-    if (sel == 1)
+    LOG_D("Sending signal to heater of zone %s: %s", zone.config->name, signal ? "on" : "off");
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    bool changed = zone.heaterState != signal;
+    if (changed)
     {
-        display.setTextColor(WHITE, BLACK);
-        display.printf(manualTimeFormatString, m);
-        display.setTextColor(BLACK);
+        int64_t now = esp_timer_get_time();
+        if (signal)
+            zone.heaterOnSince = now;
+        else
+            zone.heaterOnTime += now - zone.heaterOnSince;
     }
-    else
+    zone.heaterState = signal;
+    xSemaphoreGive(heaterStateMutex);
+    digitalWrite(zone.config->pinRelay, signal);
+    if (changed)
     {
-        display.setTextColor(BLACK);
-        display.printf(manualTimeFormatString, m);
+        publishEvent("heater", R"==({"zone": "%s", "heater": %s})==", zone.config->name, signal ? "true" : "false");
+        requestDisplayUpdate();
     }
+}
 
-    display.setCursor(14, 30);
-    if (sel == 2)
-    {
-        display.setTextColor(WHITE, BLACK);
-        display.printf(manualTimeFormatString, d);
-        display.setTextColor(BLACK);
-    }
-    else
-    {
-        display.setTextColor(BLACK);
-        display.printf(manualTimeFormatString, d);
-    }
-    display.print('.');
-    if (sel == 3)
-    {
-        display.setTextColor(WHITE, BLACK);
-        display.printf(manualTimeFormatString, mth);
-        display.setTextColor(BLACK);
-    }
-    else
-    {
-        display.setTextColor(BLACK);
-        display.printf(manualTimeFormatString, mth);
-    }
-    display.print('.');
-    if (sel == 4)
-    {
-        display.setTextColor(WHITE, BLACK);
-        display.println(y);
-        display.setTextColor(BLACK);
-    }
-    else
+void setActiveSetpoint(zone_t &zone, float setpoint, const char *source)
+{
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    bool changed = source != zone.activeSetpointSource
+        || !(setpoint == zone.activeSetpoint || (isnan(setpoint) && isnan(zone.activeSetpoint)));
+    zone.activeSetpoint = setpoint;
+    zone.activeSetpointSource = source;
+    xSemaphoreGive(heaterStateMutex);
+    if (changed)
     {
-        display.setTextColor(BLACK);
-        display.println(y);
+        if (isnan(setpoint))
+            publishEvent("setpoint", R"==({"zone": "%s", "setpoint": null, "source": "%s"})==", zone.config->name, source);
+        else
+            publishEvent("setpoint", R"==({"zone": "%s", "setpoint": %.1f, "source": "%s"})==", zone.config->name, setpoint, source);
     }
-
-    display.display();
 }
 
+/* writes the state of every zone to buffer, as a JSON object with the names of the zones as keys
+ * returns the length of the string, like snprintf
+ */
+int zonesToJson(char *buffer, size_t size)
+{
+    xSemaphoreTake(sensorValuesMutex, portMAX_DELAY);
+    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
+    int length = snprintf(buffer, size, "{");
+    for (size_t i = 0; i < zoneCount && length < (int) size; i++)
+    {
+        const zone_t &zone = zones[i];
+        char temperatureString[12] = "null";
+        char trendString[12] = "null";
+        char setpointString[12] = "null";
+        if (!isnan(zone.temperature))
+            snprintf(temperatureString, sizeof(temperatureString), "%.1f", zone.temperature);
+        if (!isnan(zone.temperatureTrend))
+            snprintf(trendString, sizeof(trendString), "%.2f", zone.temperatureTrend);
+        if (!isnan(zone.activeSetpoint))
+            snprintf(setpointString, sizeof(setpointString), "%.1f", zone.activeSetpoint);
+        length += snprintf(buffer + length, size - length,
+            R"==(%s"%s": {"temperature": %s, "trend": %s, "humidity": %d, "state": %s, "setpoint": %s, "source": "%s"})==",
+            i ? ", " : "", zone.config->name, temperatureString, trendString, zone.humidity, zone.heaterState ? "true" : "false",
+            setpointString, zone.activeSetpointSource);
+    }
+    if (length < (int) size)
+        length += snprintf(buffer + length, size - length, "}");
+    xSemaphoreGive(sensorValuesMutex);
+    xSemaphoreGive(heaterStateMutex);
+    return length;
+}
 
-/* Setup Helpers */
+// returns the index in zones of the zone with this name, -1 if there is none
+int findZone(const char *name)
+{
+    for (size_t i = 0; i < zoneCount; i++)
+        if (strcmp(zoneConfigs[i].name, name) == 0)
+            return i;
+    return -1;
+}
 
-void setupDisplayInfo()
+// moves the pending causes to the ones handled by the current evaluation of the schedules
+void claimControlCauses()
 {
-    LOG_T("begin");
-    display.clearDisplay();
-    display.setTextSize(1);
-    display.setCursor(0, 0);
-    display.setTextColor(BLACK);
-    display.println(setupSSIDPassString);
-    display.println(setupAPSSID);
-    display.println(setupAPPassword);
-    display.println();
-    display.println(setupIPString);
-    display.println("192.168.4.1");
-    display.display();
+    xSemaphoreTake(pendingControlCausesMutex, portMAX_DELAY);
+    for (int cause = 0; cause < CauseCount; cause++)
+    {
+        // a cause claimed by an evaluation that didn't send a signal is older, so it is kept
+        if (pendingControlCauses[cause] && !claimedControlCauses[cause])
+            claimedControlCauses[cause] = pendingControlCauses[cause];
+        pendingControlCauses[cause] = 0;
+    }
+    xSemaphoreGive(pendingControlCausesMutex);
 }
 
-esp_err_t setupGetInfoHandler(httpd_req_t *req)
+/* schedules start and end only at whole minutes, so if the schedule in effect for a zone changed while the schedules and the temporary schedules didn't,
+ * a schedule boundary was crossed at the first minute after the previous evaluation
+ * activeScheduleChanged tells if the schedule in effect changed for any zone since the previous evaluation
+ */
+void claimScheduleBoundary(bool activeScheduleChanged)
 {
-    const char *infoString = R"==({"version": 1.0, "settings": ["wifi", "firebase", "timezone"]})==";
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, infoString, HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
+    static int64_t lastEvaluationTime = 0;  // (us) wall clock time
+
+    timeval now;
+    gettimeofday(&now, nullptr);
+    int64_t nowTime = now.tv_sec * 1000000LL + now.tv_usec;
+    if (activeScheduleChanged && lastEvaluationTime
+        && !claimedControlCauses[CauseScheduleChange]
+        && !claimedControlCauses[CauseTemporarySchedule]
+        && !claimedControlCauses[CauseScheduleBoundary])
+    {
+        int64_t boundaryTime = std::min(nowTime, (lastEvaluationTime / 60000000 + 1) * 60000000);
+        claimedControlCauses[CauseScheduleBoundary] = esp_timer_get_time() - (nowTime - boundaryTime);
+    }
+    lastEvaluationTime = nowTime;
 }
 
-esp_err_t setupGetSettingsHandler(httpd_req_t *req)
+// records the time from each claimed cause until the signal was sent to the heater
+void recordControlLatencies(int64_t signalTime)
 {
-    char response[512];
-    StaticJsonDocument<512> doc;
-    doc["ssid"] = settings.ssid;
-    doc["firebaseURL"] = settings.firebaseURL;
-    doc["timezone"] = settings.timezone;
-    serializeJson(doc, response);
+    for (int cause = 0; cause < CauseCount; cause++)
+    {
+        if (claimedControlCauses[cause])
+        {
+            controlLatencies[cause].record((signalTime - claimedControlCauses[cause]) / 1000);
+            claimedControlCauses[cause] = 0;
+        }
+    }
+}
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
+/* writes the latency histogram of each cause as a JSON object to buffer, and clears them
+ * returns the length of the string, like snprintf
+ */
+int controlLatenciesToJson(char *buffer, size_t size)
+{
+    int length = snprintf(buffer, size, "{");
+    for (int cause = 0; cause < CauseCount && length < (int) size; cause++)
+    {
+        length += snprintf(buffer + length, size - length, R"==(%s"%s": )==", cause ? ", " : "", controlCauseNames[cause]);
+        if (length < (int) size)
+            length += controlLatencies[cause].toJson(buffer + length, size - length);
+    }
+    if (length < (int) size)
+        length += snprintf(buffer + length, size - length, "}");
+    return length;
 }
 
-esp_err_t setupPostSettingsHandler(httpd_req_t *req)
+bool loadSettings()
 {
-    char buffer[512];
-    if (req->content_len > sizeof(buffer) - 1)
+    settings = {};
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open("settings", NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
     {
-        LOG_E("content_len too large: %d", req->content_len);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Content-Length too large");
-        return ESP_FAIL;
+        LOG_E("Error nvs_open: %d", err);
+        return false;
     }
 
-    int ret = httpd_req_recv(req, buffer, sizeof(buffer) - 1);
-    if (ret < 0)
+    // a blob saved by an older firmware is shorter, the fields it doesn't have stay zero
+    size_t size = sizeof(settings);
+    err = nvs_get_blob(nvs_handle, "settings", &settings, &size);
+    nvs_close(nvs_handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
     {
-        LOG_E("Error httpd_req_recv: %d", ret);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error reading request");
-        return ESP_FAIL;
+        LOG_D("Settings not found");
+        return false;
     }
-    buffer[ret] = 0;
-
-    StaticJsonDocument<512> doc;
-    deserializeJson(doc, buffer);
-    const char *ssid = doc["ssid"];
-    const char *password = doc["password"];
-    const char *firebaseURL = doc["firebaseURL"];
-    const char *firebaseSecret = doc["firebaseSecret"];
-    const char *timezone = doc["timezone"];
-    if (!ssid || !password || !firebaseURL || !firebaseSecret || !timezone)
+    else if (err != ESP_OK)
     {
-        LOG_W("Not all settings are present");
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not all settings are present");
-        return ESP_FAIL;
+        LOG_E("Error nvs_get_blob: %d", err);
+        return false;
     }
+    LOG_D("Loaded settings");
+    return true;
+}
 
-    settings_t new_settings = {};
-    strncpy((char *) new_settings.ssid, ssid, 31);
-    strncpy((char *) new_settings.password, password, 63);
-    strncpy(new_settings.firebaseURL, firebaseURL, 63);
-    strncpy(new_settings.firebaseSecret, firebaseSecret, 40);
-    strncpy(new_settings.timezone, timezone, 63);
-
+bool saveSettings(const settings_t &newSettings)
+{
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open("settings", NVS_READWRITE, &nvs_handle);
     if (err != ESP_OK)
     {
         LOG_E("Error nvs_open: %d", err);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error saving settings");
-        return ESP_FAIL;
+        return false;
     }
     
-    err = nvs_set_blob(nvs_handle, "settings", &new_settings, sizeof(new_settings));
+    err = nvs_set_blob(nvs_handle, "settings", &newSettings, sizeof(newSettings));
     if (err != ESP_OK)
     {
         nvs_close(nvs_handle);
         LOG_E("Error nvs_set_blob: %d", err);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error saving settings");
-        return ESP_FAIL;
+        return false;
     }
     err = nvs_commit(nvs_handle);
     nvs_close(nvs_handle);
     if (err != ESP_OK)
     {
         LOG_E("Error nvs_commit: %d", err);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error saving settings");
-        return ESP_FAIL;
+        return false;
     }
-
-    settings = new_settings;
-
-    simpleDisplay(setupReceivedSettingsString);
-    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
-}
-
-esp_err_t setupRestartHandler(httpd_req_t *req)
-{
-    simpleDisplay(setupRestartingString);
-    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
-    delay(3000);
-    esp_restart();
-}
-
-
-/* General purpose */
-
-// helper function that clears the display and prints the String parameter in the top left corner
-void simpleDisplay(const char *str)
-{
-    display.clearDisplay();
-    display.setTextColor(BLACK);
-    display.setCursor(0, 0);
-    display.println(str);
-    display.display();
+    return true;
 }
 
-// connects to wifi
-// if it can't connect in waitingTimeConnectWifi milliseconds, it aborts
-bool connectSTAMode()
+// loads the schedules saved by saveSchedules() into scheduleString, if there are any
+void loadSchedules()
 {
-    LOG_T("begin");
-    LOG_D("Trying to connect to Wifi");
-
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, nullptr));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, nullptr));
-    wifi_config_t wifi_config = {};
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-    wifi_config.sta.pmf_cfg.capable = true;
-    wifi_config.sta.pmf_cfg.required = false;
-    strncpy((char *) wifi_config.sta.ssid, (const char *) settings.ssid, 31);
-    strncpy((char *) wifi_config.sta.password, (const char *) settings.password, 63);
-    
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-
-    // wait for got ip event or timeout
-    bool success = false;
-    unsigned long lastMillis = millis();
-    while (true)
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open("state", NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK)
     {
-        xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
-        success = wifiWorking;
-        xSemaphoreGive(wifiWorkingMutex);
-        if (success || millis() - lastMillis > waitingTimeConnectWifi)
-            break;
-        delay(100);
+        LOG_D("No saved schedules");
+        return;
     }
-    
-    if (success)
+    size_t size = 0;
+    err = nvs_get_blob(nvs_handle, "schedules", nullptr, &size);
+    char *buffer = err == ESP_OK ? (char *) malloc(size) : nullptr;
+    if (buffer && nvs_get_blob(nvs_handle, "schedules", buffer, &size) == ESP_OK && size > 0 && buffer[size - 1] == '\0')
     {
-        LOG_D("Connected");
-        return true;
+        xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
+        scheduleString = buffer;
+        schedulesCompiled = false;
+        xSemaphoreGive(scheduleStringMutex);
+        LOG_D("Loaded saved schedules");
     }
     else
     {
-        LOG_D("Failed to connect");
-        return false;
+        LOG_D("Error loading saved schedules: %d", err);
     }
+    free(buffer);
+    nvs_close(nvs_handle);
 }
 
-void subscribeToButtonEvents(TaskHandle_t taskHandle)
-{
-    buttonSubscribedTaskHandle = taskHandle;
-    static_assert(sizeof(Button) <= sizeof(void *));
-    static_assert(sizeof(Button) <= sizeof(uint32_t));
-    attachInterruptArg(pinUp, buttonISR, (void *) Button::Up, RISING);
-    attachInterruptArg(pinDown, buttonISR, (void *) Button::Down, RISING);
-    attachInterruptArg(pinEnter, buttonISR, (void *) Button::Enter, RISING);
-}
-
-void unsubscribeFromButtonEvents()
+/* saves scheduleString, so the schedules can be followed right after the next boot
+ * it is saved as a blob with the terminating null, because strings in NVS are limited to 4000 bytes
+ * NVS doesn't write an item again if its value didn't change, so the flash isn't worn by every reconnect of the stream
+ */
+void saveSchedules()
 {
-    detachInterrupt(pinUp);
-    detachInterrupt(pinDown);
-    detachInterrupt(pinEnter);
-    buttonSubscribedTaskHandle = nullptr;
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open("state", NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        LOG_E("Error nvs_open: %d", err);
+        return;
+    }
+    xSemaphoreTake(scheduleStringMutex, portMAX_DELAY);
+    err = nvs_set_blob(nvs_handle, "schedules", scheduleString.c_str(), scheduleString.length() + 1);
+    xSemaphoreGive(scheduleStringMutex);
+    if (err == ESP_OK)
+        err = nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK)
+    {
+        LOG_E("Error saving schedules: %d", err);
+    }
 }
 
-void sendSignalToHeater(bool signal)
+void loadUpdateCheck()
 {
-    LOG_D("Sending signal to heater: %s", signal ? "on" : "off");
-    xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
-    heaterState = signal;
-    xSemaphoreGive(heaterStateMutex);
-    digitalWrite(pinHeater, signal);
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open("state", NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK)
+        return;
+    size_t size = sizeof(updateCheck);
+    err = nvs_get_blob(nvs_handle, "updateCheck", &updateCheck, &size);
+    // the validators must be terminated, the check is made again if they aren't
+    if (err != ESP_OK || size != sizeof(updateCheck) ||
+        !memchr(updateCheck.etag, 0, sizeof(updateCheck.etag)) || !memchr(updateCheck.lastModified, 0, sizeof(updateCheck.lastModified)))
+    {
+        updateCheck = {};
+    }
+    nvs_close(nvs_handle);
 }
 
-bool loadSettings()
+void saveUpdateCheck()
 {
-    settings = {};
     nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open("settings", NVS_READWRITE, &nvs_handle);
+    esp_err_t err = nvs_open("state", NVS_READWRITE, &nvs_handle);
     if (err != ESP_OK)
     {
         LOG_E("Error nvs_open: %d", err);
-        return false;
+        return;
     }
-
-    size_t size = sizeof(settings);
-    err = nvs_get_blob(nvs_handle, "settings", &settings, &size);
+    err = nvs_set_blob(nvs_handle, "updateCheck", &updateCheck, sizeof(updateCheck));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs_handle);
     nvs_close(nvs_handle);
-    if (err == ESP_ERR_NVS_NOT_FOUND)
+    if (err != ESP_OK)
     {
-        LOG_D("Settings not found");
-        return false;
+        LOG_E("Error saving the update check: %d", err);
     }
-    else if (err != ESP_OK)
+}
+
+// waits at most waitingTimeNTP for the first NTP sync, returns if it happened
+bool waitForNTP()
+{
+    LOG_D("Trying to get NTP time");
+    uint32_t startMillis = millis();
+    while ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0 && millis() - startMillis < waitingTimeNTP)
     {
-        LOG_E("Error nvs_get_blob: %d", err);
+        delay(100);
+    }
+    if ((sntp_getreachability(0) | sntp_getreachability(1) | sntp_getreachability(2)) == 0)
+    {
+        LOG_D("Couldn't get NTP time");
+        requestDisplayUpdate();
         return false;
     }
-    LOG_D("Loaded settings");
+    time_t now;
+    time(&now);
+    LOG_D("Got NTP time: %ld", now);
     return true;
 }
 
+bool timeIsSet()
+{
+    return time(nullptr) >= minimumValidTime;
+}
+
 
 /* Schedule evaluation helpers */
 
-bool cmpTempSetTemp(float temp, float setTemp)
+bool cmpTempSetTemp(zone_t &zone, float temp, float setTemp)
 {
     xSemaphoreTake(heaterStateMutex, portMAX_DELAY);
-    bool heaterStateCopy = heaterState;
+    bool heaterStateCopy = zone.heaterState;
     xSemaphoreGive(heaterStateMutex);
     if (heaterStateCopy)
     {
@@ -1638,13 +3449,59 @@ bool cmpTempSetTemp(float temp, float setTemp)
     return temp <= setTemp - tempThreshold;
 }
 
-bool scheduleIsActive(JsonObjectConst schedule)
+/* parses scheduleString into compiledSchedules, must be called with scheduleStringMutex taken
+ * the times of the one time schedules are converted with the current timezone
+ */
+void compileSchedules()
 {
-    const char *repeat = schedule["repeat"];
-    
+    compiledScheduleCount = 0;
+    // we find the first occurrence of the character '{', excluding the first character; this is the beggining of the first schedule object
+    int beginIndex = scheduleString.indexOf('{', 1);
+    while (beginIndex != -1)
+    {
+        // we find the next occurrence of '}', starting at beginIndex; this is the end of the first schedule object
+        int endIndex = scheduleString.indexOf('}', beginIndex + 1);
+        if (endIndex == -1)
+            break;
+        if (compiledScheduleCount == maxSchedules)
+        {
+            LOG_W("Only the first %u schedules are followed", maxSchedules);
+            break;
+        }
+        StaticJsonDocument<400> doc;
+        auto error = deserializeJson(doc, scheduleString.c_str() + beginIndex, endIndex - beginIndex + 1);
+        if (error)
+        {
+            LOG_D("Invalid schedule");
+        }
+        else if (compileSchedule(doc.as<JsonObjectConst>(), compiledSchedules[compiledScheduleCount]))
+        {
+            compiledSchedules[compiledScheduleCount].position = beginIndex;
+            compiledScheduleCount++;
+        }
+        beginIndex = scheduleString.indexOf('{', endIndex + 1);
+    }
+    schedulesCompiled = true;
+    LOG_D("Compiled %u schedules", compiledScheduleCount);
+}
+
+// returns false if the schedule is invalid or it is for a zone that doesn't exist
+bool compileSchedule(JsonObjectConst schedule, compiledSchedule_t &compiled)
+{
+    // the schedules without a zone are for the first one
+    const char *zoneName = schedule["zone"];
+    int zone = zoneName ? findZone(zoneName) : 0;
+    if (zone == -1)
+    {
+        LOG_D("Schedule for unknown zone %s", zoneName);
+        return false;
+    }
+    compiled.zone = zone;
+    compiled.setTemp = schedule["setTemp"];
+    const char *repeat = schedule["repeat"] | "";
+
     if (strcmp(repeat, "Once") == 0)
     {
-        LOG_D("Once");
         tm starttm, endtm;
         starttm.tm_sec = 0;
         starttm.tm_min = schedule["sM"];
@@ -1660,83 +3517,172 @@ bool scheduleIsActive(JsonObjectConst schedule)
         endtm.tm_mon = schedule["eMth"];
         endtm.tm_year = schedule["eY"].as<int>() - 1900;
         endtm.tm_isdst = -1;
-        time_t startTime = mktime(&starttm);
-        time_t endTime = mktime(&endtm);
-        time_t now;
-        time(&now);
-        bool active = startTime <= now && now < endTime;
-        LOG_D("%s", active ? "Active" : "Not active");
-        return active;
+        compiled.repeat = ScheduleRepeat::Once;
+        compiled.weekDays = 0;
+        compiled.start = mktime(&starttm);
+        compiled.end = mktime(&endtm);
+        return true;
     }
 
-    int startTime = schedule["sH"].as<int>() * 60 + schedule["sM"].as<int>();
-    int endTime = schedule["eH"].as<int>() * 60 + schedule["eM"].as<int>();
-    time_t now;
-    tm tmnow;
-    time(&now);
-    localtime_r(&now, &tmnow);
-    int currentTime = tmnow.tm_hour * 60 + tmnow.tm_min;
+    compiled.start = schedule["sH"].as<int>() * 60 + schedule["sM"].as<int>();
+    compiled.end = schedule["eH"].as<int>() * 60 + schedule["eM"].as<int>();
 
     if (strcmp(repeat, "Daily") == 0)
     {
-        LOG_D("Daily");
-        bool active = startTime <= currentTime && currentTime < endTime;
-        LOG_D("%s", active ? "Active" : "Not active");
-        return active;
+        compiled.repeat = ScheduleRepeat::Daily;
+        compiled.weekDays = 0x7F;
+        return true;
     }
 
     if (strcmp(repeat, "Weekly") == 0)
     {
-        LOG_D("Weekly");
+        compiled.repeat = ScheduleRepeat::Weekly;
+        compiled.weekDays = 0;
         JsonArrayConst weekdays = schedule["weekDays"]; // Sunday is day 1
         for (int wday : weekdays)
-            if (wday == tmnow.tm_wday + 1)
-            {
-                LOG_T("Active on this weekday");
-                bool active = startTime <= currentTime && currentTime < endTime;
-                LOG_D("%s", active ? "Active" : "Not active");
-                return active;
-            }
-        LOG_T("Not active on this weekday");
-        LOG_D("Not active");
-        return false;
+            if (wday >= 1 && wday <= 7)
+                compiled.weekDays |= 1 << (wday - 1);
+        return true;
     }
     LOG_D("Schedule repeat is invalid");
     return false;
 }
 
+// now and tmnow are the current time, as UNIX time and as local time
+bool scheduleIsActive(const compiledSchedule_t &schedule, time_t now, const tm &tmnow)
+{
+    if (schedule.repeat == ScheduleRepeat::Once)
+        return schedule.start <= now && now < schedule.end;
+
+    // the daily schedules are active on every weekday
+    if (!(schedule.weekDays & (1 << tmnow.tm_wday)))
+        return false;
+    int currentTime = tmnow.tm_hour * 60 + tmnow.tm_min;
+    return schedule.start <= currentTime && currentTime < schedule.end;
+}
+
 
 /* ISRs */
 
-void IRAM_ATTR buttonISR(void *button)
+// adds an edge to the button queue, returns false if it is full
+bool IRAM_ATTR pushButtonEdge(const buttonEdge_t &edge)
+{
+    uint32_t head = buttonQueueHead.load(std::memory_order_relaxed);
+    while (true)
+    {
+        buttonQueueSlot_t &slot = buttonQueue[head % buttonQueueSize];
+        int32_t difference = (int32_t) (slot.sequence.load(std::memory_order_acquire) - head);
+        if (difference == 0)
+        {
+            // the slot is free, we take it if no other producer took it first
+            if (buttonQueueHead.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+            {
+                slot.edge = edge;
+                slot.sequence.store(head + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // the consumer hasn't read the slot of the previous lap, the task will resynchronize the state from the pin
+            return false;
+        }
+        else
+        {
+            // another producer took the slot
+            head = buttonQueueHead.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/* accepts the state read from the pin of a button if it differs from the last accepted one
+ * and the debounce time since the last accepted edge is over, then adds the edge to the button queue
+ * returns true if an edge was added, remaining is the time (us) until the debounce time is over, or 0
+ */
+bool IRAM_ATTR acceptButtonEdge(buttonInput_t *input, bool pressed, int64_t &remaining)
 {
-    portENTER_CRITICAL_ISR(&lastButtonPressMux);
-    if (millis() - lastButtonPress >= buttonDebounceTime)
+    remaining = 0;
+    uint32_t accepted = input->acceptedEdge.load(std::memory_order_acquire);
+    int64_t now;
+    while (true)
     {
-        lastButtonPress = millis();
-        BaseType_t higherPriorityTaskWoken = pdFALSE;
-        uint32_t buttonValue = (uint32_t) button;
-        xTaskNotifyFromISR(
-            buttonSubscribedTaskHandle,
-            buttonValue,
-            eSetValueWithoutOverwrite,
-            &higherPriorityTaskWoken);
-        if (higherPriorityTaskWoken == pdTRUE)
+        if (pressed == (accepted & 1))
+            return false;
+        // read after the accepted edge, so the edges of a button get increasing times in the order they are accepted
+        now = esp_timer_get_time();
+        // the times wrap every 71 minutes, an edge taken for a bounce because of it is only sampled again later
+        uint32_t elapsed = ((uint32_t) now & ~1u) - (accepted & ~1u);
+        if (elapsed < buttonDebounceTime * 1000)
         {
-            portYIELD_FROM_ISR();
+            remaining = buttonDebounceTime * 1000 - elapsed;
+            return false;
         }
+        if (input->acceptedEdge.compare_exchange_weak(accepted, ((uint32_t) now & ~1u) | pressed, std::memory_order_acq_rel))
+            break;
     }
-    portEXIT_CRITICAL_ISR(&lastButtonPressMux);
+    return pushButtonEdge({ input->button, pressed, now });
 }
 
+// called on both edges of a button
+// each button is debounced on its own and the accepted edges are added to the button queue
+void IRAM_ATTR buttonISR(void *arg)
+{
+    buttonInput_t *input = static_cast<buttonInput_t *>(arg);
+    int64_t remaining;
+    bool accepted = acceptButtonEdge(input, digitalRead(input->pin), remaining);
+
+    if (remaining > 0)
+    {
+        // the edge can be a bounce or a real press right after a release
+        // so instead of dropping it the pin is sampled again when the debounce time is over
+        // fails harmlessly if the timer is already running
+        esp_timer_start_once(input->debounceTimer, remaining);
+        return;
+    }
+    if (!accepted)
+        return;
+
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    xTaskNotifyFromISR(
+        buttonSubscribedTaskHandle,
+        notificationButtonEvent,
+        eSetBits,
+        &higherPriorityTaskWoken);
+    if (higherPriorityTaskWoken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+// runs in the esp_timer task when the debounce time of an early edge is over
+// the state that settled on the pin is accepted if it differs from the last accepted one
+void buttonDebounceTimerCallback(void *arg)
+{
+    buttonInput_t *input = static_cast<buttonInput_t *>(arg);
+    int64_t remaining;
+    bool accepted = acceptButtonEdge(input, digitalRead(input->pin), remaining);
+    if (remaining > 0)
+    {
+        // the ISR accepted another edge since the timer was started
+        esp_timer_start_once(input->debounceTimer, remaining);
+        return;
+    }
+
+    TaskHandle_t taskHandle = buttonSubscribedTaskHandle;
+    if (accepted && taskHandle)
+    {
+        xTaskNotify(taskHandle, notificationButtonEvent, eSetBits);
+    }
+}
 
 /* Event handlers */
 
-void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *)
+void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *data)
 {
     if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START)
     {
         LOG_D("Wifi started");
+        wifiConnectStart = esp_timer_get_time();
         esp_err_t err = esp_wifi_connect();
         if (err != ESP_OK)
         {
@@ -1744,6 +3690,28 @@ void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *)
             xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
             wifiWorking = false;
             xSemaphoreGive(wifiWorkingMutex);
+            requestDisplayUpdate();
+        }
+    }
+    else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_CONNECTED)
+    {
+        auto *event = static_cast<wifi_event_sta_connected_t *>(data);
+        wifiAssociated = esp_timer_get_time();
+        if (wifiConnectStart)
+            wifiAssociationLatencies.record((wifiAssociated - wifiConnectStart) / 1000);
+        wifiFastPathFailures = 0;
+        // the next attempts go straight to this access point
+        bool profileChanged = event->channel != currentWifiProfile.channel
+            || memcmp(event->bssid, currentWifiProfile.bssid, sizeof(currentWifiProfile.bssid)) != 0;
+        memcpy(currentWifiProfile.bssid, event->bssid, sizeof(currentWifiProfile.bssid));
+        currentWifiProfile.channel = event->channel;
+        LOG_D("Associated on channel %d%s", event->channel, wifiFastPath ? ", using the fast path" : "");
+        if (profileChanged)
+        {
+            xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
+            connectedWifiProfile = currentWifiProfile;
+            xSemaphoreGive(wifiWorkingMutex);
+            wifiProfileChanged = true;
         }
     }
     else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED)
@@ -1751,6 +3719,21 @@ void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *)
         xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
         wifiWorking = false;
         xSemaphoreGive(wifiWorkingMutex);
+        requestDisplayUpdate();
+        if (!wifiConnectStart)
+            wifiConnectStart = esp_timer_get_time();
+        wifiAssociated = 0;
+        // after a few failed attempts at the cached access point, it may have moved to another channel, or another one may be better
+        if (wifiFastPath && ++wifiFastPathFailures >= wifiFastPathAttempts)
+        {
+            LOG_D("Fast reconnect failed, falling back to a full scan");
+            wifiFastPathFallbacks++;
+            configureSTAMode(false);
+        }
+        else if (!wifiFastPath && currentWifiProfile.channel && wifiFastPathFailures == 0)
+        {
+            configureSTAMode(true);
+        }
         esp_err_t err = esp_wifi_connect();
         if (err != ESP_OK)
         {
@@ -1760,21 +3743,34 @@ void wifi_event_handler(void *, esp_event_base_t base, int32_t id, void *)
     else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP)
     {
         LOG_D("Got IP");
+        int64_t now = esp_timer_get_time();
+        if (wifiAssociated)
+            wifiAddressLatencies.record((now - wifiAssociated) / 1000);
+        if (wifiConnectStart)
+            LOG_D("Connected in %lld ms", (now - wifiConnectStart) / 1000);
+        wifiConnectStart = 0;
         xSemaphoreTake(wifiWorkingMutex, portMAX_DELAY);
         wifiWorking = true;
         xSemaphoreGive(wifiWorkingMutex);
+        requestDisplayUpdate();
     }
 }
 
 esp_err_t update_http_event_handler(esp_http_client_event_t *event)
 {
+    if (!event->user_data)
+        return ESP_OK;
+    auto response = (updateCheckResponse_t *) event->user_data;
     if (event->event_id == HTTP_EVENT_ON_DATA)
     {
-        if (event->user_data)
-        {
-            auto response = (std::string *) event->user_data;
-            response->append((const char *) event->data, event->data_len);
-        }
+        response->body.append((const char *) event->data, event->data_len);
+    }
+    else if (event->event_id == HTTP_EVENT_ON_HEADER)
+    {
+        if (strcasecmp(event->header_key, "ETag") == 0)
+            strlcpy(response->etag, event->header_value, sizeof(response->etag));
+        else if (strcasecmp(event->header_key, "Last-Modified") == 0)
+            strlcpy(response->lastModified, event->header_value, sizeof(response->lastModified));
     }
     return ESP_OK;
 }
\ No newline at end of file
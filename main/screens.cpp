@@ -0,0 +1,498 @@
+/*
+    Copyright 2019-2020 Cosmin Popan
+
+    This file is part of ThermostatESP32
+
+    ThermostatESP32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ThermostatESP32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <math.h>
+#include <cstdio>
+#include "screens.h"
+#include "string_consts.h"
+#include "glyph_sprites.h"
+#include "flame.h"
+
+// Widgets of the main screen, each one is only redrawn when the value it shows changes
+enum MainScreenWidget
+{
+    WidgetDate = 0,
+    WidgetClock,
+    WidgetTemp,
+    WidgetHumidity,
+    WidgetFlame,
+    WidgetErrors,
+    WidgetCount
+};
+
+// the area a widget clears before drawing itself
+struct widgetArea_t
+{
+    int16_t x, y, w, h;
+};
+
+const widgetArea_t mainScreenWidgetAreas[WidgetCount] = {
+    {  3, 32, 42, 16 },  // date, two lines of up to 7 characters
+    { 42,  9, 42, 12 },  // clock, the DSEG7 digits go 11 pixels above the baseline
+    { 48, 30, 36, 18 },  // temperature, including the degree symbol which is 2 pixels higher
+    {  3, 18, 24,  8 },  // humidity
+    { 75,  0,  8, 12 },  // flame
+    {  0,  0, 54,  8 },  // errors, at most 3 errors of 2 characters followed by a space
+};
+
+static void displayDate(Framebuffer &display, int day, int mth, int year, int wDay, int cursorX, int cursorY);
+static void displayClock(Framebuffer &display, int hour, int min, int cursorX, int cursorY);
+static void displayTemp(Framebuffer &display, float temp, int cursorX, int cursorY);
+static void displayHumidity(Framebuffer &display, int hum, int cursorX, int cursorY);
+static void displayFlame(Framebuffer &display, const uint8_t *flameBitmap, int cursorX, int cursorY, int width, int height);
+static void displayErrors(Framebuffer &display, uint8_t errors, int cursorX, int cursorY);
+static void displayGlyphSprite(Framebuffer &display, const glyphSprite_t &sprite);
+
+
+/* Main screen */
+
+void drawMainScreen(Framebuffer &display, const mainScreenState_t &state, mainScreenCache_t &cache)
+{
+    bool redrawAll = !cache.drawn || display.getGeneration() != cache.generation;
+    if (redrawAll)
+        display.clearDisplay();
+
+    bool dirty[WidgetCount];
+    dirty[WidgetDate] = redrawAll
+        || state.time.tm_mday != cache.state.time.tm_mday
+        || state.time.tm_mon != cache.state.time.tm_mon
+        || state.time.tm_year != cache.state.time.tm_year
+        || state.time.tm_wday != cache.state.time.tm_wday;
+    dirty[WidgetClock] = redrawAll
+        || state.time.tm_hour != cache.state.time.tm_hour
+        || state.time.tm_min != cache.state.time.tm_min;
+    dirty[WidgetTemp] = redrawAll
+        || !(state.temp == cache.state.temp || (isnan(state.temp) && isnan(cache.state.temp)));
+    dirty[WidgetHumidity] = redrawAll || state.hum != cache.state.hum;
+    dirty[WidgetFlame] = redrawAll || state.heater != cache.state.heater;
+    dirty[WidgetErrors] = redrawAll || state.errors != cache.state.errors;
+
+    // clearing a widget also erases the parts of the widgets that overlap it, so those have to be drawn again too
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < WidgetCount; i++)
+        {
+            if (!dirty[i])
+                continue;
+            const widgetArea_t &a = mainScreenWidgetAreas[i];
+            for (int j = 0; j < WidgetCount; j++)
+            {
+                const widgetArea_t &b = mainScreenWidgetAreas[j];
+                if (!dirty[j] && a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h)
+                {
+                    dirty[j] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // first we clear every dirty widget, then we draw them, so overlapping widgets don't erase each other
+    for (int i = 0; i < WidgetCount; i++)
+    {
+        if (dirty[i])
+        {
+            const widgetArea_t &area = mainScreenWidgetAreas[i];
+            display.fillRect(area.x, area.y, area.w, area.h, WHITE);
+        }
+    }
+    display.setTextColor(BLACK);
+    for (int i = 0; i < WidgetCount; i++)
+    {
+        if (!dirty[i])
+            continue;
+        switch (i)
+        {
+        case WidgetDate:
+            displayDate(display, state.time.tm_mday, state.time.tm_mon + 1, state.time.tm_year + 1900, state.time.tm_wday, 3, 32);
+            break;
+        case WidgetClock:
+            displayClock(display, state.time.tm_hour, state.time.tm_min, 42, 20);
+            break;
+        case WidgetTemp:
+            displayTemp(display, state.temp, 48, 32);
+            break;
+        case WidgetHumidity:
+            displayHumidity(display, state.hum, 3, 18);
+            break;
+        case WidgetFlame:
+            if (state.heater)
+                displayFlame(display, flame, 75, 0, 8, 12); // the last two arguments are the width and the height of the flame icon
+            break;
+        case WidgetErrors:
+            displayErrors(display, state.errors, 0, 0);
+            break;
+        }
+    }
+    // the other screens expect the default font
+    display.setFont();
+    display.setTextSize(1);
+
+    cache.state = state;
+    cache.generation = display.getGeneration();
+    cache.drawn = true;
+    // only the banks and columns that changed are sent
+    display.display();
+}
+
+// cursorX and cursorY are the location of the top left corner
+static void displayErrors(Framebuffer &display, uint8_t errors, int cursorX, int cursorY)
+{
+    display.setCursor(cursorX, cursorY);
+    display.setFont();
+    display.setTextSize(1);
+    if (errors & DisplayErrorWifi)
+    {
+        display.print(displayErrorWifiString);
+        display.write(' ');
+    }
+    if (errors & DisplayErrorNTP)
+    {
+        display.print(displayErrorNTPString);
+        display.write(' ');
+    }
+    if (errors & DisplayErrorFirebase)
+    {
+        display.print(displayErrorFirebaseString);
+        display.write(' ');
+    }
+    if (errors & DisplayErrorSensor)
+    {
+        display.print(displayErrorSensorString);
+        display.write(' ');
+    }
+}
+
+// cursorX and cursorY are the location of the top left corner
+static void displayHumidity(Framebuffer &display, int hum, int cursorX, int cursorY)
+{
+    display.setCursor(cursorX, cursorY);
+    display.setFont();
+    display.setTextSize(1);
+    if (hum == -1)
+    {
+        display.print(displayHumidityNotAvailableString);
+        return;
+    }
+    display.printf(displayHumidityFormatString, hum);
+}
+
+// cursorX and cursorY are the location of the top left corner
+static void displayFlame(Framebuffer &display, const uint8_t *flameBitmap, int cursorX, int cursorY, int width, int height)
+{
+    display.drawBitmap(cursorX, cursorY, flameBitmap, width, height, BLACK);
+}
+
+// cursorX and cursorY are the location of the top left corner
+// sunday is wDay 0
+static void displayDate(Framebuffer &display, int day, int mth, int year, int wDay, int cursorX, int cursorY)
+{
+    display.setCursor(cursorX, cursorY);
+    display.setFont();
+    display.setTextSize(1);
+    display.printf(displayDateLine1FormatString, displayShortWeekdayStrings[wDay], day);
+    display.setCursor(cursorX, display.getCursorY());
+    display.printf(displayDateLine2FormatString, mth, year);
+}
+
+// cursorX and cursorY are the location of the middle left point
+// it uses the DSEG7 Classic Bold font, from the sprites rendered at compile time
+static void displayClock(Framebuffer &display, int hour, int min, int cursorX, int cursorY)
+{
+    display.setCursor(cursorX, cursorY);
+    char clock[6];
+    snprintf(clock, sizeof(clock), displayClockFormatString, hour, min);
+    for (const char *c = clock; *c; c++)
+    {
+        if (*c >= '0' && *c <= ':')
+            displayGlyphSprite(display, clockGlyphSprites[*c - '0']);
+    }
+}
+
+// cursorX and cursorY are the location of the top left corner
+// needs at least 2 free pixels above(for the degree symbol and C)
+static void displayTemp(Framebuffer &display, float temp, int cursorX, int cursorY)
+{
+    display.setFont();
+    if (isnan(temp))
+    {
+        display.setCursor(cursorX, cursorY);
+        display.setTextSize(2);
+        display.write('N');
+        display.setTextSize(1, 2);
+        display.write('/');
+        display.setTextSize(2);
+        display.write('A');
+        return;
+    }
+    display.setCursor(cursorX, cursorY);
+    display.setTextSize(2);
+    char integerPart[8];
+    snprintf(integerPart, sizeof(integerPart), "%d", (int)temp);
+    for (const char *c = integerPart; *c; c++)
+    {
+        if (*c >= '0' && *c <= '9')
+            displayGlyphSprite(display, tempGlyphSprites[*c - '0']);
+        else
+            display.write(*c);
+    }
+    display.setTextSize(1);
+    int x = display.getCursorX() - 1;
+    int y = display.getCursorY();
+    display.setCursor(x, y - 2);
+    display.printf("%c%c", char(247), displayTempLetter); // char(247) is the degree symbol °
+    display.setCursor(x, y + 7);
+    float decimals = temp - floorf(temp);
+    decimals *= 10;
+    display.printf(".%d", (int)(decimals + 0.5f));
+}
+
+// draws a sprite at the cursor and advances the cursor, like write() does for a character
+static void displayGlyphSprite(Framebuffer &display, const glyphSprite_t &sprite)
+{
+    int16_t x = display.getCursorX();
+    int16_t y = display.getCursorY();
+    display.drawSprite(x + sprite.xOffset, y + sprite.yOffset, sprite.columns, sprite.width, sprite.height);
+    display.setCursor(x + sprite.xAdvance, y);
+}
+
+
+/* Menus */
+
+void simpleDisplay(Framebuffer &display, const char *str)
+{
+    display.clearDisplay();
+    display.setTextColor(BLACK);
+    display.setCursor(0, 0);
+    display.println(str);
+    display.display();
+}
+
+void startupMenuHelper(Framebuffer &display, int highlightedOption)
+{
+    display.clearDisplay();
+    display.setTextSize(1);
+    display.setCursor(0, 0);
+
+    display.println(menuTitleString);
+
+    if (highlightedOption == 0)
+        display.setTextColor(WHITE, BLACK);
+    else
+        display.setTextColor(BLACK);
+
+    display.println(menuNormalModeString);
+
+    if (highlightedOption == 1)
+        display.setTextColor(WHITE, BLACK);
+    else
+        display.setTextColor(BLACK);
+
+    display.println(menuSetupString);
+
+    display.setTextColor(BLACK);
+    display.display();
+}
+
+void temporaryScheduleHelper(Framebuffer &display, float temp, int duration, int minutesLeft, int option, int sel)
+{
+    display.clearDisplay();
+    display.println(temporaryScheduleTitleString);
+    display.println();
+
+    if (sel == 0)
+    {
+        display.setTextColor(WHITE, BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+    }
+    display.printf(temporaryScheduleTempFormatString, temp);
+    if (sel == 1)
+    {
+        display.setTextColor(WHITE, BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+    }
+    if (duration == -1)
+    {
+        if (minutesLeft == -1)
+        {
+            display.print(temporaryScheduleDurationInfiniteString);
+        }
+        else if (minutesLeft < 60)
+        {
+            display.printf(temporaryScheduleDuration1FormatString, minutesLeft);
+        }
+        else
+        {
+            display.printf(temporaryScheduleDuration2FormatString, ((float)minutesLeft) / 60);
+        }
+    }
+    else if (duration < 60)
+    {
+        display.printf(temporaryScheduleDuration1FormatString, duration);
+    }
+    else
+    {
+        if (duration == 24 * 60 + 30)
+            display.print(temporaryScheduleDurationInfiniteString);
+        else
+            display.printf(temporaryScheduleDuration2FormatString, ((float)duration) / 60);
+    }
+    if (sel == 2)
+    {
+        if (option == 0)
+        {
+            display.setTextColor(WHITE, BLACK);
+        }
+        else
+        {
+            display.setTextColor(BLACK);
+        }
+        display.print(temporaryScheduleOkString);
+        display.setTextColor(BLACK);
+        display.write(' ');
+        if (option == 1)
+        {
+            display.setTextColor(WHITE, BLACK);
+        }
+        else
+        {
+            display.setTextColor(BLACK);
+        }
+        display.print(temporaryScheduleCancelString);
+        display.setTextColor(BLACK);
+        display.write(' ');
+        if (option == 2)
+        {
+            display.setTextColor(WHITE, BLACK);
+        }
+        else
+        {
+            display.setTextColor(BLACK);
+        }
+        display.println(temporaryScheduleDeleteString);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+        display.print(temporaryScheduleOkString);
+        display.write(' ');
+        display.print(temporaryScheduleCancelString);
+        display.write(' ');
+        display.println(temporaryScheduleDeleteString);
+    }
+    display.setTextColor(BLACK);
+    display.display();
+}
+
+void manualTimeHelper(Framebuffer &display, int h, int m, int d, int mth, int y, int sel)
+{
+    display.clearDisplay();
+    display.setTextSize(1);
+    display.setTextColor(BLACK);
+    display.setCursor(10, 0);
+    display.println(manualTimeTitleString);
+
+    display.setCursor(27, 15);
+    if (sel == 0)
+    {
+        display.setTextColor(WHITE, BLACK);
+        display.printf(manualTimeFormatString, h);
+        display.setTextColor(BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+        display.printf(manualTimeFormatString, h);
+    }
+    display.print(':');
+    if (sel == 1)
+    {
+        display.setTextColor(WHITE, BLACK);
+        display.printf(manualTimeFormatString, m);
+        display.setTextColor(BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+        display.printf(manualTimeFormatString, m);
+    }
+
+    display.setCursor(14, 30);
+    if (sel == 2)
+    {
+        display.setTextColor(WHITE, BLACK);
+        display.printf(manualTimeFormatString, d);
+        display.setTextColor(BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+        display.printf(manualTimeFormatString, d);
+    }
+    display.print('.');
+    if (sel == 3)
+    {
+        display.setTextColor(WHITE, BLACK);
+        display.printf(manualTimeFormatString, mth);
+        display.setTextColor(BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+        display.printf(manualTimeFormatString, mth);
+    }
+    display.print('.');
+    if (sel == 4)
+    {
+        display.setTextColor(WHITE, BLACK);
+        display.println(y);
+        display.setTextColor(BLACK);
+    }
+    else
+    {
+        display.setTextColor(BLACK);
+        display.println(y);
+    }
+
+    display.display();
+}
+
+void setupDisplayInfo(Framebuffer &display, const char *ssid, const char *password)
+{
+    display.clearDisplay();
+    display.setTextSize(1);
+    display.setCursor(0, 0);
+    display.setTextColor(BLACK);
+    display.println(setupSSIDPassString);
+    display.println(ssid);
+    display.println(password);
+    display.println();
+    display.println(setupIPString);
+    display.println("192.168.4.1");
+    display.display();
+}
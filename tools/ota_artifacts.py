@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+
+#    Copyright 2019-2020 Cosmin Popan
+#
+#    This file is part of ThermostatESP32
+#
+#    ThermostatESP32 is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    ThermostatESP32 is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+
+"""Makes the compressed image and the patches the thermostat can update from, instead of the full image.
+
+The release is made from the new image and the images it can be patched from, usually the last few releases:
+    tools/ota_artifacts.py release build/thermostat.bin --version 1.3.0 --base-url https://example.com/thermostat/ \
+        --from releases/1.2.0.bin --from releases/1.2.1.bin -o site/thermostat/
+which writes the image, the image compressed with zlib, a patch from each of the old images and latest.json,
+leaving out the compressed image and the patches that aren't smaller than the image.
+The thermostat downloads the patch made against the image it is running if there is one, otherwise the compressed image.
+
+Every patch is applied again after it is made, and must result in exactly the new image.
+The format of the patches is described in components/OtaUpdater/DeltaPatcher.h.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import struct
+import sys
+import zlib
+
+# must match components/OtaUpdater/DeltaPatcher.h
+MAGIC = b'TDP1'
+HEADER = struct.Struct('<4sII32s')
+COPY, ADD, INSERT = 1, 2, 3
+
+# matches are looked up by the blocks of the old image that start at a multiple of BLOCK_STEP
+BLOCK = 16
+BLOCK_STEP = 4
+# how much worse than the best point so far an approximate match can get before it stops being extended
+MAX_MISMATCH = 64
+# offset of hash_appended in esp_image_header_t
+HASH_APPENDED_OFFSET = 23
+
+
+def image_sha256(image):
+    """Returns the SHA-256 that esp_partition_get_sha256() gives for the partition the image is installed in:
+    the hash appended at the end of the image if there is one, otherwise the hash of the whole image.
+    """
+    if len(image) > 32 and image[HASH_APPENDED_OFFSET] == 1:
+        return image[-32:]
+    return hashlib.sha256(image).digest()
+
+
+def extend_match(old, old_start, new, new_start):
+    """Returns how far the match at old_start and new_start goes, allowing bytes that differ
+    as long as most of them are the same, like the addresses in code that moved.
+    """
+    limit = min(len(old) - old_start, len(new) - new_start)
+    score = best_score = best_length = 0
+    for length in range(1, limit + 1):
+        score += 1 if old[old_start + length - 1] == new[new_start + length - 1] else -1
+        if score >= best_score:
+            best_score, best_length = score, length
+        elif score < best_score - MAX_MISMATCH:
+            break
+    return best_length
+
+
+def make_patch(old, new):
+    """Returns the uncompressed patch that rebuilds new from old."""
+    index = {}
+    for offset in range(0, len(old) - BLOCK + 1, BLOCK_STEP):
+        index.setdefault(old[offset:offset + BLOCK], offset)
+
+    commands = []
+    insert_start = 0
+
+    def insert(end):
+        if end > insert_start:
+            commands.append(struct.pack('<BI', INSERT, end - insert_start) + new[insert_start:end])
+
+    position = 0
+    while position <= len(new) - BLOCK:
+        old_start = index.get(new[position:position + BLOCK])
+        if old_start is None:
+            position += 1
+            continue
+        # the bytes before the block may match too
+        new_start = position
+        while new_start > insert_start and old_start > 0 and new[new_start - 1] == old[old_start - 1]:
+            new_start -= 1
+            old_start -= 1
+        length = extend_match(old, old_start, new, new_start)
+        insert(new_start)
+        differences = bytes((new[new_start + i] - old[old_start + i]) & 0xFF for i in range(length))
+        if differences.count(0) == length:
+            commands.append(struct.pack('<BII', COPY, old_start, length))
+        else:
+            commands.append(struct.pack('<BII', ADD, old_start, length) + differences)
+        position = insert_start = new_start + length
+    insert(len(new))
+
+    return HEADER.pack(MAGIC, len(old), len(new), image_sha256(old)) + b''.join(commands)
+
+
+def apply_patch(old, patch):
+    """Returns the image rebuilt from old and the uncompressed patch, the way DeltaPatcher does it."""
+    magic, source_size, target_size, source_sha256 = HEADER.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError('not a patch')
+    if source_size != len(old) or source_sha256 != image_sha256(old):
+        raise ValueError('the patch was made against another image')
+    result = bytearray()
+    position = HEADER.size
+    while len(result) < target_size:
+        command = patch[position]
+        if command in (COPY, ADD):
+            offset, length = struct.unpack_from('<II', patch, position + 1)
+            position += 9
+            if offset + length > source_size:
+                raise ValueError('command out of range')
+            if command == COPY:
+                result += old[offset:offset + length]
+            else:
+                result += bytes((old[offset + i] + patch[position + i]) & 0xFF for i in range(length))
+                position += length
+        elif command == INSERT:
+            length, = struct.unpack_from('<I', patch, position + 1)
+            position += 5
+            result += patch[position:position + length]
+            position += length
+        else:
+            raise ValueError('unknown command %d' % command)
+        if len(result) > target_size:
+            raise ValueError('command out of range')
+    if position != len(patch):
+        raise ValueError('data after the end of the patch')
+    return bytes(result)
+
+
+# 4 KB, the window the thermostat decompresses with (Inflater::windowSize), it rejects streams with a larger one
+WINDOW_BITS = 12
+
+
+def compress(data):
+    compressor = zlib.compressobj(9, zlib.DEFLATED, WINDOW_BITS)
+    return compressor.compress(data) + compressor.flush()
+
+
+def make_checked_patch(old, new):
+    """Returns the compressed patch from old to new, after checking that it rebuilds new."""
+    patch = make_patch(old, new)
+    if apply_patch(old, patch) != new:
+        raise RuntimeError('the patch doesn\'t rebuild the image')
+    return compress(patch)
+
+
+def read(path):
+    with open(path, 'rb') as file:
+        return file.read()
+
+
+def write(path, data):
+    with open(path, 'wb') as file:
+        file.write(data)
+
+
+def report(name, size, image_size):
+    print('%s: %d bytes, %.1f%% of the image' % (name, size, 100.0 * size / image_size))
+
+
+def release(args):
+    new = read(args.image)
+    name = os.path.basename(args.image)
+    os.makedirs(args.output, exist_ok=True)
+    write(os.path.join(args.output, name), new)
+    description = {
+        'version': args.version,
+        'url': args.base_url + name,
+        'sha256': hashlib.sha256(new).hexdigest(),
+        'deltas': [],
+    }
+    smallest = len(new)
+    compressed = compress(new)
+    if len(compressed) < smallest:
+        write(os.path.join(args.output, name + '.z'), compressed)
+        report(name + '.z', len(compressed), len(new))
+        description['compressed'] = args.base_url + name + '.z'
+        smallest = len(compressed)
+
+    for path in args.old:
+        old = read(path)
+        source_sha256 = image_sha256(old).hex()
+        patch_name = '%s-from-%s.patch' % (name, source_sha256[:16])
+        patch = make_checked_patch(old, new)
+        # a patch that isn't smaller than the image is of no use
+        if len(patch) >= smallest:
+            print('%s: the patch isn\'t smaller than the image, skipped' % path)
+            continue
+        write(os.path.join(args.output, patch_name), patch)
+        report(patch_name, len(patch), len(new))
+        description['deltas'].append({'from': source_sha256, 'url': args.base_url + patch_name})
+
+    with open(os.path.join(args.output, 'latest.json'), 'w') as file:
+        json.dump(description, file, indent=2)
+
+
+def delta(args):
+    old, new = read(args.old), read(args.new)
+    patch = make_checked_patch(old, new)
+    write(args.output, patch)
+    report(args.output, len(patch), len(new))
+
+
+def apply(args):
+    write(args.output, apply_patch(read(args.old), zlib.decompress(read(args.patch))))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Makes the compressed image and the patches for firmware updates.')
+    commands = parser.add_subparsers(dest='command')
+    commands.required = True
+
+    parser_release = commands.add_parser('release', help='writes the image, its compressed version, the patches and latest.json')
+    parser_release.add_argument('image', help='the new image')
+    parser_release.add_argument('--version', required=True, help='the version of the new image, for example 1.3.0')
+    parser_release.add_argument('--base-url', required=True, help='the URL the output directory is published at, ending with /')
+    parser_release.add_argument('--from', dest='old', action='append', default=[], help='an image to make a patch from')
+    parser_release.add_argument('-o', '--output', required=True, help='the output directory')
+    parser_release.set_defaults(function=release)
+
+    parser_delta = commands.add_parser('delta', help='makes a patch from one image to another')
+    parser_delta.add_argument('old')
+    parser_delta.add_argument('new')
+    parser_delta.add_argument('-o', '--output', required=True)
+    parser_delta.set_defaults(function=delta)
+
+    parser_apply = commands.add_parser('apply', help='applies a patch, the way the thermostat does')
+    parser_apply.add_argument('old')
+    parser_apply.add_argument('patch')
+    parser_apply.add_argument('-o', '--output', required=True)
+    parser_apply.set_defaults(function=apply)
+
+    args = parser.parse_args()
+    try:
+        args.function(args)
+    except (OSError, ValueError, RuntimeError) as error:
+        sys.exit(str(error))
+
+
+if __name__ == '__main__':
+    main()
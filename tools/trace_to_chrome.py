@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+
+#    Copyright 2019-2020 Cosmin Popan
+#
+#    This file is part of ThermostatESP32
+#
+#    ThermostatESP32 is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    ThermostatESP32 is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with ThermostatESP32. If not, see <https://www.gnu.org/licenses/>.
+
+"""Converts a trace dump from the serial output of the thermostat to the Chrome trace format.
+
+Build with TRACE_ENABLED set to 1 in CMakeLists.txt, hold Down on the main screen to print the trace,
+save the serial output and run:
+    tools/trace_to_chrome.py serial.log -o trace.json
+then open trace.json in https://ui.perfetto.dev or chrome://tracing.
+
+Spans are shown on the track of the task that recorded them, spans recorded from interrupts on a track per core,
+and the task that was running on each core on a track of its own.
+"""
+
+import argparse
+import json
+import sys
+
+# must match TraceEventType in components/Trace/Trace.h
+BEGIN, END, ISR_BEGIN, ISR_END, TASK_SWITCH = range(5)
+
+TASKS_PID = 1
+CORES_PID = 2
+INTERRUPTS_PID = 3
+
+
+def parse_dump(lines):
+    """Returns the frequency of the timestamps, span names, task names and events of the last dump in lines."""
+    dump = None
+    for line in lines:
+        # the dump can be preceded by anything on the same line, for example by the prefix of a serial monitor
+        position = line.find('TRACE ')
+        if position == -1:
+            continue
+        fields = line[position:].split()
+        kind = fields[1] if len(fields) > 1 else ''
+        if kind == 'BEGIN':
+            dump = {'frequency': int(fields[2]), 'spans': {}, 'tasks': {}, 'events': []}
+        elif dump is None:
+            continue
+        elif kind == 'SPAN':
+            dump['spans'][int(fields[2])] = ' '.join(fields[3:])
+        elif kind == 'TASK':
+            dump['tasks'][int(fields[2], 16)] = ' '.join(fields[3:])
+        elif kind == 'EVENT':
+            timestamp, event_type, core = (int(field) for field in fields[2:5])
+            dump['events'].append((timestamp, event_type, core, int(fields[5], 16)))
+        elif kind == 'END':
+            result, dump = dump, None
+            yield result
+
+
+def unwrap_timestamps(events):
+    """The timestamps are the low 32 bits of a microsecond timer both cores share, so they overflow every 71 minutes.
+    The events are in the order they were recorded, so every timestamp is taken relative to the previous one.
+    Gaps longer than half of the timer's period (about 36 minutes) can't be told apart from shorter ones.
+    """
+    result = []
+    previous = None
+    current = 0
+    for timestamp, event_type, core, data in events:
+        if previous is not None:
+            delta = (timestamp - previous) & 0xFFFFFFFF
+            if delta >= 0x80000000:
+                # a core reads the time after taking its place in the buffer,
+                # so an event of the other core that took the next place can have an earlier time
+                delta -= 0x100000000
+            current += delta
+        previous = timestamp
+        result.append((current, event_type, core, data))
+    return result
+
+
+def convert(dump):
+    frequency_mhz = dump['frequency'] / 1e6
+    spans = dump['spans']
+    tasks = dump['tasks']
+
+    def task_name(handle):
+        return tasks.get(handle, 'task 0x%x' % handle)
+
+    trace_events = [
+        {'ph': 'M', 'name': 'process_name', 'pid': TASKS_PID, 'args': {'name': 'Tasks'}},
+        {'ph': 'M', 'name': 'process_name', 'pid': CORES_PID, 'args': {'name': 'Cores'}},
+        {'ph': 'M', 'name': 'process_name', 'pid': INTERRUPTS_PID, 'args': {'name': 'Interrupts'}},
+    ]
+    named_threads = set()
+
+    def name_thread(pid, tid, name):
+        if (pid, tid) not in named_threads:
+            named_threads.add((pid, tid))
+            trace_events.append({'ph': 'M', 'name': 'thread_name', 'pid': pid, 'tid': tid, 'args': {'name': name}})
+
+    running = {}  # core -> (task, start)
+    events = unwrap_timestamps(dump['events'])
+    for timestamp, event_type, core, data in events:
+        ts = timestamp / frequency_mhz
+        if event_type == TASK_SWITCH:
+            previous = running.get(core)
+            if previous and previous[0] != data:
+                name_thread(CORES_PID, core, 'Core %d' % core)
+                trace_events.append({'ph': 'X', 'name': task_name(previous[0]), 'pid': CORES_PID, 'tid': core,
+                                     'ts': previous[1], 'dur': ts - previous[1]})
+            if not previous or previous[0] != data:
+                running[core] = (data, ts)
+        elif event_type in (BEGIN, END):
+            # the task is unknown until the first task switch on the core
+            task = running[core][0] if core in running else 0
+            name_thread(TASKS_PID, task, task_name(task) if task else 'unknown task')
+            trace_events.append({'ph': 'B' if event_type == BEGIN else 'E', 'name': spans.get(data, 'span %d' % data),
+                                 'pid': TASKS_PID, 'tid': task, 'ts': ts})
+        elif event_type in (ISR_BEGIN, ISR_END):
+            name_thread(INTERRUPTS_PID, core, 'Core %d' % core)
+            trace_events.append({'ph': 'B' if event_type == ISR_BEGIN else 'E', 'name': spans.get(data, 'span %d' % data),
+                                 'pid': INTERRUPTS_PID, 'tid': core, 'ts': ts})
+
+    # the tasks that were still running when the trace was dumped
+    if events:
+        end = events[-1][0] / frequency_mhz
+        for core, (task, start) in running.items():
+            name_thread(CORES_PID, core, 'Core %d' % core)
+            trace_events.append({'ph': 'X', 'name': task_name(task), 'pid': CORES_PID, 'tid': core,
+                                 'ts': start, 'dur': end - start})
+
+    return {'traceEvents': trace_events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Converts a trace dump of the thermostat to a Chrome trace.')
+    parser.add_argument('input', nargs='?', type=argparse.FileType('r', errors='replace'), default=sys.stdin,
+                        help='serial output that contains the dump (default: stdin)')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout,
+                        help='Chrome trace JSON file (default: stdout)')
+    args = parser.parse_args()
+
+    dumps = list(parse_dump(args.input))
+    if not dumps:
+        sys.exit('No complete trace dump found')
+    # the last dump is the most recent one
+    json.dump(convert(dumps[-1]), args.output)
+
+
+if __name__ == '__main__':
+    main()